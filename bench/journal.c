@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "glassnote.h"
+#include "history.h"
+#include "journal.h"
+#include "session.h"
+#include "stroke.h"
+#include "table.h"
+#include "utils.h"
+
+#define N_STROKES 50000
+#define STROKE_MAX_PTS 400
+// one stroke in this many is erased again
+#define ERASE_EVERY 8
+// the overlay rests after this many strokes, when a snapshot may be taken
+#define REST_EVERY 500
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static float jitter(float amount) {
+    return ((float)rand() / RAND_MAX * 2.f - 1.f) * amount;
+}
+
+static struct gn_stroke *draw_stroke(struct gn_state *state) {
+    struct gn_stroke *stroke = create_stroke(state, 1.f + rand() % 12, rand());
+    size_t n = 2 + rand() % (STROKE_MAX_PTS - 2);
+    float x = rand() % 1920, y = rand() % 1080;
+    float angle = jitter(3.14159265f), turn = jitter(0.3f);
+    for (size_t i = 0; i < n; i++) {
+        if (rand() % 50 == 0) {
+            turn = jitter(0.3f);
+        }
+        angle += turn;
+        x += cosf(angle) * 2.f;
+        y += sinf(angle) * 2.f;
+        extend_stroke(stroke, x, y, NULL);
+    }
+    finish_stroke(stroke, NULL);
+    return stroke;
+}
+
+static size_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+static void init_state(struct gn_state *state, const char *session_path) {
+    *state = (struct gn_state){
+        .history = {.budget = GN_HISTORY_INIT_BUDGET},
+        .session_path = session_path,
+    };
+    init_stroke_table(&state->strokes);
+}
+
+static void cleanup_state(struct gn_state *state) {
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        destroy_stroke(stroke);
+    }
+    wl_list_for_each(stroke, &state->strokes.hidden, link) {
+        destroy_stroke(stroke);
+    }
+    cleanup_history(&state->history);
+    cleanup_stroke_table(&state->strokes);
+    cleanup_pool(&state->pool);
+    cleanup_session_maps(state);
+}
+
+// the restored canvas holds the same strokes, within the quantization
+static bool same_strokes(struct gn_state *a, struct gn_state *b) {
+    if (a->strokes.n_live != b->strokes.n_live) {
+        return false;
+    }
+    struct gn_stroke *sb = wl_container_of(b->strokes.order.next, sb, link);
+    struct gn_stroke *sa;
+    wl_list_for_each(sa, &a->strokes.order, link) {
+        if (sa->n_pts != sb->n_pts || sa->color != sb->color ||
+            sa->width != sb->width || !unpack_stroke(sb)) {
+            return false;
+        }
+        for (size_t i = 0; i < sa->n_pts; i++) {
+            struct gn_vec2 p = *stroke_pt(sa, i), q = *stroke_pt(sb, i);
+            if (fabsf(p.x - q.x) > 1.f / GN_SESSION_QUANT ||
+                fabsf(p.y - q.y) > 1.f / GN_SESSION_QUANT) {
+                return false;
+            }
+        }
+        sb = wl_container_of(sb->link.next, sb, link);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    srand(1);
+    char dir[] = "/tmp/glassnote-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Failed to create a directory for the session\n");
+        return EXIT_FAILURE;
+    }
+    char session_path[sizeof(dir) + 16], journal_path[sizeof(dir) + 32];
+    sprintf(session_path, "%s/session", dir);
+    sprintf(journal_path, "%s.journal", session_path);
+
+    // a session drawn and partly erased, cut off without a last snapshot
+    struct gn_state drawn;
+    init_state(&drawn, session_path);
+    if (open_journal(&drawn) != GN_JOURNAL_OPENED) {
+        return EXIT_FAILURE;
+    }
+    double record_ns = 0.;
+    // drawn until N_STROKES are left
+    size_t n_drawn = 0;
+    for (; drawn.strokes.n_live < N_STROKES; n_drawn++) {
+        struct gn_stroke *stroke = draw_stroke(&drawn);
+        double st = now_ns();
+        history_add(&drawn, stroke);
+        if (n_drawn % ERASE_EVERY == 0) {
+            history_erase(&drawn, stroke);
+        }
+        record_ns += now_ns() - st;
+        if (n_drawn % REST_EVERY == REST_EVERY - 1) {
+            maybe_compact_journal(&drawn);
+        }
+    }
+    record_ns /= n_drawn;
+    bool written = close_journal(&drawn);
+
+    size_t session_sz = file_size(session_path);
+    size_t journal_sz = file_size(journal_path);
+    struct gn_state restored;
+    init_state(&restored, session_path);
+    double st = now_ns();
+    bool opened = open_journal(&restored) == GN_JOURNAL_OPENED;
+    double replay_ms = (now_ns() - st) / 1e6;
+    bool same = written && opened && same_strokes(&drawn, &restored);
+    close_journal(&restored);
+
+    printf("%zu strokes, session %zu bytes, journal %zu bytes\n",
+           drawn.strokes.n_live, session_sz, journal_sz);
+    printf("record: %.1f ns/stroke on the drawing thread\n", record_ns);
+    printf("restore: %.2f ms, %.0f strokes/s, %.1f MiB/s: %s\n", replay_ms,
+           drawn.strokes.n_live / (replay_ms / 1e3),
+           (session_sz + journal_sz) / (replay_ms / 1e3) / (1 << 20),
+           same ? "ok" : "FAIL");
+
+    cleanup_state(&drawn);
+    cleanup_state(&restored);
+    unlink(journal_path);
+    unlink(session_path);
+    rmdir(dir);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
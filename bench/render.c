@@ -0,0 +1,1014 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl32.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "glassnote.h"
+#include "grid.h"
+#include "history.h"
+#include "pool.h"
+#include "predict.h"
+#include "render.h"
+#include "seat.h"
+#include "stroke.h"
+#include "table.h"
+#include "trace.h"
+#include "utils.h"
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+// buffers the compositor would cycle through, which is the buffer age
+#define N_BUFFERS 3
+#define SAMPLES 4
+#define FRAME_US 16667
+#define INIT_FRAMES 1024
+#define INIT_MOTIONS 4096
+// slowest pointer whose lag is measured in time, in px per ms
+#define MIN_LAG_SPEED 0.05
+
+// the overlay without a compositor: input goes straight to the seat
+// handlers and frames are drawn into offscreen buffers on a vblank clock
+struct bench {
+    struct gn_state state;
+    struct gn_output output;
+    struct gn_seat seat;
+    // buffers are this many times the output's size
+    float scale;
+
+    GLuint fbos[N_BUFFERS], rbos[N_BUFFERS];
+    // gpu time of the frames drawn into each buffer, read once it is reused
+    GLuint queries[N_BUFFERS];
+    bool queried[N_BUFFERS];
+    double query_start_ns[N_BUFFERS];
+    PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_ui64;
+
+    uint64_t now_us, next_frame_us;
+    size_t n_frames;
+    // per frame measured, in ms
+    double *cpu_ms, *gpu_ms;
+    size_t n_cpu, n_gpu, c_frames;
+
+    double input_ns;
+    size_t n_events;
+    size_t pts_kept, pts_reported;
+
+    // a scenario found the canvas other than it should be
+    bool failed;
+
+    // the motion replayed, to measure the prediction against
+    struct motion *motions;
+    size_t n_motions, c_motions;
+};
+
+struct motion {
+    uint64_t time_us;
+    uint32_t seat;
+    // the seat is drawing a stroke
+    bool drawing;
+    struct gn_vec2 pt;
+};
+
+void noop() {}
+
+void set_output_dirty(struct gn_output *output) { output->dirty = true; }
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static float jitter(float amount) {
+    return ((float)rand() / RAND_MAX * 2.f - 1.f) * amount;
+}
+
+static bool has_extension(const char *extensions, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = extensions; p != NULL && *p != '\0';) {
+        if (strncmp(p, name, len) == 0 && (p[len] == ' ' || p[len] == '\0')) {
+            return true;
+        }
+        p = strchr(p, ' ');
+        p = p != NULL ? p + 1 : NULL;
+    }
+    return false;
+}
+
+static bool has_gl_extension(const char *name) {
+    GLint n;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for (GLint i = 0; i < n; i++) {
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a surfaceless display where there is one, Mesa's llvmpipe is enough
+static bool init_headless_egl(struct gn_state *state, EGLSurface *surface) {
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const char *client = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (get_platform_display != NULL &&
+        has_extension(client, "EGL_MESA_platform_surfaceless")) {
+        state->egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                                  EGL_DEFAULT_DISPLAY, NULL);
+    } else {
+        state->egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (state->egl_display == EGL_NO_DISPLAY ||
+        eglInitialize(state->egl_display, NULL, NULL) != EGL_TRUE) {
+        return false;
+    }
+
+    // clang-format off
+    const EGLint config_attribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+        EGL_RED_SIZE,        8,
+        EGL_NONE
+    };
+    // clang-format on
+    EGLint num_configs;
+    if (!eglChooseConfig(state->egl_display, config_attribs,
+                         &state->egl_config, 1, &num_configs) ||
+        num_configs == 0) {
+        return false;
+    }
+    const EGLint ctx_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3,
+                                  EGL_CONTEXT_MINOR_VERSION, 2, EGL_NONE};
+    state->egl_context = eglCreateContext(state->egl_display, state->egl_config,
+                                          EGL_NO_CONTEXT, ctx_attribs);
+    if (state->egl_context == EGL_NO_CONTEXT) {
+        return false;
+    }
+    // frames go to framebuffers of their own, the surface is never drawn to
+    const EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    *surface = eglCreatePbufferSurface(state->egl_display, state->egl_config,
+                                       pbuffer_attribs);
+    return eglMakeCurrent(state->egl_display, *surface, *surface,
+                          state->egl_context) == EGL_TRUE;
+}
+
+static void init_bench(struct bench *b, EGLDisplay display, EGLContext ctx,
+                       float predict_ms, float scale, bool curves) {
+    *b = (struct bench){
+        .state =
+            {
+                .active = true,
+                .egl_display = display,
+                .egl_context = ctx,
+                .bg_colors = {GN_STATE_INIT_BG_COLOR_INACTIVE,
+                              GN_STATE_INIT_BG_COLOR_ACTIVE},
+                .colors = {GN_STATE_INIT_COLOR_1, GN_STATE_INIT_COLOR_2,
+                           GN_STATE_INIT_COLOR_3, GN_STATE_INIT_COLOR_4,
+                           GN_STATE_INIT_COLOR_5},
+                .cur_stroke_width = GN_STATE_INIT_WIDTH,
+                .tool = GN_TOOL_PEN,
+                .eraser_radius = GN_STATE_INIT_ERASER_RADIUS,
+                .fit_curves = curves,
+                .predict_ms = predict_ms,
+                .history = {.budget = GN_HISTORY_INIT_BUDGET},
+                .canvas_listener = &display_canvas_listener,
+            },
+        .scale = scale,
+        .next_frame_us = FRAME_US,
+        .c_frames = INIT_FRAMES,
+    };
+    struct gn_state *state = &b->state;
+    init_stroke_table(&state->strokes);
+    wl_list_init(&state->seats);
+    wl_list_init(&state->outputs);
+    // one output at the origin of the global space
+    b->output.state = state;
+    wl_list_init(&b->output.feedback);
+    wl_list_insert(&state->outputs, &b->output.link);
+    b->seat.state = state;
+    wl_list_insert(&state->seats, &b->seat.link);
+
+    glGenFramebuffers(N_BUFFERS, b->fbos);
+    glGenRenderbuffers(N_BUFFERS, b->rbos);
+    for (size_t i = 0; i < N_BUFFERS; i++) {
+        glBindRenderbuffer(GL_RENDERBUFFER, b->rbos[i]);
+        glBindFramebuffer(GL_FRAMEBUFFER, b->fbos[i]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_RENDERBUFFER, b->rbos[i]);
+    }
+    if (has_gl_extension("GL_EXT_disjoint_timer_query")) {
+        b->get_query_ui64 = (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress(
+            "glGetQueryObjectui64vEXT");
+        glGenQueries(N_BUFFERS, b->queries);
+    }
+    b->cpu_ms = malloc(b->c_frames * sizeof(double));
+    b->gpu_ms = malloc(b->c_frames * sizeof(double));
+}
+
+// what layer_surface_handle_configure does, the buffers take the new size
+// times the scale
+static void configure(struct bench *b, int32_t width, int32_t height) {
+    struct gn_state *state = &b->state;
+    int32_t buffer_width = lroundf(width * b->scale);
+    int32_t buffer_height = lroundf(height * b->scale);
+    for (size_t i = 0; i < N_BUFFERS; i++) {
+        glBindRenderbuffer(GL_RENDERBUFFER, b->rbos[i]);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, SAMPLES, GL_RGBA8,
+                                         buffer_width, buffer_height);
+    }
+    b->output.width = width;
+    b->output.height = height;
+    b->output.buffer_width = buffer_width;
+    b->output.buffer_height = buffer_height;
+    if (!b->output.configured) {
+        b->output.configured = true;
+        glBindFramebuffer(GL_FRAMEBUFFER, b->fbos[0]);
+        init_gl(state);
+        // only errors raised while drawing frames are counted
+        glGetError();
+    }
+    resize_grid(state, 0, 0, width, height);
+    glViewport(0, 0, buffer_width, buffer_height);
+    b->output.damage.full = true;
+}
+
+static void read_query(struct bench *b, size_t buf) {
+    if (!b->queried[buf]) {
+        return;
+    }
+    b->queried[buf] = false;
+    GLuint64 ns;
+    b->get_query_ui64(b->queries[buf], GL_QUERY_RESULT, &ns);
+    // set if the timer was thrown off while the result was measured. llvmpipe
+    // gives the first frame a time longer than the wait for it.
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (!disjoint && ns <= now_ns() - b->query_start_ns[buf]) {
+        b->gpu_ms[b->n_gpu++] = ns / 1e6;
+    }
+}
+
+// what send_frame does, with the swap replaced by moving to the next buffer
+static void draw_frame(struct bench *b) {
+    struct gn_output *output = &b->output;
+    if (b->n_cpu == b->c_frames) {
+        b->c_frames *= 2;
+        b->cpu_ms = realloc(b->cpu_ms, b->c_frames * sizeof(double));
+        b->gpu_ms = realloc(b->gpu_ms, b->c_frames * sizeof(double));
+    }
+
+    size_t buf = b->n_frames % N_BUFFERS;
+    int age = b->n_frames < N_BUFFERS ? 0 : N_BUFFERS;
+    glBindFramebuffer(GL_FRAMEBUFFER, b->fbos[buf]);
+    bool predicted = predict_tails(&b->state, output, b->now_us * 1000);
+    struct gn_damage repaint = repaint_damage(output, age);
+
+    if (b->get_query_ui64 != NULL) {
+        read_query(b, buf);
+        glBeginQuery(GL_TIME_ELAPSED_EXT, b->queries[buf]);
+        b->query_start_ns[buf] = now_ns();
+    }
+    double st = now_ns();
+    render(&b->state, output, &repaint);
+    b->cpu_ms[b->n_cpu++] = (now_ns() - st) / 1e6;
+    if (b->get_query_ui64 != NULL) {
+        glEndQuery(GL_TIME_ELAPSED_EXT);
+        b->queried[buf] = true;
+    }
+    glFlush();
+
+    push_damage(output);
+    output->dirty = predicted;
+    b->n_frames++;
+}
+
+// moves the trace to time t, drawing the frames due by then
+static void advance(struct bench *b, uint64_t t) {
+    while (b->next_frame_us <= t) {
+        b->now_us = b->next_frame_us;
+        struct gn_output *output = &b->output;
+        if (output->configured && (output->dirty || output->damage.full)) {
+            draw_frame(b);
+        }
+        b->next_frame_us += FRAME_US;
+    }
+    b->now_us = t;
+}
+
+static void press(struct bench *b, uint64_t t, float x, float y) {
+    advance(b, t);
+    double st = now_ns();
+    struct gn_vec2 prev = b->seat.pointer_loc;
+    b->seat.pointer_loc = (struct gn_vec2){x, y};
+    seat_handle_moved(&b->seat, prev);
+    if (b->state.predict_ms > 0.f) {
+        seat_sample_motion(&b->seat, t, t * 1000, b->seat.pointer_loc);
+    }
+    seat_handle_pressed(&b->seat);
+    b->input_ns += now_ns() - st;
+    b->n_events++;
+}
+
+static void move(struct bench *b, uint64_t t, float x, float y) {
+    advance(b, t);
+    double st = now_ns();
+    struct gn_vec2 prev = b->seat.pointer_loc;
+    b->seat.pointer_loc = (struct gn_vec2){x, y};
+    seat_handle_moved(&b->seat, prev);
+    if (b->state.predict_ms > 0.f) {
+        seat_sample_motion(&b->seat, t, t * 1000, b->seat.pointer_loc);
+    }
+    b->input_ns += now_ns() - st;
+    b->n_events++;
+}
+
+// counts the points of a stroke once it is finished
+static void count_pts(struct bench *b, struct gn_stroke_handle handle) {
+    struct gn_stroke *stroke = stroke_table_get(&b->state.strokes, handle);
+    if (stroke != NULL && stroke->finished) {
+        b->pts_kept += stroke->n_pts;
+        b->pts_reported += stroke->pts_reported;
+    }
+}
+
+static void release(struct bench *b, uint64_t t) {
+    advance(b, t);
+    struct gn_stroke_handle handle = b->seat.cur_stroke;
+    double st = now_ns();
+    seat_handle_released(&b->seat);
+    b->input_ns += now_ns() - st;
+    b->n_events++;
+    count_pts(b, handle);
+}
+
+// a touch frame in which n points, with ids 0 to n - 1, go down at pts
+static void touch_down(struct bench *b, uint64_t t, const struct gn_vec2 *pts,
+                       size_t n) {
+    advance(b, t);
+    double st = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        seat_handle_touch_down(&b->seat, i, pts[i]);
+    }
+    seat_handle_touch_frame(&b->seat);
+    b->input_ns += now_ns() - st;
+    b->n_events += n;
+}
+
+// a touch frame in which they all move to pts
+static void touch_move(struct bench *b, uint64_t t, const struct gn_vec2 *pts,
+                       size_t n) {
+    advance(b, t);
+    double st = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        seat_handle_touch_motion(&b->seat, i, pts[i]);
+    }
+    seat_handle_touch_frame(&b->seat);
+    b->input_ns += now_ns() - st;
+    b->n_events += n;
+}
+
+// a touch frame in which they are all lifted
+static void touch_up(struct bench *b, uint64_t t, size_t n) {
+    advance(b, t);
+    struct gn_stroke_handle handles[GN_SEAT_MAX_TOUCHES];
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        handles[i] = b->seat.touches[i].stroke;
+    }
+    double st = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        seat_handle_touch_up(&b->seat, i);
+    }
+    seat_handle_touch_frame(&b->seat);
+    b->input_ns += now_ns() - st;
+    b->n_events += n;
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        count_pts(b, handles[i]);
+    }
+}
+
+// a touch frame in which the compositor takes them all over
+static void touch_cancel(struct bench *b, uint64_t t) {
+    advance(b, t);
+    double st = now_ns();
+    seat_handle_touch_cancel(&b->seat);
+    b->input_ns += now_ns() - st;
+    b->n_events++;
+}
+
+static void undo(struct bench *b, uint64_t t, bool redo) {
+    advance(b, t);
+    double st = now_ns();
+    seat_handle_released(&b->seat);
+    if (redo) {
+        history_redo(&b->state);
+    } else {
+        history_undo(&b->state);
+    }
+    b->input_ns += now_ns() - st;
+    b->n_events++;
+}
+
+// leaves out what was drawn so far, such as the canvas a scenario starts from
+static void start_measuring(struct bench *b) {
+    glFinish();
+    for (size_t i = 0; i < N_BUFFERS; i++) {
+        b->queried[i] = false;
+    }
+    b->n_cpu = b->n_gpu = 0;
+    b->input_ns = 0.;
+    b->n_events = b->pts_kept = b->pts_reported = 0;
+}
+
+// a wandering drag of n events, rate_hz of them a second, from time t
+static uint64_t drag(struct bench *b, uint64_t t, size_t n, float rate_hz,
+                     float speed) {
+    float x = 100 + rand() % (OUTPUT_WIDTH - 200);
+    float y = 100 + rand() % (OUTPUT_HEIGHT - 200);
+    float angle = jitter(3.14159265f), turn = jitter(0.1f);
+    float step = speed / rate_hz;
+    uint64_t dt = 1e6f / rate_hz;
+    press(b, t, x, y);
+    for (size_t i = 0; i < n; i++) {
+        if (rand() % 40 == 0) {
+            turn = jitter(0.15f);
+        }
+        angle += turn;
+        x = fminf(fmaxf(x + cosf(angle) * step, 0), OUTPUT_WIDTH);
+        y = fminf(fmaxf(y + sinf(angle) * step, 0), OUTPUT_HEIGHT);
+        t += dt;
+        move(b, t, x, y);
+    }
+    t += dt;
+    release(b, t);
+    return t;
+}
+
+// a canvas of n strokes, drawn within a few frames
+static uint64_t fill(struct bench *b, uint64_t t, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        t = drag(b, t, 200 + rand() % 400, 1e6f, 2e6f);
+    }
+    start_measuring(b);
+    return t;
+}
+
+// short strokes with pauses between them, a 240 Hz pen
+static uint64_t handwriting(struct bench *b, uint64_t t) {
+    for (size_t i = 0; i < 150; i++) {
+        t = drag(b, t, 60 + rand() % 200, 240.f, 300.f);
+        t += 50000 + rand() % 150000;
+    }
+    return t;
+}
+
+// a stroke held for half a minute, from a 1000 Hz mouse
+static uint64_t long_drag(struct bench *b, uint64_t t) {
+    return drag(b, t, 30000, 1000.f, 400.f);
+}
+
+// a full canvas cut up with the pixel eraser
+static uint64_t pixel_erase(struct bench *b, uint64_t t) {
+    t = fill(b, t, 400);
+    b->state.tool = GN_TOOL_PIXEL_ERASER;
+    for (size_t i = 0; i < 20; i++) {
+        t = drag(b, t, 240, 240.f, 800.f) + 50000;
+    }
+    b->state.tool = GN_TOOL_PEN;
+    return t;
+}
+
+// a full canvas taken down and put back one step a frame
+static uint64_t undo_redo(struct bench *b, uint64_t t) {
+    size_t n = 400;
+    t = fill(b, t, n);
+    for (size_t i = 0; i < 2 * n; i++) {
+        t += FRAME_US;
+        undo(b, t, i >= n);
+    }
+    return t;
+}
+
+// n fingers drawing at once on a 120 Hz touchscreen, each touch frame moving
+// all of them, lifted together after a second or two, or taken over by the
+// compositor if cancel is set
+static uint64_t touches(struct bench *b, uint64_t t, size_t n, bool cancel) {
+    struct gn_vec2 pts[GN_SEAT_MAX_TOUCHES];
+    float angles[GN_SEAT_MAX_TOUCHES], turns[GN_SEAT_MAX_TOUCHES];
+    float rate_hz = 120.f, step = 300.f / rate_hz;
+    uint64_t dt = 1e6f / rate_hz;
+    for (size_t round = 0; round < 20; round++) {
+        for (size_t i = 0; i < n; i++) {
+            pts[i].x = 100 + rand() % (OUTPUT_WIDTH - 200);
+            pts[i].y = 100 + rand() % (OUTPUT_HEIGHT - 200);
+            angles[i] = jitter(3.14159265f);
+            turns[i] = jitter(0.1f);
+        }
+        touch_down(b, t, pts, n);
+        for (size_t j = 120 + rand() % 120; j > 0; j--) {
+            for (size_t i = 0; i < n; i++) {
+                if (rand() % 40 == 0) {
+                    turns[i] = jitter(0.15f);
+                }
+                angles[i] += turns[i];
+                pts[i].x = fminf(
+                    fmaxf(pts[i].x + cosf(angles[i]) * step, 0), OUTPUT_WIDTH);
+                pts[i].y = fminf(
+                    fmaxf(pts[i].y + sinf(angles[i]) * step, 0), OUTPUT_HEIGHT);
+            }
+            t += dt;
+            touch_move(b, t, pts, n);
+        }
+        t += dt;
+        if (cancel) {
+            touch_cancel(b, t);
+        } else {
+            touch_up(b, t, n);
+        }
+        t += 200000;
+    }
+    return t;
+}
+
+static uint64_t touch_1(struct bench *b, uint64_t t) {
+    return touches(b, t, 1, false);
+}
+
+static uint64_t touch_5(struct bench *b, uint64_t t) {
+    return touches(b, t, 5, false);
+}
+
+// as many fingers as there are
+static uint64_t touch_10(struct bench *b, uint64_t t) {
+    return touches(b, t, 10, false);
+}
+
+// fingers drawing over a canvas that a system gesture takes over, which
+// leaves the canvas and its history as they were
+static uint64_t cancelled_touches(struct bench *b, uint64_t t) {
+    t = fill(b, t, 100);
+    uint32_t hash = hash_strokes(&b->state);
+    size_t n_live = b->state.strokes.n_live;
+    size_t n_cmds = b->state.history.n;
+    t = touches(b, t, 5, true);
+    if (hash_strokes(&b->state) != hash ||
+        b->state.strokes.n_live != n_live || b->state.history.n != n_cmds) {
+        fprintf(stderr, "Cancelled touch points left strokes behind\n");
+        b->failed = true;
+    }
+    return t;
+}
+
+// keeps where the pointer of seat is after a motion replayed at time_us
+static void add_motion(struct bench *b, uint64_t time_us, uint32_t id) {
+    struct gn_seat *seat, *found = NULL;
+    wl_list_for_each(seat, &b->state.seats, link) {
+        if (seat->id == id) {
+            found = seat;
+        }
+    }
+    if (found == NULL) {
+        return;
+    }
+    if (b->n_motions == b->c_motions) {
+        size_t c_motions = b->c_motions == 0 ? INIT_MOTIONS : b->c_motions * 2;
+        struct motion *motions =
+            realloc(b->motions, c_motions * sizeof(struct motion));
+        if (motions == NULL) {
+            return;
+        }
+        b->motions = motions;
+        b->c_motions = c_motions;
+    }
+    b->motions[b->n_motions++] = (struct motion){
+        .time_us = time_us,
+        .seat = id,
+        .drawing =
+            stroke_table_get(&b->state.strokes, found->cur_stroke) != NULL,
+        .pt = found->pointer_loc,
+    };
+}
+
+// feeds a recorded trace to the seats, as fast as frames are drawn or at
+// the pace it was recorded at. end is the event the recording stopped with,
+// if it did. false if the trace is corrupt.
+static bool replay(struct bench *b, struct gn_trace_reader *reader,
+                   bool realtime, struct gn_trace_event *end) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct gn_trace_event event;
+    int ret;
+    while ((ret = next_trace_event(reader, &event)) > 0) {
+        if (realtime) {
+            uint64_t ns = start.tv_nsec + event.time_us * 1000;
+            struct timespec due = {start.tv_sec + ns / 1000000000,
+                                   ns % 1000000000};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due,
+                                   NULL) == EINTR) {
+            }
+        }
+        advance(b, event.time_us);
+        if (event.type == GN_TRACE_CONFIGURE) {
+            configure(b, event.x, event.y);
+            continue;
+        }
+        if (event.type == GN_TRACE_END) {
+            *end = event;
+            continue;
+        }
+
+        // the strokes the event may finish, the pointer's and the touch
+        // points'
+        struct gn_stroke_handle handles[1 + GN_SEAT_MAX_TOUCHES] = {0};
+        struct gn_seat *seat;
+        wl_list_for_each(seat, &b->state.seats, link) {
+            if (seat->id != event.seat) {
+                continue;
+            }
+            handles[0] = seat->cur_stroke;
+            for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+                handles[1 + i] = seat->touches[i].stroke;
+            }
+        }
+        double st = now_ns();
+        replay_trace_event(&b->state, &event);
+        b->input_ns += now_ns() - st;
+        b->n_events++;
+        for (size_t i = 0; i < 1 + GN_SEAT_MAX_TOUCHES; i++) {
+            count_pts(b, handles[i]);
+        }
+        if (event.type == GN_TRACE_MOTION && b->state.predict_ms > 0.f) {
+            add_motion(b, event.time_us, event.seat);
+        }
+    }
+    advance(b, reader->time_us + FRAME_US);
+    return ret == 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_times(double *ms, size_t n) {
+    if (n == 0) {
+        printf(" %23s", "-");
+        return;
+    }
+    qsort(ms, n, sizeof(double), compare_doubles);
+    printf(" %7.3f %7.3f %7.3f", ms[n / 2], ms[n * 99 / 100], ms[n - 1]);
+}
+
+static void report(struct bench *b, const char *name) {
+    struct gn_state *state = &b->state;
+    struct gn_pool_usage pool = pool_usage(&state->pool);
+    size_t store = state->gl.store.c_instances *
+                       sizeof(struct gn_lines_instance) +
+                   state->gl.curve_store.c_instances *
+                       sizeof(struct gn_curves_instance);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%-12s %6zu", name, b->n_cpu);
+    print_times(b->cpu_ms, b->n_cpu);
+    print_times(b->gpu_ms, b->n_gpu);
+    double event_us = b->n_events > 0 ? b->input_ns / b->n_events / 1e3 : 0.;
+    printf(" %8.2f %9zu %9zu %8zu %8zu %8ld\n", event_us, b->pts_kept,
+           b->pts_reported, pool.reserved_bytes >> 10, store >> 10,
+           usage.ru_maxrss >> 10);
+}
+
+// where the pointer of the seat of motions[i] was at time_us, from the
+// motions after it. false if it had stopped, or the trace ended, before then.
+static bool motion_at(struct bench *b, size_t i, uint64_t time_us,
+                      struct gn_vec2 *pt, double *speed) {
+    const struct motion *prev = &b->motions[i];
+    for (size_t j = i + 1; j < b->n_motions; j++) {
+        const struct motion *next = &b->motions[j];
+        if (next->seat != prev->seat) {
+            continue;
+        }
+        if (next->time_us - prev->time_us > GN_PREDICT_WINDOW_US) {
+            return false;
+        }
+        if (next->time_us >= time_us && next->time_us > prev->time_us) {
+            double dt = next->time_us - prev->time_us;
+            *pt = gn_vec2_lerp(prev->pt, next->pt,
+                               (time_us - prev->time_us) / dt);
+            *speed = gn_vec2_norm(gn_vec2_minus(next->pt, prev->pt)) /
+                     (dt / 1000.);
+            return true;
+        }
+        prev = next;
+    }
+    return false;
+}
+
+// how far from the pointer the tip of the stroke is predict_ms after each
+// motion drawn, with the tail the predictor draws and with none, in px and
+// in ms of pointer travel
+static void report_prediction(struct bench *b) {
+    float ahead_ms = b->state.predict_ms;
+    struct gn_predictor *predictors =
+        calloc(GN_TRACE_MAX_SEATS, sizeof(struct gn_predictor));
+    size_t n = b->n_motions;
+    double *err = malloc(n * sizeof(double));
+    double *err_none = malloc(n * sizeof(double));
+    double *lag = malloc(n * sizeof(double));
+    double *lag_none = malloc(n * sizeof(double));
+    if (predictors == NULL || err == NULL || err_none == NULL ||
+        lag == NULL || lag_none == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the prediction\n");
+        goto out;
+    }
+
+    size_t n_err = 0, n_lag = 0;
+    double sum = 0., sum_none = 0.;
+    for (size_t i = 0; i < n; i++) {
+        const struct motion *m = &b->motions[i];
+        if (m->seat >= GN_TRACE_MAX_SEATS) {
+            continue;
+        }
+        struct gn_predictor *predictor = &predictors[m->seat];
+        predictor_add(predictor, m->time_us, m->pt);
+        struct gn_vec2 actual;
+        double speed;
+        if (!m->drawing ||
+            !motion_at(b, i, m->time_us + ahead_ms * 1000, &actual, &speed)) {
+            continue;
+        }
+        // the tip stays where the pointer was without a prediction
+        struct gn_vec2 tip = m->pt;
+        predictor_predict(predictor, ahead_ms, &tip);
+        err[n_err] = gn_vec2_norm(gn_vec2_minus(tip, actual));
+        err_none[n_err] = gn_vec2_norm(gn_vec2_minus(m->pt, actual));
+        sum += err[n_err];
+        sum_none += err_none[n_err];
+        if (speed >= MIN_LAG_SPEED) {
+            lag[n_lag] = err[n_err] / speed;
+            lag_none[n_lag] = err_none[n_err] / speed;
+            n_lag++;
+        }
+        n_err++;
+    }
+    if (n_err == 0) {
+        printf("prediction   no motion drawn to measure it on\n");
+        goto out;
+    }
+    qsort(err, n_err, sizeof(double), compare_doubles);
+    qsort(err_none, n_err, sizeof(double), compare_doubles);
+    printf("prediction   %.0f ms ahead, %zu motions: error px mean/p95 "
+           "%.2f/%.2f, %.2f/%.2f without\n",
+           ahead_ms, n_err, sum / n_err, err[n_err * 95 / 100],
+           sum_none / n_err, err_none[n_err * 95 / 100]);
+    if (n_lag > 0) {
+        qsort(lag, n_lag, sizeof(double), compare_doubles);
+        qsort(lag_none, n_lag, sizeof(double), compare_doubles);
+        printf("             tip lag ms p50 %.2f, %.2f without, %.2f ms "
+               "gained\n",
+               lag[n_lag / 2], lag_none[n_lag / 2],
+               lag_none[n_lag / 2] - lag[n_lag / 2]);
+    }
+
+out:
+    free(predictors);
+    free(err);
+    free(err_none);
+    free(lag);
+    free(lag_none);
+}
+
+static void cleanup_bench(struct bench *b) {
+    struct gn_state *state = &b->state;
+    glFinish();
+    for (size_t i = 0; i < N_BUFFERS; i++) {
+        b->queried[i] = false;
+    }
+    if (b->output.configured) {
+        cleanup_gl(state);
+    }
+    // the seats a trace brought
+    wl_list_remove(&b->seat.link);
+    struct gn_seat *seat, *seat_tmp;
+    wl_list_for_each_safe(seat, seat_tmp, &state->seats, link) {
+        destroy_seat(seat);
+    }
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        destroy_stroke(stroke);
+    }
+    wl_list_for_each(stroke, &state->strokes.hidden, link) {
+        destroy_stroke(stroke);
+    }
+    cleanup_history(&state->history);
+    cleanup_stroke_table(&state->strokes);
+    cleanup_pool(&state->pool);
+    cleanup_grid(&state->grid);
+    if (b->get_query_ui64 != NULL) {
+        glDeleteQueries(N_BUFFERS, b->queries);
+    }
+    glDeleteFramebuffers(N_BUFFERS, b->fbos);
+    glDeleteRenderbuffers(N_BUFFERS, b->rbos);
+    free(b->cpu_ms);
+    free(b->gpu_ms);
+    free(b->motions);
+}
+
+static const struct scenario {
+    const char *name;
+    uint64_t (*run)(struct bench *b, uint64_t t);
+} scenarios[] = {
+    {"handwriting", handwriting},
+    {"long-drag", long_drag},
+    {"pixel-erase", pixel_erase},
+    {"undo-redo", undo_redo},
+    {"touch-1", touch_1},
+    {"touch-5", touch_5},
+    {"touch-10", touch_10},
+    {"touch-cancel", cancelled_touches},
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage:\n"
+            "  %s [SCENARIO...] [--predict MS] [--scale S] [--curves]\n"
+            "  %s --trace PATH [--realtime] [--predict MS] [--scale S]\n"
+            "\n"
+            "  SCENARIO        handwriting, long-drag, pixel-erase, "
+            "undo-redo, touch-1,\n"
+            "                  touch-5, touch-10 or touch-cancel, all of them "
+            "by default\n"
+            "  --trace PATH    replays input recorded by glassnote --record\n"
+            "  --realtime      at the pace it was recorded at, rather than "
+            "at once\n"
+            "  --predict MS    draws strokes MS ahead of the pointer, and "
+            "measures how\n"
+            "                  well the trace's motion is predicted\n"
+            "  --scale S       draws at S times the output's size, as on a "
+            "scaled output\n"
+            "  --curves        finished strokes are fitted with curves, as "
+            "with glassnote\n"
+            "                  --curves. a trace keeps the setting it was "
+            "recorded with.\n",
+            prog, prog);
+    exit(EXIT_FAILURE);
+}
+
+static void finish(struct bench *b, const char *name) {
+    glFinish();
+    for (size_t buf = 0; buf < N_BUFFERS; buf++) {
+        if (b->get_query_ui64 != NULL) {
+            read_query(b, buf);
+        }
+    }
+    report(b, name);
+}
+
+// replays the trace at path, false if it could not be, or drew other strokes
+// than were recorded
+static bool run_trace(struct bench *b, const char *path, bool realtime) {
+    struct gn_trace_reader reader;
+    if (!open_trace(&reader, &b->state, path)) {
+        return false;
+    }
+    struct gn_trace_event end = {0};
+    bool ok = replay(b, &reader, realtime, &end);
+    if (!ok) {
+        fprintf(stderr, "Failed to replay all of %s, it is corrupt\n", path);
+    }
+    finish(b, "trace");
+    if (b->state.predict_ms > 0.f) {
+        report_prediction(b);
+    }
+
+    uint32_t hash = hash_strokes(&b->state);
+    if (end.type != GN_TRACE_END) {
+        printf("strokes %08x, the recording was cut short\n", hash);
+    } else {
+        ok = ok && hash == end.code;
+        printf("strokes %08x, recorded %08x: %s\n", hash, end.code,
+               hash == end.code ? "ok" : "FAIL");
+    }
+    close_trace(&reader);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    const char *trace_path = NULL;
+    bool realtime = false;
+    float predict_ms = 0.f;
+    float scale = 1.f;
+    bool curves = false;
+    size_t n_scenarios = sizeof(scenarios) / sizeof(*scenarios);
+    int n_picked = 0;
+    for (int i = 1; i < argc; i++) {
+        bool known = false;
+        for (size_t j = 0; j < n_scenarios; j++) {
+            known |= strcmp(argv[i], scenarios[j].name) == 0;
+        }
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if (strcmp(argv[i], "--predict") == 0 && i + 1 < argc) {
+            char *end;
+            predict_ms = strtof(argv[++i], &end);
+            if (*end != '\0' || end == argv[i] || !(predict_ms > 0.f)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            char *end;
+            scale = strtof(argv[++i], &end);
+            if (*end != '\0' || end == argv[i] || !(scale >= 0.25f) ||
+                scale > 4.f) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--curves") == 0) {
+            curves = true;
+        } else if (known) {
+            n_picked++;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if ((trace_path != NULL && n_picked > 0) ||
+        (trace_path == NULL && realtime)) {
+        usage(argv[0]);
+    }
+
+    struct gn_state egl = {0};
+    EGLSurface surface;
+    if (!init_headless_egl(&egl, &surface)) {
+        fprintf(stderr, "Failed to create a headless EGL context\n");
+        return EXIT_FAILURE;
+    }
+    printf("%s, %d samples, buffer age %d, scale %.2f, ",
+           (const char *)glGetString(GL_RENDERER), SAMPLES, N_BUFFERS, scale);
+    if (trace_path != NULL) {
+        printf("%s\n", trace_path);
+    } else {
+        printf("%dx%d\n", OUTPUT_WIDTH, OUTPUT_HEIGHT);
+    }
+    printf("%-12s %6s %23s %23s %8s %9s %9s %8s %8s %8s\n", "", "frames",
+           "cpu ms p50/p99/max", "gpu ms p50/p99/max", "us/event", "pts kept",
+           "reported", "pool KiB", "gpu KiB", "rss MiB");
+
+    bool ok = true;
+    if (trace_path != NULL) {
+        struct bench b;
+        init_bench(&b, egl.egl_display, egl.egl_context, predict_ms, scale,
+                   curves);
+        ok = run_trace(&b, trace_path, realtime);
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            fprintf(stderr, "GL error %#x in %s\n", err, trace_path);
+            ok = false;
+        }
+        cleanup_bench(&b);
+    }
+
+    for (size_t i = 0; trace_path == NULL && i < n_scenarios; i++) {
+        // the scenarios named on the command line, all of them by default
+        bool picked = n_picked == 0;
+        for (int j = 1; j < argc; j++) {
+            picked |= strcmp(argv[j], scenarios[i].name) == 0;
+        }
+        if (!picked) {
+            continue;
+        }
+        // every scenario gets the same trace, whichever ran before it
+        srand(1);
+        struct bench b;
+        init_bench(&b, egl.egl_display, egl.egl_context, predict_ms, scale,
+                   curves);
+        configure(&b, OUTPUT_WIDTH, OUTPUT_HEIGHT);
+        // the first frame compiles the shaders, which is left out
+        draw_frame(&b);
+        start_measuring(&b);
+        uint64_t t = scenarios[i].run(&b, 0);
+        advance(&b, t + FRAME_US);
+        GLenum err = glGetError();
+        finish(&b, scenarios[i].name);
+        if (err != GL_NO_ERROR) {
+            fprintf(stderr, "GL error %#x in %s\n", err, scenarios[i].name);
+            ok = false;
+        }
+        ok = ok && !b.failed;
+        cleanup_bench(&b);
+    }
+
+    eglMakeCurrent(egl.egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroySurface(egl.egl_display, surface);
+    eglDestroyContext(egl.egl_display, egl.egl_context);
+    eglTerminate(egl.egl_display);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,314 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "glassnote.h"
+#include "scan.h"
+#include "stroke.h"
+#include "table.h"
+#include "utils.h"
+
+// same as STROKE_SIMPLIFICATION_THRESHOLD in src/stroke.c
+#define REF_THRESHOLD 1.5f
+#define N_RANDOM_STROKES 2000
+#define RANDOM_STROKE_MAX_PTS 2000
+#define REF_MAX_EVENTS 20000
+#define N_KERNEL_CHECKS 20000
+#define KERNEL_CHECK_MAX_PTS 300
+// points scanned per kernel and segment length when timing
+#define KERNEL_TIMED_PTS (1 << 24)
+
+// the original simplifier, rescanning the open segment on every point with
+// the scalar kernel
+struct ref_stroke {
+    struct gn_vec2 *pts;
+    size_t n_pts, seg_st;
+};
+
+static gn_scan_fn *ref_scan;
+
+static void ref_extend(struct ref_stroke *stroke, struct gn_vec2 n_pt) {
+    if (stroke->seg_st + 1 < stroke->n_pts) {
+        struct gn_vec2 st_pt = stroke->pts[stroke->seg_st];
+        struct gn_scan_max max =
+            ref_scan(&stroke->pts[stroke->seg_st + 1],
+                     stroke->n_pts - stroke->seg_st - 1, st_pt, n_pt);
+        float len_sq = gn_vec2_norm_sq(gn_vec2_minus(n_pt, st_pt));
+        if (max.cross_sq > 0.f &&
+            max.cross_sq >= REF_THRESHOLD * REF_THRESHOLD * len_sq) {
+            size_t index = stroke->seg_st + 1 + max.index;
+            stroke->seg_st++;
+            for (size_t i = index; i < stroke->n_pts; i++) {
+                stroke->pts[i - index + stroke->seg_st] = stroke->pts[i];
+            }
+            stroke->n_pts = stroke->n_pts - index + stroke->seg_st;
+        }
+    }
+    stroke->pts[stroke->n_pts++] = n_pt;
+}
+
+static void ref_finish(struct ref_stroke *stroke) {
+    if (stroke->seg_st + 1 < stroke->n_pts) {
+        stroke->seg_st++;
+        stroke->pts[stroke->seg_st] = stroke->pts[stroke->n_pts - 1];
+        stroke->n_pts = stroke->seg_st + 1;
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static float jitter(float amount) {
+    return ((float)rand() / RAND_MAX * 2.f - 1.f) * amount;
+}
+
+// a slow, nearly straight drag, all of it within the threshold of one line
+static void straight_drag(struct gn_vec2 *pts, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        pts[i] = (struct gn_vec2){100.f + i * 0.25f, 200.f + jitter(0.6f)};
+    }
+}
+
+// a wandering drag with turns of every sharpness
+static size_t random_drag(struct gn_vec2 *pts, size_t max) {
+    size_t n = 2 + rand() % (max - 2);
+    float x = rand() % 1920, y = rand() % 1080;
+    float angle = jitter(3.14159265f);
+    float turn = jitter(0.3f);
+    float step = 0.2f + (float)rand() / RAND_MAX * 4.f;
+    for (size_t i = 0; i < n; i++) {
+        if (rand() % 50 == 0) {
+            turn = jitter(0.3f);
+        }
+        angle += turn + jitter(0.05f);
+        x += cosf(angle) * step + jitter(0.4f);
+        y += sinf(angle) * step + jitter(0.4f);
+        pts[i] = (struct gn_vec2){x, y};
+    }
+    return n;
+}
+
+// the scan as it was, taking a sqrtf and a division for every point. the
+// distance is returned as cross_sq.
+static struct gn_scan_max perp_dist_scan(const struct gn_vec2 *pts, uint32_t n,
+                                         struct gn_vec2 a, struct gn_vec2 b) {
+    struct gn_vec2 ab = gn_vec2_minus(b, a);
+    struct gn_scan_max max = {0.f, UINT32_MAX};
+    for (uint32_t i = 0; i < n; i++) {
+        float dist = fabsf(gn_vec2_cross(ab, gn_vec2_minus(pts[i], a))) /
+                     gn_vec2_norm(ab);
+        if (dist > max.cross_sq) {
+            max = (struct gn_scan_max){dist, i};
+        }
+    }
+    return max;
+}
+
+// every kernel has to find the same point as the scalar one, also among
+// points on whole pixels, which tie often, and from unaligned starts
+static int check_kernels(void) {
+    const struct gn_scan_kernel *kernels;
+    size_t n_kernels = scan_kernels(&kernels);
+    struct gn_vec2 *pts =
+        malloc((KERNEL_CHECK_MAX_PTS + 1) * sizeof(struct gn_vec2));
+    int rc = 0;
+
+    for (size_t c = 0; c < N_KERNEL_CHECKS && rc == 0; c++) {
+        uint32_t n = rand() % KERNEL_CHECK_MAX_PTS;
+        uint32_t off = rand() % 2;
+        bool whole = c % 2 == 0;
+        float x = rand() % 1920, y = rand() % 1080;
+        for (uint32_t i = 0; i < n + off; i++) {
+            float px = x + jitter(20.f), py = y + jitter(20.f);
+            pts[i] = whole ? (struct gn_vec2){roundf(px), roundf(py)}
+                           : (struct gn_vec2){px, py};
+        }
+        struct gn_vec2 a = {x, y};
+        struct gn_vec2 b = {x + jitter(30.f), y + jitter(30.f)};
+        if (c % 100 == 0) {
+            b = a;
+        } else if (whole) {
+            b = (struct gn_vec2){roundf(b.x), roundf(b.y)};
+        }
+
+        struct gn_scan_max want = kernels[0].fn(pts + off, n, a, b);
+        for (size_t k = 1; k < n_kernels; k++) {
+            struct gn_scan_max got = kernels[k].fn(pts + off, n, a, b);
+            if (got.cross_sq != want.cross_sq || got.index != want.index) {
+                fprintf(stderr,
+                        "%s found point %u (%g), scalar found %u (%g)\n",
+                        kernels[k].name, got.index, got.cross_sq, want.index,
+                        want.cross_sq);
+                rc = 1;
+            }
+        }
+    }
+    printf("kernels:");
+    for (size_t k = 0; k < n_kernels; k++) {
+        printf(" %s", kernels[k].name);
+    }
+    printf(", %d scans: %s\n", N_KERNEL_CHECKS, rc ? "FAIL" : "ok");
+
+    free(pts);
+    return rc;
+}
+
+// ns per scan of an open segment of a nearly straight drag
+static void time_kernels(void) {
+    const struct gn_scan_kernel *kernels;
+    size_t n_kernels = scan_kernels(&kernels);
+    static const uint32_t lengths[] = {16, 64, 256, 1024, 4096};
+    uint32_t max = lengths[sizeof(lengths) / sizeof(*lengths) - 1];
+    struct gn_vec2 *pts = malloc(max * sizeof(struct gn_vec2));
+    straight_drag(pts, max);
+    struct gn_vec2 a = pts[0];
+    struct gn_vec2 b = {a.x + max * 0.25f, a.y + 1.f};
+
+    printf("%10s %10s", "points", "perp_dist");
+    for (size_t k = 0; k < n_kernels; k++) {
+        printf(" %10s", kernels[k].name);
+    }
+    printf("\n");
+    volatile uint32_t sink = 0;
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); l++) {
+        uint32_t n = lengths[l];
+        size_t reps = KERNEL_TIMED_PTS / n;
+        printf("%10u", n);
+        for (size_t k = 0; k <= n_kernels; k++) {
+            gn_scan_fn *fn = k == 0 ? perp_dist_scan : kernels[k - 1].fn;
+            double st = now_ns();
+            for (size_t r = 0; r < reps; r++) {
+                sink += fn(pts, n, a, b).index;
+            }
+            printf(" %10.1f", (now_ns() - st) / reps);
+        }
+        printf("\n");
+    }
+
+    free(pts);
+}
+
+static bool same_points(struct gn_stroke *stroke, struct ref_stroke *ref) {
+    if (stroke->n_pts != ref->n_pts) {
+        return false;
+    }
+    for (size_t i = 0; i < ref->n_pts; i++) {
+        struct gn_vec2 pt = *stroke_pt(stroke, i);
+        if (pt.x != ref->pts[i].x || pt.y != ref->pts[i].y) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct gn_stroke *new_stroke(struct gn_state *state) {
+    // only one stroke is alive at a time
+    struct gn_stroke *last = stroke_table_last(&state->strokes);
+    if (last != NULL) {
+        destroy_stroke(last);
+        stroke_table_remove(&state->strokes, last);
+    }
+    return create_stroke(state, GN_STATE_INIT_WIDTH, 0);
+}
+
+static int check_equivalence(struct gn_state *state) {
+    size_t max = RANDOM_STROKE_MAX_PTS;
+    struct gn_vec2 *pts = malloc(max * sizeof(struct gn_vec2));
+    struct ref_stroke ref = {.pts = malloc(max * sizeof(struct gn_vec2))};
+    size_t n_pts_in = 0, n_pts_out = 0;
+    int rc = 0;
+
+    for (size_t s = 0; s < N_RANDOM_STROKES; s++) {
+        size_t n = s % 50 == 0 ? max : random_drag(pts, max);
+        if (s % 50 == 0) {
+            straight_drag(pts, n);
+        }
+        struct gn_stroke *stroke = new_stroke(state);
+        ref.n_pts = ref.seg_st = 0;
+        for (size_t i = 0; i < n; i++) {
+            extend_stroke(stroke, pts[i].x, pts[i].y, NULL);
+            ref_extend(&ref, pts[i]);
+        }
+        finish_stroke(stroke, NULL);
+        ref_finish(&ref);
+
+        n_pts_in += n;
+        n_pts_out += ref.n_pts;
+        if (!same_points(stroke, &ref)) {
+            fprintf(stderr, "stroke %zu differs from the reference\n", s);
+            rc = 1;
+            break;
+        }
+    }
+    printf("equivalence: %d strokes, %zu points kept of %zu: %s\n",
+           N_RANDOM_STROKES, n_pts_out, n_pts_in, rc ? "FAIL" : "ok");
+
+    free(pts);
+    free(ref.pts);
+    return rc;
+}
+
+static void time_drags(struct gn_state *state) {
+    static const size_t lengths[] = {100, 1000, 10000, 100000, 1000000};
+    size_t max = lengths[sizeof(lengths) / sizeof(*lengths) - 1];
+    struct gn_vec2 *pts = malloc(max * sizeof(struct gn_vec2));
+    struct ref_stroke ref = {.pts = malloc(max * sizeof(struct gn_vec2))};
+
+    printf("%10s %14s %14s %10s\n", "events", "ns/event", "ref ns/event",
+           "kept");
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); l++) {
+        size_t n = lengths[l];
+        straight_drag(pts, n);
+
+        struct gn_stroke *stroke = new_stroke(state);
+        double st = now_ns();
+        for (size_t i = 0; i < n; i++) {
+            extend_stroke(stroke, pts[i].x, pts[i].y, NULL);
+        }
+        double ns = (now_ns() - st) / n;
+
+        // the reference is quadratic, long drags would take minutes
+        double ref_ns = NAN;
+        if (n <= REF_MAX_EVENTS) {
+            ref.n_pts = ref.seg_st = 0;
+            st = now_ns();
+            for (size_t i = 0; i < n; i++) {
+                ref_extend(&ref, pts[i]);
+            }
+            ref_ns = (now_ns() - st) / n;
+        }
+        printf("%10zu %14.1f %14.1f %10zu\n", n, ns, ref_ns, stroke->n_pts);
+    }
+
+    free(pts);
+    free(ref.pts);
+}
+
+int main(int argc, char **argv) {
+    srand(1);
+    struct gn_state state = {0};
+    init_stroke_table(&state.strokes);
+
+    const struct gn_scan_kernel *kernels;
+    scan_kernels(&kernels);
+    ref_scan = kernels[0].fn;
+
+    int rc = check_kernels();
+    rc |= check_equivalence(&state);
+    time_drags(&state);
+    time_kernels();
+
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state.strokes.order, link) {
+        destroy_stroke(stroke);
+    }
+    cleanup_stroke_table(&state.strokes);
+    cleanup_pool(&state.pool);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
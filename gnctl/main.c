@@ -1,7 +1,11 @@
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <systemd/sd-bus.h>
+#include <unistd.h>
 
 #include "gnctl.h"
 
@@ -9,11 +13,47 @@ void usage(const char *prog) {
     fprintf(stderr,
             "Usage:\n"
             "  %s show\n"
-            "  %s hide\n",
-            prog, prog);
+            "  %s hide\n"
+            "  %s usage\n"
+            "  %s save [PATH]\n"
+            "  %s stats\n",
+            prog, prog, prog, prog, prog);
     exit(EXIT_FAILURE);
 }
 
+// the histograms come in us and are printed in ms
+static int print_stats(sd_bus_message *reply) {
+    int r = sd_bus_message_enter_container(reply, 'a', "(sttttt)");
+    if (r < 0) {
+        return r;
+    }
+    printf("%-8s %8s %8s %8s %8s %8s\n", "ms", "frames", "p50", "p90", "p99",
+           "max");
+    const char *name;
+    uint64_t n, p50, p90, p99, max;
+    while ((r = sd_bus_message_read(reply, "(sttttt)", &name, &n, &p50, &p90,
+                                    &p99, &max)) > 0) {
+        printf("%-8s %8" PRIu64 " %8.2f %8.2f %8.2f %8.2f\n", name, n,
+               p50 / 1000., p90 / 1000., p99 / 1000., max / 1000.);
+    }
+    if (r < 0) {
+        return r;
+    }
+    r = sd_bus_message_exit_container(reply);
+    if (r < 0) {
+        return r;
+    }
+
+    uint64_t presented, missed, discarded;
+    r = sd_bus_message_read(reply, "ttt", &presented, &missed, &discarded);
+    if (r >= 0) {
+        printf("frames: %" PRIu64 " presented, %" PRIu64 " missed, %" PRIu64
+               " discarded\n",
+               presented, missed, discarded);
+    }
+    return r;
+}
+
 int main(int argc, char **argv) {
     sd_bus *bus = NULL;
     int r;
@@ -38,6 +78,36 @@ int main(int argc, char **argv) {
         r = sd_bus_call_method(bus, GN_SD_BUS_NAME, GN_SD_BUS_OBJ_PATH,
                                GN_SD_BUS_NAME, GN_SD_BUS_HIDE_CMD, NULL, &reply,
                                "");
+    } else if (strcmp(argv[1], "usage") == 0) {
+        r = sd_bus_call_method(bus, GN_SD_BUS_NAME, GN_SD_BUS_OBJ_PATH,
+                               GN_SD_BUS_NAME, GN_SD_BUS_USAGE_CMD, NULL,
+                               &reply, "");
+    } else if (strcmp(argv[1], "save") == 0) {
+        // glassnote resolves relative paths against its own directory
+        char *path = NULL;
+        if (argc > 2 && argv[2][0] != '/') {
+            char *cwd = getcwd(NULL, 0);
+            path = cwd == NULL ? NULL
+                               : malloc(strlen(cwd) + strlen(argv[2]) + 2);
+            if (path == NULL) {
+                free(cwd);
+                sd_bus_unref(bus);
+                fprintf(stderr, "Failed to resolve path: %s\n", argv[2]);
+                return EXIT_FAILURE;
+            }
+            sprintf(path, "%s/%s", cwd, argv[2]);
+            free(cwd);
+        }
+        // an empty path saves to the session glassnote was started with
+        r = sd_bus_call_method(bus, GN_SD_BUS_NAME, GN_SD_BUS_OBJ_PATH,
+                               GN_SD_BUS_NAME, GN_SD_BUS_SAVE_CMD, NULL, &reply,
+                               "s",
+                               path != NULL ? path : argc > 2 ? argv[2] : "");
+        free(path);
+    } else if (strcmp(argv[1], "stats") == 0) {
+        r = sd_bus_call_method(bus, GN_SD_BUS_NAME, GN_SD_BUS_OBJ_PATH,
+                               GN_SD_BUS_NAME, GN_SD_BUS_STATS_CMD, NULL,
+                               &reply, "");
     } else {
         sd_bus_unref(bus);
         fprintf(stderr, "Unknown command: %s\n", argv[1]);
@@ -54,8 +124,23 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    bool success;
-    r = sd_bus_message_read(reply, "b", &success);
+    bool success = true;
+    if (strcmp(argv[1], "usage") == 0) {
+        uint64_t n_strokes, n_pts, used, reserved;
+        r = sd_bus_message_read(reply, "tttt", &n_strokes, &n_pts, &used,
+                                &reserved);
+        if (r >= 0) {
+            printf("strokes: %" PRIu64 "\n"
+                   "points: %" PRIu64 "\n"
+                   "point memory: %" PRIu64 " bytes used, %" PRIu64
+                   " bytes reserved\n",
+                   n_strokes, n_pts, used, reserved);
+        }
+    } else if (strcmp(argv[1], "stats") == 0) {
+        r = print_stats(reply);
+    } else {
+        r = sd_bus_message_read(reply, "b", &success);
+    }
     sd_bus_message_unref(reply);
     if (r < 0) {
         fprintf(stderr, "Failed to parse reply: %s\n", strerror(-r));
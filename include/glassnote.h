@@ -2,6 +2,7 @@
 #define _GLASSNOTE_H
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GL/gl.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -10,9 +11,17 @@
 #include <wayland-egl.h>
 #include <wayland-server-core.h>
 
+#include "grid.h"
+#include "history.h"
+#include "journal.h"
+#include "pool.h"
 #include "render.h"
+#include "schedule.h"
+#include "stats.h"
+#include "table.h"
+#include "trace.h"
+#include "utils.h"
 
-#define GN_STATE_INIT_STROKES 64
 #define GN_STATE_INIT_WIDTH 3.f
 #define GN_STATE_INIT_COLOR_1 0xd20f39ff
 #define GN_STATE_INIT_COLOR_2 0xfe640bff
@@ -21,16 +30,98 @@
 #define GN_STATE_INIT_COLOR_5 0x179299ff
 #define GN_STATE_INIT_BG_COLOR_INACTIVE 0x00000000
 #define GN_STATE_INIT_BG_COLOR_ACTIVE 0x00000044
+#define GN_STATE_INIT_ERASER_RADIUS 8.f
+#define GN_ERASER_MIN_RADIUS 2.f
+#define GN_ERASER_MAX_RADIUS 64.f
+
+#define GN_DAMAGE_MAX_RECTS 8
+// number of previous frames whose damage is kept for buffer age
+#define GN_DAMAGE_HISTORY 4
+
+// pixel aligned rectangles in surface coordinates
+struct gn_damage {
+    struct gn_box rects[GN_DAMAGE_MAX_RECTS];
+    size_t n_rects;
+    bool full;
+};
+
+// a file mapped read only
+struct gn_file_map {
+    const uint8_t *data;
+    size_t size;
+};
+
+enum gn_tool {
+    GN_TOOL_PEN,
+    // removes whole strokes
+    GN_TOOL_ERASER,
+    // removes the parts of strokes under it
+    GN_TOOL_PIXEL_ERASER,
+};
+
+// how changes to the canvas reach whatever shows it. the display's is
+// display_canvas_listener, benchmarks that draw nothing leave it unset.
+struct gn_canvas_listener {
+    // box, in the global space, has to be repainted
+    void (*damage)(struct gn_state *state, struct gn_box box);
+    // a finished stroke was added to the canvas
+    void (*upload)(struct gn_state *state, struct gn_stroke *stroke);
+    // a finished stroke is about to leave it
+    void (*discard)(struct gn_state *state, struct gn_stroke *stroke);
+};
 
+// the overlay on one wl_output. strokes are kept in the compositor's global
+// space, the output shows the part of it at x, y.
 struct gn_output {
     struct gn_state *state;
+    struct wl_list link; // gn_state::outputs
+    struct wl_output *wl_output;
+    // registry name of the wl_output
+    uint32_t wl_name;
+    int32_t x, y;
+    // the logical position and size xdg-output sent since its last done,
+    // sizes are 0 until it sent one
+    int32_t xdg_x, xdg_y, xdg_width, xdg_height;
 
     struct wl_callback *frame_callback;
+    // the frame callback was asked for by a frame being drawn, not by damage
+    bool frame_drawn;
+    struct gn_frame_schedule schedule;
     bool configured;
     bool dirty;
+    // the surface's size, in the units of the global space
     int32_t width, height;
-
+    // scale the compositor would have the surface drawn at, in 120ths
+    uint32_t scale_120;
+    // the buffer is drawn at this fraction of that scale, lowered by
+    // --dynamic-scale while frames run over
+    float render_scale;
+    // the buffer was resized, the next frame redraws everything at the new
+    // size and does not count against the budget
+    bool scale_changed;
+    // frames in a row that ran over their budget
+    uint32_t slow_frames;
+    // the buffer's size in pixels, the viewport shows it at the surface's
+    int32_t buffer_width, buffer_height;
+
+    // damage accumulated since the last frame
+    struct gn_damage damage;
+    // damage of the frames presented before, most recent first
+    struct gn_damage history[GN_DAMAGE_HISTORY];
+    // arrival of the oldest pointer event that changed the frame being
+    // prepared, 0 if none did
+    uint64_t input_ns;
+    // frames waiting for their presentation feedback
+    struct wl_list feedback; // gn_frame_feedback::link
+    // the finished strokes on this output
+    struct gn_canvas_cache cache;
+
+    // only with zxdg_output_manager_v1, which places the output
+    struct zxdg_output_v1 *xdg_output;
     struct wl_surface *surface;
+    // only with wp_viewporter, the buffer is the surface's size without it
+    struct wp_viewport *viewport;
+    struct wp_fractional_scale_v1 *fractional_scale;
     struct zwlr_layer_surface_v1 *layer_surface;
     struct wl_egl_window *egl_window;
     EGLSurface egl_surface;
@@ -45,6 +136,14 @@ struct gn_state {
     struct wl_compositor *compositor;
     struct zwlr_layer_shell_v1 *layer_shell;
     struct wp_cursor_shape_manager_v1 *cursor_shape_manager;
+    // optional, frames are only timed to the screen with it
+    struct wp_presentation *presentation;
+    // optional, outputs are drawn at their own scale with them
+    struct wp_viewporter *viewporter;
+    struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+    // optional, outputs are placed by wl_output.geometry without it, which
+    // wlroots compositors send as 0,0 for all of them
+    struct zxdg_output_manager_v1 *xdg_output_manager;
     struct xkb_context *xkb_context;
 
     struct sd_bus *bus;
@@ -55,15 +154,39 @@ struct gn_state {
     EGLDisplay egl_display;
     EGLConfig egl_config;
     EGLContext egl_context;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_buffers_with_damage;
+    bool has_buffer_age;
 
-    struct gn_output output;
+    struct wl_list outputs; // gn_output::link
 
     int32_t bg_colors[2];
     int32_t colors[5];
     size_t color_ind;
     float cur_stroke_width;
-    struct gn_stroke *strokes;
-    size_t n_strokes, c_strokes;
+    enum gn_tool tool;
+    float eraser_radius;
+    // finished strokes are stored as fitted curves
+    bool fit_curves;
+    // ms ahead of the pointer the tip of a stroke is drawn, 0 unless set
+    // with --predict
+    float predict_ms;
+    // outputs drop their render scale while frames take too long
+    bool dynamic_scale;
+    // restored at startup and kept up to date through the journal, if set
+    const char *session_path;
+    // NULL if nothing shows the canvas
+    const struct gn_canvas_listener *canvas_listener;
+    struct gn_stroke_table strokes;
+    struct gn_history history;
+    struct gn_journal journal;
+    // the session and journal files restored from, strokes loaded packed
+    // read their points from them
+    struct gn_file_map session_map, journal_map;
+    // input reaching the seats is recorded here with --record
+    struct gn_trace trace;
+    struct gn_stats stats;
+    struct gn_chunk_pool pool;
+    struct gn_grid grid;
 
     struct wl_list seats; // gn_seat::link
 
@@ -71,6 +194,21 @@ struct gn_state {
 };
 
 void noop();
-void set_output_dirty(struct gn_state *state);
+void set_output_dirty(struct gn_output *output);
+// the part of the global space the output shows
+struct gn_box output_box(const struct gn_output *output);
+// the pixels of the output's buffer that rect, in surface coordinates, covers
+struct gn_box buffer_rect(const struct gn_output *output, struct gn_box rect);
+// damages box, in the global space, on the outputs it is on
+void damage_output(struct gn_state *state, struct gn_box box);
+void damage_output_full(struct gn_state *state);
+// as damage_output, but drawing is about to be drawn and gets box in that
+// frame, without asking for another
+void damage_frame(struct gn_state *state, struct gn_output *drawing,
+                  struct gn_box box);
+// what to repaint in a buffer drawn `age` frames ago, 0 if unknown
+struct gn_damage repaint_damage(struct gn_output *output, int age);
+// keeps the damage of the frame just drawn for the buffers drawn after it
+void push_damage(struct gn_output *output);
 
 #endif
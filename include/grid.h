@@ -0,0 +1,63 @@
+#ifndef _GN_GRID_H
+#define _GN_GRID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+// side length of a grid cell in surface coordinates
+#define GN_GRID_CELL_SZ 32.f
+#define GN_GRID_CELL_INIT_ENTRIES 8
+
+struct gn_state;
+struct gn_stroke;
+struct gn_stroke_chunk;
+
+// seg of the entries of a packed stroke, which is put in every cell its bbox
+// overlaps until a hit test reaches it and indexes its segments instead
+#define GN_GRID_PACKED UINT32_MAX
+
+// segment seg, or cubic seg if it is curved, of the stroke in slot stroke of
+// gn_state::strokes
+struct gn_grid_entry {
+    uint32_t stroke;
+    uint32_t seg;
+    // holds the segment's first point, saving a walk along the stroke
+    struct gn_stroke_chunk *chunk;
+};
+
+struct gn_grid_cell {
+    struct gn_grid_entry *entries;
+    size_t n_entries, c_entries;
+};
+
+// uniform grid over the outputs, bucketing every indexed segment in each cell
+// its box (padded by half the stroke width) overlaps. points off the outputs
+// are clamped to the border cells.
+struct gn_grid {
+    struct gn_grid_cell *cells;
+    int32_t cols, rows;
+    // corner of the first cell in the global space, outputs left of or above
+    // its origin put it at negative coordinates
+    int32_t x, y;
+
+    // result of the last hit test
+    struct gn_grid_entry *hits;
+    size_t n_hits, c_hits;
+};
+
+// covers width by height from x, y, reindexing every stroke when the cells
+// change
+void resize_grid(struct gn_state *state, int32_t x, int32_t y, int32_t width,
+                 int32_t height);
+void cleanup_grid(struct gn_grid *grid);
+// adds the segments of the stroke that became final since the last call
+void index_stroke(struct gn_state *state, struct gn_stroke *stroke);
+void unindex_stroke(struct gn_state *state, struct gn_stroke *stroke);
+// collects the segments of finished strokes passing within radius of segment
+// a-b into gn_grid::hits, ordered by stroke and then segment
+size_t grid_hit_test(struct gn_state *state, struct gn_vec2 a,
+                     struct gn_vec2 b, float radius);
+
+#endif
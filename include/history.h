@@ -0,0 +1,58 @@
+#ifndef _GN_HISTORY_H
+#define _GN_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GN_HISTORY_INIT_CMDS 64
+#define GN_HISTORY_INIT_REFS 256
+// history kept by default, in bytes
+#define GN_HISTORY_INIT_BUDGET (64 << 20)
+// marks the refs of strokes a command put on the canvas
+#define GN_HISTORY_ADDED (UINT32_C(1) << 31)
+
+struct gn_state;
+struct gn_stroke;
+
+// an undoable step, taking the strokes in refs with GN_HISTORY_ADDED clear
+// off the canvas and putting the ones with it set on. strokes taken off are
+// hidden rather than freed, so undo and redo only move slots around and
+// never copy points. drawing a stroke, erasing strokes and cutting a stroke
+// into pieces are all recorded this way.
+struct gn_history_cmd {
+    // offset of the command's refs in gn_history::refs
+    size_t ref;
+    size_t n_refs;
+};
+
+struct gn_history {
+    // cmds[st, pos) are applied and cmds[pos, n) were undone
+    struct gn_history_cmd *cmds;
+    size_t st, pos, n, c_cmds;
+    // stroke slots of every command, those before refs_st are dropped
+    uint32_t *refs;
+    size_t refs_st, n_refs, c_refs;
+
+    // gestures recording into cmds[n - 1], which stays open until they end
+    size_t n_open;
+    // chunks held by hidden strokes
+    size_t n_hidden_chunks;
+    // oldest commands are dropped once the log and hidden strokes take more
+    size_t budget;
+};
+
+// a gesture's strokes are recorded in one command, while any gesture is open
+void history_begin(struct gn_state *state);
+void history_end(struct gn_state *state);
+// records a stroke that was put on the canvas
+void history_add(struct gn_state *state, struct gn_stroke *stroke);
+// takes a stroke off the canvas, keeping it for undo
+void history_erase(struct gn_state *state, struct gn_stroke *stroke);
+bool history_undo(struct gn_state *state);
+bool history_redo(struct gn_state *state);
+// bytes of the log and of the points of hidden strokes
+size_t history_bytes(struct gn_history *history);
+void cleanup_history(struct gn_history *history);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _GN_JOURNAL_H
+#define _GN_JOURNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the journal of a session at PATH is PATH.journal, in little endian:
+//
+//   header   magic "GNJO", u32 version, u64 inode and u64 size of the
+//            session file it follows
+//   records  u32 size, u32 fnv-1a hash of the payload's u32s and then of
+//            the bytes after the last whole one, then the payload, a u8
+//            type and its fields
+//
+// a session is restored by loading the session file and replaying the
+// records after it. records stop at the first one that is cut short or does
+// not match its hash, which is where a crash left the journal. the session
+// file is replaced by a snapshot of the canvas from time to time, a journal
+// naming another file is left over from before a snapshot and ignored.
+#define GN_JOURNAL_MAGIC "GNJO"
+#define GN_JOURNAL_VERSION 2
+#define GN_JOURNAL_HEADER_SZ 24
+#define GN_JOURNAL_RECORD_SZ 8
+// the canvas is snapshot when the overlay rests or is hidden, once this
+// many bytes, or the size of the last snapshot if larger, were written to
+// the journal since
+#define GN_JOURNAL_COMPACT_BYTES (4 << 20)
+#define GN_JOURNAL_INIT_PENDING 4096
+
+enum gn_journal_record {
+    // a stroke was put on top of the canvas, it takes the next id:
+    // u32 n_pts, u32 n_bytes, f32 bbox x y w h, f32 width, i32 color,
+    // u32 flags, then its points as in a session file. version 1 had no
+    // bbox.
+    GN_JOURNAL_ADD = 1,
+    // a stroke was taken off the canvas: u32 id
+    GN_JOURNAL_REMOVE = 2,
+};
+
+struct gn_state;
+struct gn_stroke;
+
+// records are written from a thread of their own, so drawing never waits on
+// the disk. the writer takes every record queued since it last woke and
+// syncs them together.
+struct gn_journal {
+    bool open;
+    char *path;
+    const char *session_path;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // owned by the writer while it runs
+    int fd;
+    // records not yet taken by the writer
+    uint8_t *pending;
+    size_t n_pending, c_pending;
+    // snapshot to write once the first snapshot_cut bytes of pending are
+    // written, the records after them go to the journal that follows it
+    uint8_t *snapshot;
+    size_t snapshot_sz, snapshot_cut;
+    bool stop;
+    // set by the writer when records could not be kept
+    bool failed;
+
+    // id of the last stroke added, the strokes of a snapshot are 1..n
+    uint32_t last_id;
+    size_t n_since_snapshot;
+    size_t last_snapshot_sz;
+};
+
+enum gn_journal_open {
+    // the session was restored and is journaled from here on
+    GN_JOURNAL_OPENED,
+    // the session was restored, the journal could not be opened
+    GN_JOURNAL_FAILED,
+    // the session file could not be read, nothing was restored and neither
+    // file is written to
+    GN_JOURNAL_UNREADABLE,
+};
+
+// loads state->session_path and replays its journal, then starts writing to
+// it
+enum gn_journal_open open_journal(struct gn_state *state);
+// records a stroke put on the canvas, and one taken off
+void journal_add(struct gn_state *state, struct gn_stroke *stroke);
+void journal_remove(struct gn_state *state, struct gn_stroke *stroke);
+// queues a snapshot of the canvas, after which the journal starts over
+bool compact_journal(struct gn_state *state);
+// whether the journal grew enough since the last snapshot to take another
+bool journal_compact_due(struct gn_state *state);
+// takes a snapshot if one is due, where encoding it holds up no input
+void maybe_compact_journal(struct gn_state *state);
+// writes everything queued and stops the writer, false if some records
+// could not be kept
+bool close_journal(struct gn_state *state);
+
+#endif
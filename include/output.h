@@ -0,0 +1,37 @@
+#ifndef _GN_OUTPUT_H
+#define _GN_OUTPUT_H
+
+#include <stdint.h>
+#include <wayland-client-protocol.h>
+
+#include "glassnote.h"
+
+// highest wl_output version the listener handles
+#define GN_OUTPUT_VERSION 4
+// highest zxdg_output_manager_v1 version the listener handles
+#define GN_XDG_OUTPUT_VERSION 3
+// with --dynamic-scale, the render scale steps down by this once this many
+// frames in a row ran over their budget, down to the minimum
+#define GN_OUTPUT_SCALE_STEP 0.25f
+#define GN_OUTPUT_SLOW_FRAMES 3
+#define GN_OUTPUT_MIN_SCALE 0.5f
+// the budget of a frame while the refresh period is not known
+#define GN_OUTPUT_FRAME_BUDGET_NS 16666667
+// the full scale comes back, and a snapshot that is due is taken, once no
+// frame was drawn for this long
+#define GN_OUTPUT_IDLE_NS 250000000
+
+// keeps track of the wl_output bound from the registry name, its overlay is
+// shown at once if EGL is up
+void create_output(struct gn_state *state, struct wl_output *wl_output,
+                   uint32_t name);
+// places the output by the logical position xdg-output sends for it, once
+// state->xdg_output_manager is bound
+void watch_output_position(struct gn_output *output);
+// maps the overlay on the output, it is drawn once configured
+void show_output(struct gn_output *output);
+void destroy_output(struct gn_output *output);
+// draws the frame the timer fired for, st is when work on it started
+void handle_frame_timer(struct gn_output *output, uint64_t st);
+
+#endif
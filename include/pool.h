@@ -0,0 +1,45 @@
+#ifndef _GN_POOL_H
+#define _GN_POOL_H
+
+#include <stddef.h>
+
+// stroke chunks carved out of every slab allocation
+#define GN_POOL_SLAB_CHUNKS 64
+#define GN_POOL_INIT_SLABS 16
+
+struct gn_state;
+struct gn_stroke_chunk;
+struct gn_chunk_slab;
+
+// point chunks of every stroke, handed out from slabs so drawing and undo
+// never reach the allocator once the slabs are warm. free chunks are kept in
+// a list threaded through gn_stroke_chunk::next.
+struct gn_chunk_pool {
+    struct gn_chunk_slab **slabs;
+    size_t n_slabs, c_slabs;
+
+    struct gn_stroke_chunk *free;
+    size_t n_free;
+    // chunks handed out and not yet given back
+    size_t n_used;
+};
+
+struct gn_pool_usage {
+    size_t n_slabs;
+    size_t n_used, n_free;
+    // bytes of the chunks in use and of every slab
+    size_t used_bytes, reserved_bytes;
+};
+
+struct gn_stroke_chunk *pool_alloc_chunk(struct gn_chunk_pool *pool);
+void pool_free_chunk(struct gn_chunk_pool *pool, struct gn_stroke_chunk *chunk);
+// gives back the n chunks linked from head to tail at once
+void pool_free_chunks(struct gn_chunk_pool *pool, struct gn_stroke_chunk *head,
+                      struct gn_stroke_chunk *tail, size_t n);
+struct gn_pool_usage pool_usage(struct gn_chunk_pool *pool);
+// moves the chunks in use into as few slabs as can hold them and releases
+// the rest. chunks move, so strokes are reindexed when theirs do.
+void compact_pool(struct gn_state *state);
+void cleanup_pool(struct gn_chunk_pool *pool);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _GN_PREDICT_H
+#define _GN_PREDICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+// pointer samples kept for the fit
+#define GN_PREDICT_SAMPLES 16
+// samples older than this before the newest one are left out of the fit
+#define GN_PREDICT_WINDOW_US 40000
+// the acceleration is only fitted over at least this many samples and this
+// long a span, it is noise over fewer
+#define GN_PREDICT_MIN_QUADRATIC 5
+#define GN_PREDICT_MIN_QUADRATIC_US 12000
+// furthest the tip is drawn ahead of the pointer, in px
+#define GN_PREDICT_MAX_DIST 48.f
+// range of --predict, in ms
+#define GN_PREDICT_MIN_MS 8
+#define GN_PREDICT_MAX_MS 20
+// no tail is drawn once the pointer has rested this long
+#define GN_PREDICT_IDLE_NS 32000000
+
+// extrapolates where the pointer is going from its last positions, by a
+// least squares fit of a parabola in time over the samples of the last
+// GN_PREDICT_WINDOW_US, or of a line while there are too few of them for
+// the acceleration to mean anything
+struct gn_predictor {
+    uint64_t time_us[GN_PREDICT_SAMPLES];
+    struct gn_vec2 pts[GN_PREDICT_SAMPLES];
+    // pos is where the next sample goes
+    size_t n, pos;
+};
+
+void predictor_reset(struct gn_predictor *predictor);
+// time_us only has to grow, from any origin
+void predictor_add(struct gn_predictor *predictor, uint64_t time_us,
+                   struct gn_vec2 pt);
+// the position ahead_ms after the last sample, false if the samples do not
+// tell, such as when they all have the same time
+bool predictor_predict(const struct gn_predictor *predictor, float ahead_ms,
+                       struct gn_vec2 *out);
+
+#endif
@@ -2,32 +2,171 @@
 #define _GN_RENDER_H
 
 #include <GLES3/gl32.h>
+// needs the GLES3 types
+#include <GLES2/gl2ext.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
 
+#include "utils.h"
+
+// frames that may be in flight while a stream is written
+#define GN_STREAM_COPIES 3
+
+struct gn_canvas_listener;
+struct gn_damage;
+struct gn_output;
 struct gn_state;
+struct gn_stroke;
+
+// one straight segment of a stroke, drawn as one instance of the line mesh
+struct gn_lines_instance {
+    struct gn_vec2 pt1;
+    struct gn_vec2 pt2;
+    float width;
+    uint8_t color[4];
+};
+
+// one cubic, or a piece of one, of a curved stroke, drawn as one instance of
+// the curve mesh
+struct gn_curves_instance {
+    struct gn_vec2 pts[4];
+    float width;
+    uint8_t color[4];
+};
+
+struct gn_instance_buffer {
+    GLuint vao;
+    GLuint vbo;
+    // holds gn_curves_instance rather than gn_lines_instance
+    bool curves;
+    size_t n_instances;
+    size_t c_instances;
+    // instances belonging to removed strokes that are still in the buffer
+    size_t n_dead;
+};
+
+// the span of gn_lines_device::stream an in-progress stroke is written to,
+// at the same place in every copy. the instances after its segments are
+// zero width, so all strokes in progress are drawn with one call.
+struct gn_stream {
+    size_t st, c;
+    // leading instances of each copy that are already up to date
+    size_t n_synced[GN_STREAM_COPIES];
+    // instances of each copy that may not be zero width
+    size_t n_written[GN_STREAM_COPIES];
+
+    bool in_use;
+    struct wl_list link; // gn_lines_device::streams
+};
+
+// finished strokes composited once into an offscreen texture, which is copied
+// to the output every frame underneath the in-progress strokes. each output
+// has one of the part of the canvas it shows.
+struct gn_canvas_cache {
+    // multisampled target, only used when the output is multisampled
+    GLuint ms_fbo;
+    GLuint ms_rbo;
+    GLint samples;
+
+    GLuint fbo;
+    GLuint tex;
+    int32_t width, height;
+
+    bool valid;
+    // overlay state the cache was drawn with
+    bool active;
+    // instances of the store batches already composited into the cache.
+    // the strokes uploaded after them are the last in z order.
+    size_t n_drawn;
+};
+
+// consecutive instances of store or curve_store, drawn in the order the
+// batches were added so strokes overlap in the order they were uploaded
+struct gn_store_batch {
+    bool curves;
+    size_t first, count;
+};
 
 struct gn_lines_device {
     GLuint program_id;
-    GLuint vao;
     GLuint mesh_vbo;
-    GLuint instance_vbo;
+
+    GLuint blit_program_id;
+    GLuint blit_vao;
+    GLuint u_blit_tex;
+
+    GLuint curve_program_id;
+    GLuint curve_mesh_vbo;
+
+    // segments of finished strokes, uploaded once when the stroke finishes
+    struct gn_instance_buffer store;
+    // cubics of finished curved strokes
+    struct gn_instance_buffer curve_store;
+    struct gn_store_batch *batches;
+    size_t n_batches, c_batches;
+    // instances in all batches
+    size_t n_batched;
+    // segments of in-progress strokes, streamed into a different copy every
+    // frame so that the GPU is never reading the copy being written.
+    // c_instances is the capacity of a single copy.
+    struct gn_instance_buffer stream;
+    // persistent mapping of all copies, if supported
+    struct gn_lines_instance *stream_map;
+    // spans of the stream in order, reused once their stroke finishes
+    struct wl_list streams; // gn_stream::link
+    // signalled once the GPU is done with the frame that used each copy
+    GLsync fences[GN_STREAM_COPIES];
+    size_t frame;
+    PFNGLBUFFERSTORAGEEXTPROC buffer_storage;
+
+    // c_scratch is in bytes
+    void *scratch;
+    size_t c_scratch;
 
     struct gn_lines_uniforms {
         GLuint u_resolution;
-        GLuint u_color;
-        GLuint u_width;
+        GLuint u_origin;
+        GLuint u_alpha;
+        GLuint u_cull;
+        GLuint u_n_cull;
     } uniforms;
 
     struct gn_lines_attributes {
         GLuint a_pos;
         GLuint a_pt1;
         GLuint a_pt2;
+        GLuint a_width;
+        GLuint a_color;
     } attribs;
+
+    struct gn_curves_uniforms {
+        GLuint u_resolution;
+        GLuint u_origin;
+        GLuint u_alpha;
+        GLuint u_tolerance;
+        GLuint u_max_lines;
+    } curve_uniforms;
+
+    struct gn_curves_attributes {
+        GLuint a_pos;
+        GLuint a_pts[4];
+        GLuint a_width;
+        GLuint a_color;
+    } curve_attribs;
 };
 
 int init_egl(struct gn_state *state);
 void cleanup_egl(struct gn_state *state);
 void init_gl(struct gn_state *state);
 void cleanup_gl(struct gn_state *state);
-void render(struct gn_state *state);
+void upload_stroke(struct gn_state *state, struct gn_stroke *stroke);
+void discard_stroke(struct gn_state *state, struct gn_stroke *stroke);
+// shows the canvas on the outputs, for gn_state::canvas_listener
+extern const struct gn_canvas_listener display_canvas_listener;
+void cleanup_canvas_cache(struct gn_canvas_cache *cache);
+void render(struct gn_state *state, struct gn_output *output,
+            const struct gn_damage *damage);
 
 #endif
@@ -0,0 +1,38 @@
+#ifndef _GN_SCAN_H
+#define _GN_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+// the point farthest from the line through a and b. the distance of p is
+// |cross(b - a, p - a)| / |b - a|, so comparing the squared cross products
+// orders the points by distance without a sqrtf or a division per point,
+// and d >= t is cross_sq >= t * t * |b - a|^2. working relative to a keeps
+// the precision that the line equation loses far from the origin.
+struct gn_scan_max {
+    float cross_sq;
+    // first point with that cross_sq, or UINT32_MAX if every point is on the
+    // line
+    uint32_t index;
+};
+
+// scans n points, n < UINT32_MAX. every kernel computes each point's
+// cross_sq with the same float operations in the same order, so they all
+// find the same point.
+typedef struct gn_scan_max gn_scan_fn(const struct gn_vec2 *pts, uint32_t n,
+                                      struct gn_vec2 a, struct gn_vec2 b);
+
+struct gn_scan_kernel {
+    const char *name;
+    gn_scan_fn *fn;
+};
+
+// the kernels this cpu can run, the scalar one first and the one scan_line
+// uses last
+size_t scan_kernels(const struct gn_scan_kernel **kernels);
+struct gn_scan_max scan_line(const struct gn_vec2 *pts, uint32_t n,
+                             struct gn_vec2 a, struct gn_vec2 b);
+
+#endif
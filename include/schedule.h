@@ -0,0 +1,57 @@
+#ifndef _GN_SCHEDULE_H
+#define _GN_SCHEDULE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// frames whose render time sets the margin
+#define GN_SCHEDULE_WINDOW 32
+// time the compositor is given between our commit and the vblank
+#define GN_SCHEDULE_SLACK_NS 1000000
+// vblanks are not predicted from a presentation older than this
+#define GN_SCHEDULE_MAX_AGE_NS 1000000000
+
+struct gn_output;
+
+// starts each frame as late as it can and still make the next vblank, so
+// input that comes in after the frame callback gets into it. the vblank is
+// predicted from the last presentation and the refresh period, and the
+// frame starts the longest of the last render times, plus some, before it.
+struct gn_frame_schedule {
+    // CLOCK_MONOTONIC timerfd, -1 if frames are drawn as soon as the frame
+    // callback is done
+    int timer_fd;
+    // a frame is drawn when the timer fires
+    bool armed;
+    // the timer runs for schedule_idle instead
+    bool idle;
+    // the frame is drawn right after the one before it was shown
+    bool follows;
+    // ns taken by the last frames, render_pos is where the next one goes
+    uint64_t render_ns[GN_SCHEDULE_WINDOW];
+    size_t n_render, render_pos;
+    // the last vblank a frame was shown at and the refresh period, 0 until
+    // a frame is presented in sync with the display
+    uint64_t vblank_ns;
+    uint32_t refresh_ns;
+    // presentation of the frame before, 0 if it is not known
+    uint64_t last_present_ns;
+};
+
+void init_schedule(struct gn_frame_schedule *schedule);
+// arms the timer for the output's next frame, false if it should be drawn
+// now
+bool schedule_frame(struct gn_output *output, bool follows);
+// whether the timer fired for the frame scheduled, *idle is set if it fired
+// for schedule_idle
+bool frame_due(struct gn_frame_schedule *schedule, bool *idle);
+// runs the timer for delay_ns, for work left until the output has been idle
+// that long, unless a frame is scheduled first
+void schedule_idle(struct gn_frame_schedule *schedule, uint64_t delay_ns);
+// stops the timer schedule_idle started, as the output is not idle anymore
+void cancel_idle(struct gn_frame_schedule *schedule);
+void schedule_rendered(struct gn_frame_schedule *schedule, uint64_t render_ns);
+void cleanup_schedule(struct gn_frame_schedule *schedule);
+
+#endif
@@ -5,12 +5,43 @@
 #include <wayland-util.h>
 
 #include "glassnote.h"
+#include "predict.h"
+#include "table.h"
 #include "utils.h"
 
+// highest wl_seat version the listeners handle
+#define GN_SEAT_VERSION 7
+#define GN_SEAT_INIT_MOTIONS 16
+// touch points drawn with at once, the ones beyond them are left out
+#define GN_SEAT_MAX_TOUCHES 16
+
+// a touch point, which draws a stroke of its own
+struct gn_touch {
+    // the point is down, with the wl_touch id
+    bool active;
+    int32_t id;
+    // the output it went down on, its positions are relative to it
+    struct gn_output *output;
+    // in the global space, where the stroke has been drawn to
+    struct gn_vec2 loc;
+    // in the touch frame being received, the point went down or went up
+    bool down, up;
+    // the position it went down at and those it moved through in that
+    // frame, handled together once it ends. kept as the slot is reused.
+    struct gn_vec2 *motions;
+    size_t n_motions, c_motions;
+    // stale if the stroke was undone while being drawn
+    struct gn_stroke_handle stroke;
+    // the point went down with an eraser tool
+    bool erasing;
+};
+
 struct gn_seat {
     struct gn_state *state;
     struct wl_seat *wl_seat;
     struct wl_list link; // gn_state::seats
+    // numbers the seat in input traces
+    uint32_t id;
 
     struct wl_keyboard *wl_keyboard;
     struct xkb_keymap *xkb_keymap;
@@ -18,12 +49,82 @@ struct gn_seat {
 
     struct wl_pointer *wl_pointer;
     struct wl_touch *wl_touch;
+    // the output the pointer entered, its positions are relative to it
+    struct gn_output *pointer_output;
+    // in the global space
     struct gn_vec2 pointer_loc;
+    // positions the pointer moved through in the pointer frame being
+    // received, handled together once it ends
+    struct gn_vec2 *motions;
+    size_t n_motions, c_motions;
+    // arrival of the first of them
+    uint64_t motion_ns;
+
+    // where the pointer has been lately, to draw the stroke ahead of it
+    struct gn_predictor predictor;
+    // wl_pointer time of the last motion, and that time unwrapped in us
+    uint32_t motion_time;
+    uint64_t motion_us;
+    // arrival of the last motion the predictor was given
+    uint64_t moved_ns;
+    // the provisional segment drawn in the frame being prepared, from the
+    // stroke's last point to tail. it is never part of the stroke.
+    bool has_tail;
+    struct gn_vec2 tail;
+    // what it covered in the frame before
+    struct gn_box tail_box;
+
+    // zeroed when the seat is not drawing, stale if the stroke was undone
+    // while being drawn
+    struct gn_stroke_handle cur_stroke;
+    // the button is held down with the eraser tool
+    bool erasing;
 
-    struct gn_stroke *cur_stroke;
+    // a fixed array, so the points already down keep their slots, and the
+    // strokes they draw, while more go down
+    struct gn_touch touches[GN_SEAT_MAX_TOUCHES];
+    // arrival of the first event of the touch frame being received
+    uint64_t touch_ns;
 };
 
 void create_seat(struct gn_state *state, struct wl_seat *wl_seat);
 void destroy_seat(struct gn_seat *seat);
+// what a button press, a motion to seat->pointer_loc and a release do, also
+// driven without a compositor by the benchmarks and trace replays
+void seat_handle_pressed(struct gn_seat *seat);
+void seat_handle_moved(struct gn_seat *seat, struct gn_vec2 prev_loc);
+// moves the pointer through every one of pts in turn, damaging the output
+// once
+void seat_handle_motions(struct gn_seat *seat, const struct gn_vec2 *pts,
+                         size_t n);
+void seat_handle_released(struct gn_seat *seat);
+// what the wl_touch events do, with positions in the global space. nothing
+// is drawn until the frame they are part of ends.
+void seat_handle_touch_down(struct gn_seat *seat, int32_t id,
+                            struct gn_vec2 pt);
+void seat_handle_touch_motion(struct gn_seat *seat, int32_t id,
+                              struct gn_vec2 pt);
+void seat_handle_touch_up(struct gn_seat *seat, int32_t id);
+// extends the stroke of every touch point through the positions it moved
+// through, damaging the output once per point
+void seat_handle_touch_frame(struct gn_seat *seat);
+// the compositor took the touch points over for a gesture, what they drew
+// is taken off the canvas
+void seat_handle_touch_cancel(struct gn_seat *seat);
+// gives the predictor a pointer position at time_us, that arrived at
+// arrival_ns
+void seat_sample_motion(struct gn_seat *seat, uint64_t time_us,
+                        uint64_t arrival_ns, struct gn_vec2 pt);
+// puts the tail of the strokes being drawn where the pointers are predicted
+// to be, damaging the frame about to be drawn on output where they were and
+// where they go. true if any is drawn on output, its frame after has to take
+// it down.
+bool predict_tails(struct gn_state *state, struct gn_output *output,
+                   uint64_t now_ns);
+// ends the strokes the pointer and the touch points are drawing and the
+// gestures they are erasing with, as if they were all lifted
+void seat_finish_drawing(struct gn_seat *seat);
+// what pressing the key of keysym does
+void seat_handle_key(struct gn_seat *seat, uint32_t keysym);
 
 #endif
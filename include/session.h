@@ -0,0 +1,169 @@
+#ifndef _GN_SESSION_H
+#define _GN_SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "stroke.h"
+
+// a session file is, in little endian:
+//
+//   header  magic "GNSE", u32 version, u32 n_strokes, u32 quant
+//   index   n_strokes entries of GN_SESSION_ENTRY_SZ bytes:
+//           u64 offset, u32 n_pts, u32 n_bytes, f32 bbox x y w h,
+//           f32 width, i32 color, u32 flags
+//   data    per stroke, the points as multiples of 1 / quant px, the first
+//           absolute and the rest relative to the one before, every
+//           coordinate a zigzag varint
+//
+// the index gives every stroke's extent without decoding its points. strokes
+// are loaded packed, with the extent from the index, and their points are
+// only decoded from the file when something needs them.
+#define GN_SESSION_MAGIC "GNSE"
+#define GN_SESSION_VERSION 1
+#define GN_SESSION_HEADER_SZ 16
+#define GN_SESSION_ENTRY_SZ 44
+// points are stored within 1 / (2 * quant) px of where they were
+#define GN_SESSION_QUANT 16
+
+#define GN_SESSION_FLAG_CURVED (1u << 0)
+// a zigzag varint of an int32 takes at most 5 bytes
+#define GN_SESSION_MAX_PT_BYTES 10
+
+// how much of a session file made it onto the canvas
+enum gn_session_load {
+    // every stroke, or there was no file
+    GN_SESSION_LOADED,
+    // the strokes that were valid, some were not
+    GN_SESSION_PARTIAL,
+    // none, the file could not be read or is not a session this knows
+    GN_SESSION_UNREADABLE,
+};
+
+// a stroke as stored in a session, data holds its encoded points
+struct gn_session_stroke {
+    const uint8_t *data;
+    size_t n_bytes, n_pts;
+    // extent of the points padded by half the width, empty if not stored
+    struct gn_box bbox;
+    float width;
+    int32_t color;
+    uint32_t flags;
+};
+
+// fields of session and journal files are little endian
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    for (size_t i = 0; i < 4; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+static inline void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline void put_f32(uint8_t *p, float v) {
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    put_u32(p, u);
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static inline float get_f32(const uint8_t *p) {
+    uint32_t u = get_u32(p);
+    float v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+// unsigned varints, 7 bits a byte with the high bit set on all but the last
+static inline size_t put_uvarint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline bool get_uvarint(const uint8_t **p, const uint8_t *end,
+                               uint64_t *v) {
+    uint64_t z = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (*p == end) {
+            return false;
+        }
+        uint8_t b = *(*p)++;
+        z |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = z;
+            return true;
+        }
+    }
+    return false;
+}
+
+// zigzag varints of int32, the sign in the lowest bit
+static inline bool get_varint(const uint8_t **p, const uint8_t *end,
+                              int32_t *v) {
+    uint32_t z = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        if (*p == end) {
+            return false;
+        }
+        uint8_t b = *(*p)++;
+        z |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// strokes still being drawn are not saved
+static inline bool session_keeps_stroke(struct gn_stroke *stroke) {
+    return stroke->finished && stroke->n_pts > 0;
+}
+
+// encodes a stroke's points into data, which has room for
+// GN_SESSION_MAX_PT_BYTES per point, returning their size
+size_t encode_session_points(struct gn_stroke *stroke, uint8_t *data,
+                             struct gn_box *bbox);
+// the contents of a session file of the strokes kept, NULL on failure
+uint8_t *encode_session(struct gn_state *state, size_t *size);
+// replaces path atomically, through path.tmp
+bool write_session(const char *path, const uint8_t *data, size_t size);
+// finished strokes are saved in z order, the file is replaced atomically
+bool save_session(struct gn_state *state, const char *path);
+// adds a stroke to the canvas packed, reading its points from s.data when
+// they are needed. NULL if it is invalid or memory ran out.
+struct gn_stroke *load_session_stroke(struct gn_state *state,
+                                      struct gn_session_stroke s);
+// adds the strokes of a session file's contents to the canvas, name is the
+// file in messages. the contents must outlive the strokes. strokes take the
+// journal id of their entry, *n_entries is the number of entries if not
+// NULL.
+enum gn_session_load load_session_data(struct gn_state *state,
+                                       const uint8_t *file, size_t size,
+                                       const char *name, uint32_t *n_entries);
+// adds the strokes of a session to the canvas as load_session_data does. the
+// file stays mapped in gn_state::session_map.
+enum gn_session_load load_session(struct gn_state *state, const char *path,
+                                  uint32_t *n_entries);
+// unmaps the files the canvas was restored from, once no stroke reads them
+void cleanup_session_maps(struct gn_state *state);
+
+#endif
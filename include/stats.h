@@ -0,0 +1,60 @@
+#ifndef _GN_STATS_H
+#define _GN_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// values below this get a bucket each, larger ones this many buckets per
+// power of two, so a percentile is within 1/8 of the value it stands for
+#define GN_HISTOGRAM_SUB 8
+// up to 2^26 us, over a minute, larger values go in the last bucket
+#define GN_HISTOGRAM_BUCKETS 200
+
+struct gn_state;
+struct gn_output;
+
+struct gn_histogram {
+    uint64_t counts[GN_HISTOGRAM_BUCKETS];
+    uint64_t n;
+    uint64_t max;
+};
+
+// how long input takes to reach the screen. times are in ns of the clock
+// the compositor presents frames by, input is timed when it reaches us.
+struct gn_stats {
+    // clockid_t of the clock
+    uint32_t clock;
+    // arrival of the pointer event being handled, 0 outside its handler
+    uint64_t event_ns;
+
+    // us from the input a frame shows to its presentation
+    struct gn_histogram latency;
+    // us of cpu time taken to render and swap a frame
+    struct gn_histogram render;
+    uint64_t n_presented, n_discarded;
+    // refresh cycles skipped between frames drawn back to back
+    uint64_t n_missed;
+};
+
+void histogram_add(struct gn_histogram *hist, uint64_t value);
+// the value at or below which p of the values are, rounded up to the end of
+// its bucket
+uint64_t histogram_percentile(const struct gn_histogram *hist, double p);
+
+// times by CLOCK_MONOTONIC until the compositor names its clock
+void init_stats(struct gn_state *state);
+uint64_t stats_now(struct gn_stats *stats);
+// bracket the handling of pointer events that arrived at event_ns, so the
+// damage they do is traced to them
+void stats_begin_input(struct gn_stats *stats, uint64_t event_ns);
+void stats_end_input(struct gn_stats *stats);
+
+// asks for the presentation feedback of the frame about to be swapped on
+// output. follows is whether it was drawn as soon as the frame before it was
+// shown.
+void request_feedback(struct gn_output *output, bool follows);
+void stats_rendered(struct gn_stats *stats, uint64_t render_ns);
+// drops the feedback of the output's frames not presented yet
+void cleanup_feedback(struct gn_output *output);
+
+#endif
@@ -1,22 +1,59 @@
 #ifndef _GN_STROKE_H
 #define _GN_STROKE_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <wayland-util.h>
 
 #include "glassnote.h"
+#include "grid.h"
+#include "pool.h"
+#include "table.h"
+#include "utils.h"
 
-#define STROKE_DEFAULT_CAPACITY 64
-#define STROKE_MAX_PTS 4096
+// points per chunk, point i of a stroke is in its (i / STROKE_CHUNK_PTS)th
+#define STROKE_CHUNK_PTS 128
+// curves are drawn as lines at most this far from them
+#define STROKE_FLATTEN_TOLERANCE 0.25f
 
 #define STROKE_MIN_WIDTH 1.f
 #define STROKE_MAX_WIDTH 24.f
 
+// points are kept in fixed size chunks so growing a stroke never moves them
+struct gn_stroke_chunk {
+    struct gn_stroke_chunk *prev, *next;
+    // slab of gn_state::pool the chunk was carved from
+    struct gn_chunk_slab *slab;
+    struct gn_vec2 pts[STROKE_CHUNK_PTS];
+};
+
+// position of a point within its chunk
+struct gn_stroke_pos {
+    struct gn_stroke_chunk *chunk;
+    size_t off;
+};
+
+// directions of lines through origin, the start of the open segment, that
+// pass within the simplification threshold of every point of the segment.
+// the range [lo, hi] is in radians and may miss some valid directions, but
+// never includes an invalid one. angles are doubles since the wedge of a long
+// segment is narrower than the precision of a float.
+struct gn_stroke_wedge {
+    struct gn_vec2 origin;
+    bool bounded;
+    double lo, hi;
+};
+
 struct gn_stroke {
-    struct gn_vec2 *pts;
+    // slot in gn_state::strokes
+    struct gn_stroke_handle handle;
+    struct wl_list link; // gn_stroke_table::order
+
+    struct gn_stroke_chunk *head, *tail;
     size_t n_pts;
-    size_t capacity;
+    // gn_state::pool, where the chunks come from and go back to
+    struct gn_chunk_pool *pool;
 
     float width;
     int32_t color;
@@ -24,14 +61,131 @@ struct gn_stroke {
     // index of segment start
     // https://www.inkandswitch.com/ink/notes/super-simple-stroke-simplification/
     size_t seg_st;
+    struct gn_stroke_wedge wedge;
     // metrics for perf
     size_t pts_reported;
+
+    bool finished;
+    // the points are the control points p0 c1 c2 p1 c1 c2 p2 ... of cubic
+    // beziers fitted to the input
+    bool curved;
+    // every reported position is kept until the stroke is fitted, the
+    // simplified polyline is too coarse to fit closely
+    bool keep_input;
+    struct gn_vec2 *input;
+    size_t n_input, c_input;
+    // extent of the stroke including its width
+    struct gn_box bbox;
+    // points encoded as in a session file, in a file the canvas was restored
+    // from. a packed stroke has no chunks until it is unpacked.
+    const uint8_t *packed;
+    size_t n_packed;
+    // owned by the renderer while the stroke is in progress
+    struct gn_stream *stream;
+    // range of this stroke's instances in gn_lines_device::store, or in
+    // curve_store if it is curved
+    size_t store_st;
+    size_t store_n;
+    // instances of the store batches uploaded before the stroke's
+    size_t batch_pos;
+    // number of segments in gn_state::grid
+    size_t n_indexed;
+    // in gn_stroke_table::hidden, kept only for undo and redo
+    bool hidden;
+    // added by the history command still being recorded
+    bool recording;
+    // the slot is free, next_free is the one freed before it
+    bool removed;
+    uint32_t next_free;
+    // names the stroke in gn_state::journal, 0 if it was never written there
+    uint32_t journal_id;
 };
 
+static inline struct gn_vec2 *stroke_pos_pt(struct gn_stroke_pos pos) {
+    return &pos.chunk->pts[pos.off];
+}
+
+static inline void stroke_pos_next(struct gn_stroke_pos *pos) {
+    if (++pos->off == STROKE_CHUNK_PTS) {
+        pos->chunk = pos->chunk->next;
+        pos->off = 0;
+    }
+}
+
+// endpoints of the segment starting at pos
+static inline void stroke_pos_seg(struct gn_stroke_pos pos, struct gn_vec2 *p,
+                                  struct gn_vec2 *q) {
+    *p = *stroke_pos_pt(pos);
+    stroke_pos_next(&pos);
+    *q = *stroke_pos_pt(pos);
+}
+
+static inline size_t stroke_n_cubics(struct gn_stroke *stroke) {
+    return stroke->curved && stroke->n_pts >= 4 ? (stroke->n_pts - 1) / 3 : 0;
+}
+
+// first point of the segment, or cubic for curved strokes, of an entry
+static inline struct gn_stroke_pos grid_entry_pos(struct gn_stroke *stroke,
+                                                  struct gn_grid_entry entry) {
+    size_t i = stroke->curved ? entry.seg * 3 : entry.seg;
+    return (struct gn_stroke_pos){entry.chunk, i % STROKE_CHUNK_PTS};
+}
+
+// control points of the cubic starting at pos
+static inline void stroke_pos_cubic(struct gn_stroke_pos pos,
+                                    struct gn_vec2 c[4]) {
+    c[0] = *stroke_pos_pt(pos);
+    for (size_t i = 1; i < 4; i++) {
+        stroke_pos_next(&pos);
+        c[i] = *stroke_pos_pt(pos);
+    }
+}
+
+// the points of a packed stroke must be unpacked before they are read
+static inline bool stroke_is_packed(struct gn_stroke *stroke) {
+    return stroke->head == NULL && stroke->n_pts > 0;
+}
+
+// walks to point i from whichever end of the stroke is closer
+struct gn_stroke_pos stroke_seek(struct gn_stroke *stroke, size_t i);
+static inline struct gn_vec2 *stroke_pt(struct gn_stroke *stroke, size_t i) {
+    return stroke_pos_pt(stroke_seek(stroke, i));
+}
+
 struct gn_stroke *create_stroke(struct gn_state *state, double width,
                                 int32_t color);
-void extend_stroke(struct gn_stroke *stroke, double x, double y);
-void finish_stroke(struct gn_stroke *stroke);
+// margin the damage of a segment of stroke leaves around it
+float stroke_damage_pad(struct gn_stroke *stroke);
+// both grow damage, if given, by the area whose rendering changed
+void extend_stroke(struct gn_stroke *stroke, double x, double y,
+                   struct gn_box *damage);
+void finish_stroke(struct gn_stroke *stroke, struct gn_box *damage);
+// replaces a finished stroke's polyline with cubic beziers fitted to its
+// input when that takes fewer points, and drops the input. the stroke must not
+// be in the grid or uploaded yet.
+void fit_stroke(struct gn_stroke *stroke, struct gn_box *damage);
+// replaces the points of a stroke, which is finished and not in the grid or
+// uploaded. false if they could not all be added, the stroke is left as it
+// was.
+bool set_stroke_points(struct gn_stroke *stroke, const struct gn_vec2 *pts,
+                       size_t n);
+// decodes the points of a packed stroke into chunks, growing its bbox to
+// them. false if they could not be, the stroke is left packed.
+bool unpack_stroke(struct gn_stroke *stroke);
+// gives the chunks of an unpacked stroke back, its points stay packed
+void repack_stroke(struct gn_stroke *stroke);
 void destroy_stroke(struct gn_stroke *stroke);
+// tell gn_state::canvas_listener, if any, of a change to the canvas
+void canvas_damage(struct gn_state *state, struct gn_box box);
+void canvas_upload(struct gn_state *state, struct gn_stroke *stroke);
+void canvas_discard(struct gn_state *state, struct gn_stroke *stroke);
+// erases a stroke from the canvas for good, damaging the area it covered
+void remove_stroke(struct gn_state *state, struct gn_stroke *stroke);
+// erases the parts of stroke ind within radius of segment a-b, replacing it
+// with a new stroke per piece left and keeping it for undo. hits are the
+// segments of the stroke that may be affected, in order.
+void cut_stroke(struct gn_state *state, size_t ind,
+                const struct gn_grid_entry *hits, size_t n_hits,
+                struct gn_vec2 a, struct gn_vec2 b, float radius);
 
 #endif
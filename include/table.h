@@ -0,0 +1,56 @@
+#ifndef _GN_TABLE_H
+#define _GN_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+// slots per block, blocks are allocated whole and never move
+#define GN_TABLE_BLOCK_STROKES 256
+#define GN_TABLE_INIT_BLOCKS 16
+
+struct gn_stroke;
+
+// names the stroke in slot ind until it is removed. generations start at 1,
+// so a zeroed handle never names a stroke.
+struct gn_stroke_handle {
+    uint32_t ind;
+    uint32_t gen;
+};
+
+// every stroke of the canvas. slots are reused once their stroke is removed,
+// so pointers to strokes stay valid until then and handles catch the reuse.
+struct gn_stroke_table {
+    struct gn_stroke **blocks;
+    size_t n_blocks, c_blocks;
+    // slots handed out at least once
+    uint32_t n_slots;
+    // removed slots, linked through gn_stroke::next_free
+    uint32_t free;
+    size_t n_live;
+    // live strokes in the order they are drawn in, oldest first
+    struct wl_list order; // gn_stroke::link
+    // strokes off the canvas that undo or redo may bring back
+    struct wl_list hidden; // gn_stroke::link
+};
+
+void init_stroke_table(struct gn_stroke_table *table);
+// the slot is zeroed but for its handle, and goes on top of the z order
+struct gn_stroke *stroke_table_add(struct gn_stroke_table *table);
+void stroke_table_remove(struct gn_stroke_table *table,
+                         struct gn_stroke *stroke);
+// moves a live stroke to the hidden list and back, on top of the z order
+void stroke_table_hide(struct gn_stroke_table *table, struct gn_stroke *stroke);
+void stroke_table_show(struct gn_stroke_table *table, struct gn_stroke *stroke);
+// moves a live stroke on top of the z order
+void stroke_table_raise(struct gn_stroke_table *table,
+                        struct gn_stroke *stroke);
+struct gn_stroke *stroke_table_at(struct gn_stroke_table *table, uint32_t ind);
+// NULL once the stroke named by handle is removed
+struct gn_stroke *stroke_table_get(struct gn_stroke_table *table,
+                                   struct gn_stroke_handle handle);
+// the most recently added live stroke, or NULL
+struct gn_stroke *stroke_table_last(struct gn_stroke_table *table);
+void cleanup_stroke_table(struct gn_stroke_table *table);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _GN_TRACE_H
+#define _GN_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// a trace of the input that reached the seats, in little endian:
+//
+//   header  magic "GNTR", u32 version, f32 stroke width, u32 color index,
+//           5 i32 colors, u32 tool, f32 eraser radius, u32 flags,
+//           u64 history budget, u64 size of the session the canvas started
+//           from, then that session
+//   events  u8 type, uvarint us since the event before, then its fields
+//
+// the session is a snapshot in the session file format. replaying the events
+// through the seat handlers from it draws the same strokes, bit for bit,
+// which the hash at the end of the trace checks. version 2 added the touch
+// events, traces of version 1 are read as well.
+#define GN_TRACE_MAGIC "GNTR"
+#define GN_TRACE_VERSION 2
+#define GN_TRACE_HEADER_SZ 64
+#define GN_TRACE_N_COLORS 5
+#define GN_TRACE_FLAG_FIT_CURVES (1u << 0)
+// replays make a seat for every id, these are more than any compositor has
+#define GN_TRACE_MAX_SEATS 64
+
+enum gn_trace_type {
+    // the outputs were configured: uvarint width, uvarint height of the
+    // global space they cover from its origin
+    GN_TRACE_CONFIGURE = 1,
+    // uvarint seat, then the pointer's wl_fixed position in the global space
+    // as zigzag varints relative to the motion before, of any seat
+    GN_TRACE_MOTION = 2,
+    // uvarint seat, uvarint button, uvarint wl_pointer button state
+    GN_TRACE_BUTTON = 3,
+    // uvarint seat, uvarint keysym, uvarint wl_keyboard key state
+    GN_TRACE_KEY = 4,
+    // the recording stopped: u32 hash of the strokes on the canvas
+    GN_TRACE_END = 5,
+    // uvarint seat, the wl_touch id as a zigzag varint, then the position as
+    // for motion events, sharing their previous position
+    GN_TRACE_TOUCH_DOWN = 6,
+    GN_TRACE_TOUCH_MOTION = 7,
+    // uvarint seat, the wl_touch id as a zigzag varint
+    GN_TRACE_TOUCH_UP = 8,
+    // uvarint seat
+    GN_TRACE_TOUCH_FRAME = 9,
+    GN_TRACE_TOUCH_CANCEL = 10,
+};
+
+struct gn_state;
+struct gn_seat;
+
+struct gn_trace {
+    FILE *file;
+    // monotonic time the last event was recorded at
+    uint64_t last_us;
+    int32_t last_x, last_y;
+};
+
+struct gn_trace_event {
+    enum gn_trace_type type;
+    // since the trace started
+    uint64_t time_us;
+    uint32_t seat;
+    // the position, the size, the button, keysym or touch id and the
+    // button or key state, or the hash, by type
+    int32_t x, y;
+    uint32_t code, state;
+};
+
+// a trace mapped for replay
+struct gn_trace_reader {
+    const uint8_t *data;
+    size_t size;
+    const uint8_t *p;
+    uint64_t time_us;
+    int32_t x, y;
+};
+
+// starts recording to path from the canvas and settings as they are now
+bool start_trace(struct gn_state *state, const char *path);
+void trace_configure(struct gn_state *state, uint32_t width, uint32_t height);
+void trace_motion(struct gn_seat *seat, int32_t x, int32_t y);
+void trace_button(struct gn_seat *seat, uint32_t button, uint32_t state);
+void trace_key(struct gn_seat *seat, uint32_t keysym, uint32_t state);
+// a touch down or motion event, or the up event of the touch point id
+void trace_touch(struct gn_seat *seat, enum gn_trace_type type, int32_t id,
+                 int32_t x, int32_t y);
+void trace_touch_up(struct gn_seat *seat, int32_t id);
+// a touch frame or cancel event
+void trace_touch_frame(struct gn_seat *seat, enum gn_trace_type type);
+// ends the trace with the hash of the strokes, false if it could not be
+// written
+bool stop_trace(struct gn_state *state);
+
+// a hash of every stroke on the canvas, points, width, color and shape
+uint32_t hash_strokes(struct gn_state *state);
+
+// maps a trace and restores the settings and canvas it starts from. the
+// strokes of the canvas read their points from the trace until it is closed.
+bool open_trace(struct gn_trace_reader *reader, struct gn_state *state,
+                const char *path);
+// 1 with the next event, 0 at the end of the trace, which may be cut short,
+// and -1 if it is corrupt
+int next_trace_event(struct gn_trace_reader *reader,
+                     struct gn_trace_event *event);
+// feeds a pointer, key or touch event to its seat, which is created if it is
+// new. configure events are left to the caller.
+void replay_trace_event(struct gn_state *state,
+                        const struct gn_trace_event *event);
+void close_trace(struct gn_trace_reader *reader);
+
+#endif
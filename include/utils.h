@@ -2,6 +2,11 @@
 #define _GN_UTILS_H
 
 #include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// most lines a cubic is flattened into, whatever its size
+#define GN_CUBIC_MAX_LINES 256
 
 struct gn_vec2 {
     float x, y;
@@ -36,12 +41,150 @@ static inline struct gn_vec2 gn_vec2_minus(struct gn_vec2 a, struct gn_vec2 b) {
     return (struct gn_vec2){a.x - b.x, a.y - b.y};
 }
 
-static inline float gn_vec2_perp_dist(struct gn_vec2 p, struct gn_vec2 a,
-                                      struct gn_vec2 b) {
-    float A = b.y - a.y;
-    float B = a.x - b.x;
-    float C = b.x * a.y - a.x * b.y;
-    return fabsf(A * p.x + B * p.y + C) / sqrtf(A * A + B * B);
+static inline struct gn_vec2 gn_vec2_scale(struct gn_vec2 vec, float s) {
+    return (struct gn_vec2){vec.x * s, vec.y * s};
+}
+
+// unit vector along vec, or zero if vec is
+static inline struct gn_vec2 gn_vec2_normalize(struct gn_vec2 vec) {
+    float norm = gn_vec2_norm(vec);
+    return norm > 0.f ? gn_vec2_scale(vec, 1.f / norm) : vec;
+}
+
+static inline struct gn_vec2 gn_vec2_lerp(struct gn_vec2 a, struct gn_vec2 b,
+                                          float t) {
+    return (struct gn_vec2){a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t};
+}
+
+static inline float gn_vec2_cross(struct gn_vec2 a, struct gn_vec2 b) {
+    return a.x * b.y - a.y * b.x;
+}
+
+// squared distance from p to segment a-b
+static inline float gn_vec2_seg_dist_sq(struct gn_vec2 p, struct gn_vec2 a,
+                                        struct gn_vec2 b) {
+    struct gn_vec2 ab = gn_vec2_minus(b, a);
+    struct gn_vec2 ap = gn_vec2_minus(p, a);
+    float len_sq = gn_vec2_norm_sq(ab);
+    float t = len_sq > 0.f ? gn_vec2_dot(ap, ab) / len_sq : 0.f;
+    t = fminf(fmaxf(t, 0.f), 1.f);
+    struct gn_vec2 closest = {ab.x * t, ab.y * t};
+    return gn_vec2_norm_sq(gn_vec2_minus(ap, closest));
+}
+
+// squared distance between segments a-b and c-d
+static inline float gn_seg_dist_sq(struct gn_vec2 a, struct gn_vec2 b,
+                                   struct gn_vec2 c, struct gn_vec2 d) {
+    struct gn_vec2 ab = gn_vec2_minus(b, a);
+    struct gn_vec2 cd = gn_vec2_minus(d, c);
+    float d1 = gn_vec2_cross(ab, gn_vec2_minus(c, a));
+    float d2 = gn_vec2_cross(ab, gn_vec2_minus(d, a));
+    float d3 = gn_vec2_cross(cd, gn_vec2_minus(a, c));
+    float d4 = gn_vec2_cross(cd, gn_vec2_minus(b, c));
+    if (((d1 > 0.f && d2 < 0.f) || (d1 < 0.f && d2 > 0.f)) &&
+        ((d3 > 0.f && d4 < 0.f) || (d3 < 0.f && d4 > 0.f))) {
+        return 0.f;
+    }
+    float ends_ab =
+        fminf(gn_vec2_seg_dist_sq(a, c, d), gn_vec2_seg_dist_sq(b, c, d));
+    float ends_cd =
+        fminf(gn_vec2_seg_dist_sq(c, a, b), gn_vec2_seg_dist_sq(d, a, b));
+    return fminf(ends_ab, ends_cd);
+}
+
+// point at t of the cubic bezier with control points c
+static inline struct gn_vec2 gn_cubic_eval(const struct gn_vec2 c[4], float t) {
+    float s = 1.f - t;
+    float b0 = s * s * s, b1 = 3.f * s * s * t, b2 = 3.f * s * t * t,
+          b3 = t * t * t;
+    return (struct gn_vec2){
+        b0 * c[0].x + b1 * c[1].x + b2 * c[2].x + b3 * c[3].x,
+        b0 * c[0].y + b1 * c[1].y + b2 * c[2].y + b3 * c[3].y,
+    };
+}
+
+// number of equal steps in t whose chords stay within tol of the cubic,
+// from Wang's formula
+static inline size_t gn_cubic_n_lines(const struct gn_vec2 c[4], float tol) {
+    struct gn_vec2 d1 = {c[0].x - 2.f * c[1].x + c[2].x,
+                         c[0].y - 2.f * c[1].y + c[2].y};
+    struct gn_vec2 d2 = {c[1].x - 2.f * c[2].x + c[3].x,
+                         c[1].y - 2.f * c[2].y + c[3].y};
+    float m = sqrtf(fmaxf(gn_vec2_norm_sq(d1), gn_vec2_norm_sq(d2)));
+    float n = ceilf(sqrtf(0.75f * m / tol));
+    if (!(n > 1.f)) {
+        return 1;
+    }
+    return n < GN_CUBIC_MAX_LINES ? (size_t)n : GN_CUBIC_MAX_LINES;
+}
+
+// control points of the part of the cubic between t0 and t1, which are the
+// blossoms (t0, t0, t0), (t0, t0, t1), (t0, t1, t1) and (t1, t1, t1)
+static inline void gn_cubic_sub(const struct gn_vec2 c[4], float t0, float t1,
+                                struct gn_vec2 out[4]) {
+    for (size_t i = 0; i < 4; i++) {
+        float t[3] = {i < 3 ? t0 : t1, i < 2 ? t0 : t1, i < 1 ? t0 : t1};
+        struct gn_vec2 p[3];
+        for (size_t j = 0; j < 3; j++) {
+            p[j] = gn_vec2_lerp(c[j], c[j + 1], t[0]);
+        }
+        for (size_t j = 0; j < 2; j++) {
+            p[j] = gn_vec2_lerp(p[j], p[j + 1], t[1]);
+        }
+        out[i] = gn_vec2_lerp(p[0], p[1], t[2]);
+    }
+}
+
+// writes the ends of the lines the cubic is flattened into, all but c[0], to
+// out, which holds GN_CUBIC_MAX_LINES points. returns the number of lines.
+static inline size_t gn_cubic_flatten(const struct gn_vec2 c[4], float tol,
+                                      struct gn_vec2 *out) {
+    size_t n = gn_cubic_n_lines(c, tol);
+    for (size_t i = 1; i < n; i++) {
+        out[i - 1] = gn_cubic_eval(c, (float)i / n);
+    }
+    out[n - 1] = c[3];
+    return n;
+}
+
+static inline bool gn_box_is_empty(struct gn_box box) {
+    return box.size.x <= 0.f || box.size.y <= 0.f;
+}
+
+static inline struct gn_box gn_box_from_corners(float x0, float y0, float x1,
+                                                float y1) {
+    return (struct gn_box){{x0, y0}, {x1 - x0, y1 - y0}};
+}
+
+// smallest box containing segment a-b with pad to spare on every side
+static inline struct gn_box gn_box_from_segment(struct gn_vec2 a,
+                                                struct gn_vec2 b, float pad) {
+    return gn_box_from_corners(fminf(a.x, b.x) - pad, fminf(a.y, b.y) - pad,
+                               fmaxf(a.x, b.x) + pad, fmaxf(a.y, b.y) + pad);
+}
+
+static inline struct gn_box gn_box_union(struct gn_box a, struct gn_box b) {
+    if (gn_box_is_empty(a)) {
+        return b;
+    }
+    if (gn_box_is_empty(b)) {
+        return a;
+    }
+    return gn_box_from_corners(fminf(a.pos.x, b.pos.x), fminf(a.pos.y, b.pos.y),
+                               fmaxf(a.pos.x + a.size.x, b.pos.x + b.size.x),
+                               fmaxf(a.pos.y + a.size.y, b.pos.y + b.size.y));
+}
+
+static inline struct gn_box gn_box_intersect(struct gn_box a, struct gn_box b) {
+    struct gn_box box = gn_box_from_corners(
+        fmaxf(a.pos.x, b.pos.x), fmaxf(a.pos.y, b.pos.y),
+        fminf(a.pos.x + a.size.x, b.pos.x + b.size.x),
+        fminf(a.pos.y + a.size.y, b.pos.y + b.size.y));
+    return gn_box_is_empty(box) ? (struct gn_box){0} : box;
+}
+
+static inline float gn_box_area(struct gn_box box) {
+    return gn_box_is_empty(box) ? 0.f : box.size.x * box.size.y;
 }
 
 #endif
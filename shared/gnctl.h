@@ -8,5 +8,8 @@
 #define GN_SD_BUS_HIDE_CMD "HideOverlay"
 #define GN_SD_BUS_COLOR_CMD "ChangeColor"
 #define GN_SD_BUS_WIDTH_CMD "ChangeWidth"
+#define GN_SD_BUS_USAGE_CMD "GetUsage"
+#define GN_SD_BUS_SAVE_CMD "SaveSession"
+#define GN_SD_BUS_STATS_CMD "GetStats"
 
 #endif
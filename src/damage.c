@@ -0,0 +1,139 @@
+#include <math.h>
+#include <string.h>
+
+#include "glassnote.h"
+#include "stats.h"
+#include "utils.h"
+
+// merges box into an overlapping rect, or into the rect that grows the least
+// once there is no room left, so the list stays short
+static void add_damage(struct gn_damage *damage, struct gn_box box) {
+    if (damage->full || gn_box_is_empty(box)) {
+        return;
+    }
+
+    for (size_t i = 0; i < damage->n_rects;) {
+        if (gn_box_is_empty(gn_box_intersect(damage->rects[i], box))) {
+            i++;
+            continue;
+        }
+        // the merged rect may overlap rects that were checked already
+        box = gn_box_union(damage->rects[i], box);
+        damage->rects[i] = damage->rects[--damage->n_rects];
+        i = 0;
+    }
+
+    if (damage->n_rects < GN_DAMAGE_MAX_RECTS) {
+        damage->rects[damage->n_rects++] = box;
+        return;
+    }
+
+    size_t best = 0;
+    float best_growth = INFINITY;
+    for (size_t i = 0; i < damage->n_rects; i++) {
+        float growth = gn_box_area(gn_box_union(damage->rects[i], box)) -
+                       gn_box_area(damage->rects[i]);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    damage->rects[best] = gn_box_union(damage->rects[best], box);
+}
+
+static void merge_damage(struct gn_damage *dst, const struct gn_damage *src) {
+    if (src->full) {
+        dst->full = true;
+        return;
+    }
+    for (size_t i = 0; i < src->n_rects; i++) {
+        add_damage(dst, src->rects[i]);
+    }
+}
+
+struct gn_box output_box(const struct gn_output *output) {
+    return (struct gn_box){{output->x, output->y},
+                           {output->width, output->height}};
+}
+
+struct gn_box buffer_rect(const struct gn_output *output, struct gn_box rect) {
+    float sx = (float)output->buffer_width / output->width;
+    float sy = (float)output->buffer_height / output->height;
+    return gn_box_from_corners(floorf(rect.pos.x * sx), floorf(rect.pos.y * sy),
+                               ceilf((rect.pos.x + rect.size.x) * sx),
+                               ceilf((rect.pos.y + rect.size.y) * sy));
+}
+
+// adds the part of box, in the global space, that is on output to its
+// damage. false if none is.
+static bool add_output_damage(struct gn_output *output, struct gn_box box) {
+    box = gn_box_intersect(box, output_box(output));
+    if (gn_box_is_empty(box)) {
+        return false;
+    }
+    box.pos.x -= output->x;
+    box.pos.y -= output->y;
+    box = gn_box_from_corners(floorf(box.pos.x), floorf(box.pos.y),
+                              ceilf(box.pos.x + box.size.x),
+                              ceilf(box.pos.y + box.size.y));
+
+    add_damage(&output->damage, box);
+    return true;
+}
+
+// outputs other than drawing are asked for a frame, and told which input
+// changed it
+static void damage_outputs(struct gn_state *state, struct gn_box box,
+                           struct gn_output *drawing) {
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (!add_output_damage(output, box) || output == drawing) {
+            continue;
+        }
+        if (output->input_ns == 0) {
+            output->input_ns = state->stats.event_ns;
+        }
+        set_output_dirty(output);
+    }
+}
+
+void damage_output(struct gn_state *state, struct gn_box box) {
+    damage_outputs(state, box, NULL);
+}
+
+void damage_frame(struct gn_state *state, struct gn_output *drawing,
+                  struct gn_box box) {
+    damage_outputs(state, box, drawing);
+}
+
+void damage_output_full(struct gn_state *state) {
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        output->damage.full = true;
+        if (output->input_ns == 0) {
+            output->input_ns = state->stats.event_ns;
+        }
+        set_output_dirty(output);
+    }
+}
+
+struct gn_damage repaint_damage(struct gn_output *output, int age) {
+    // the back buffer already holds the frame from `age` swaps ago, so only
+    // what changed since then has to be repainted
+    struct gn_damage repaint = output->damage;
+    if (age <= 0 || age > GN_DAMAGE_HISTORY + 1) {
+        repaint.full = true;
+    } else {
+        for (int i = 0; i < age - 1; i++) {
+            merge_damage(&repaint, &output->history[i]);
+        }
+    }
+    return repaint;
+}
+
+void push_damage(struct gn_output *output) {
+    memmove(&output->history[1], &output->history[0],
+            (GN_DAMAGE_HISTORY - 1) * sizeof(struct gn_damage));
+    output->history[0] = output->damage;
+    output->damage = (struct gn_damage){0};
+}
@@ -0,0 +1,297 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "glassnote.h"
+#include "grid.h"
+#include "stroke.h"
+#include "utils.h"
+
+// segments before seg_st no longer move while the stroke is in progress.
+// curved strokes are indexed by cubic.
+static size_t stroke_final_segments(struct gn_stroke *stroke) {
+    if (!stroke->finished) {
+        return stroke->seg_st;
+    }
+    if (stroke->curved) {
+        return stroke_n_cubics(stroke);
+    }
+    return stroke->n_pts < 2 ? 0 : stroke->n_pts - 1;
+}
+
+// the cell of global coordinate v, on an axis whose cells start at origin
+static int32_t grid_coord(float v, int32_t origin, int32_t n) {
+    float c = floorf((v - origin) / GN_GRID_CELL_SZ);
+    // clamp before converting, the cast is undefined out of range
+    if (!(c > 0.f)) {
+        return 0;
+    }
+    return c >= (float)(n - 1) ? n - 1 : (int32_t)c;
+}
+
+struct gn_grid_range {
+    int32_t x0, y0, x1, y1;
+};
+
+static struct gn_grid_range grid_range(struct gn_grid *grid,
+                                       struct gn_box box) {
+    return (struct gn_grid_range){
+        grid_coord(box.pos.x, grid->x, grid->cols),
+        grid_coord(box.pos.y, grid->y, grid->rows),
+        grid_coord(box.pos.x + box.size.x, grid->x, grid->cols),
+        grid_coord(box.pos.y + box.size.y, grid->y, grid->rows),
+    };
+}
+
+static bool cell_push(struct gn_grid_cell *cell, struct gn_grid_entry entry) {
+    if (cell->n_entries == cell->c_entries) {
+        size_t c_entries = cell->c_entries == 0 ? GN_GRID_CELL_INIT_ENTRIES
+                                                : cell->c_entries * 2;
+        struct gn_grid_entry *entries =
+            realloc(cell->entries, c_entries * sizeof(struct gn_grid_entry));
+        if (entries == NULL) {
+            return false;
+        }
+        cell->entries = entries;
+        cell->c_entries = c_entries;
+    }
+    cell->entries[cell->n_entries++] = entry;
+    return true;
+}
+
+void resize_grid(struct gn_state *state, int32_t x, int32_t y, int32_t width,
+                 int32_t height) {
+    struct gn_grid *grid = &state->grid;
+    int32_t cols = (int32_t)ceilf(width / GN_GRID_CELL_SZ);
+    int32_t rows = (int32_t)ceilf(height / GN_GRID_CELL_SZ);
+    cols = cols < 1 ? 1 : cols;
+    rows = rows < 1 ? 1 : rows;
+    if (grid->cells != NULL && grid->cols == cols && grid->rows == rows &&
+        grid->x == x && grid->y == y) {
+        return;
+    }
+
+    cleanup_grid(grid);
+    grid->cells = calloc((size_t)cols * rows, sizeof(struct gn_grid_cell));
+    if (grid->cells == NULL) {
+        fprintf(stderr, "Failed to allocate memory for grid\n");
+        return;
+    }
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->x = x;
+    grid->y = y;
+
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        stroke->n_indexed = 0;
+        index_stroke(state, stroke);
+    }
+}
+
+void cleanup_grid(struct gn_grid *grid) {
+    if (grid->cells != NULL) {
+        for (int32_t i = 0; i < grid->cols * grid->rows; i++) {
+            free(grid->cells[i].entries);
+        }
+        free(grid->cells);
+    }
+    free(grid->hits);
+    *grid = (struct gn_grid){0};
+}
+
+void index_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_grid *grid = &state->grid;
+    if (grid->cells == NULL) {
+        return;
+    }
+
+    uint32_t ind = stroke->handle.ind;
+    size_t n = stroke_final_segments(stroke);
+    if (stroke->n_indexed >= n) {
+        return;
+    }
+
+    if (stroke_is_packed(stroke)) {
+        // it is found by its bbox until a hit test unpacks it
+        struct gn_grid_entry entry = {ind, GN_GRID_PACKED, NULL};
+        struct gn_grid_range r = grid_range(grid, stroke->bbox);
+        stroke->n_indexed = n;
+        for (int32_t y = r.y0; y <= r.y1; y++) {
+            for (int32_t x = r.x0; x <= r.x1; x++) {
+                struct gn_grid_cell *cell = &grid->cells[y * grid->cols + x];
+                if (!cell_push(cell, entry)) {
+                    fprintf(stderr, "Failed to allocate memory for grid\n");
+                    return;
+                }
+            }
+        }
+        return;
+    }
+
+    float pad = stroke->width * 0.5f;
+    size_t step = stroke->curved ? 3 : 1;
+    struct gn_stroke_pos pos = stroke_seek(stroke, stroke->n_indexed * step);
+    for (size_t i = stroke->n_indexed; i < n; i++) {
+        struct gn_grid_entry entry = {ind, i, pos.chunk};
+        struct gn_box box;
+        if (stroke->curved) {
+            // the curve lies within the hull of its control points
+            struct gn_vec2 c[4];
+            stroke_pos_cubic(pos, c);
+            box = gn_box_union(gn_box_from_segment(c[0], c[1], pad),
+                               gn_box_from_segment(c[2], c[3], pad));
+        } else {
+            struct gn_vec2 p, q;
+            stroke_pos_seg(pos, &p, &q);
+            box = gn_box_from_segment(p, q, pad);
+        }
+        for (size_t j = 0; j < step; j++) {
+            stroke_pos_next(&pos);
+        }
+
+        struct gn_grid_range r = grid_range(grid, box);
+        for (int32_t y = r.y0; y <= r.y1; y++) {
+            for (int32_t x = r.x0; x <= r.x1; x++) {
+                struct gn_grid_cell *cell = &grid->cells[y * grid->cols + x];
+                if (!cell_push(cell, entry)) {
+                    fprintf(stderr, "Failed to allocate memory for grid\n");
+                    stroke->n_indexed = i;
+                    return;
+                }
+            }
+        }
+    }
+    stroke->n_indexed = n;
+}
+
+void unindex_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_grid *grid = &state->grid;
+    if (grid->cells == NULL || stroke->n_indexed == 0) {
+        return;
+    }
+
+    // the bbox covers every segment box, including the ones already indexed
+    uint32_t ind = stroke->handle.ind;
+    struct gn_grid_range r = grid_range(grid, stroke->bbox);
+    for (int32_t y = r.y0; y <= r.y1; y++) {
+        for (int32_t x = r.x0; x <= r.x1; x++) {
+            struct gn_grid_cell *cell = &grid->cells[y * grid->cols + x];
+            for (size_t i = 0; i < cell->n_entries;) {
+                if (cell->entries[i].stroke == ind) {
+                    cell->entries[i] = cell->entries[--cell->n_entries];
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+    stroke->n_indexed = 0;
+}
+
+// squared distance from segment a-b to the lines the cubic is drawn with
+static float cubic_dist_sq(const struct gn_vec2 c[4], struct gn_vec2 a,
+                           struct gn_vec2 b) {
+    struct gn_vec2 pts[GN_CUBIC_MAX_LINES];
+    size_t n = gn_cubic_flatten(c, STROKE_FLATTEN_TOLERANCE, pts);
+    float dist_sq = INFINITY;
+    struct gn_vec2 prev = c[0];
+    for (size_t i = 0; i < n; i++) {
+        dist_sq = fminf(dist_sq, gn_seg_dist_sq(prev, pts[i], a, b));
+        prev = pts[i];
+    }
+    return dist_sq;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const struct gn_grid_entry *ea = a, *eb = b;
+    if (ea->stroke != eb->stroke) {
+        return ea->stroke < eb->stroke ? -1 : 1;
+    }
+    return ea->seg < eb->seg ? -1 : ea->seg > eb->seg;
+}
+
+size_t grid_hit_test(struct gn_state *state, struct gn_vec2 a,
+                     struct gn_vec2 b, float radius) {
+    struct gn_grid *grid = &state->grid;
+    if (grid->cells == NULL) {
+        grid->n_hits = 0;
+        return 0;
+    }
+
+    struct gn_box query = gn_box_from_segment(a, b, radius);
+    struct gn_grid_range r = grid_range(grid, query);
+again:
+    grid->n_hits = 0;
+    for (int32_t y = r.y0; y <= r.y1; y++) {
+        for (int32_t x = r.x0; x <= r.x1; x++) {
+            struct gn_grid_cell *cell = &grid->cells[y * grid->cols + x];
+            for (size_t i = 0; i < cell->n_entries; i++) {
+                struct gn_grid_entry entry = cell->entries[i];
+                struct gn_stroke *stroke =
+                    stroke_table_at(&state->strokes, entry.stroke);
+                if (!stroke->finished) {
+                    continue;
+                }
+                if (entry.seg == GN_GRID_PACKED) {
+                    // the cells change as its segments replace its bbox, the
+                    // test starts over
+                    struct gn_box near = gn_box_intersect(stroke->bbox, query);
+                    if (gn_box_is_empty(near) || !unpack_stroke(stroke)) {
+                        continue;
+                    }
+                    unindex_stroke(state, stroke);
+                    index_stroke(state, stroke);
+                    goto again;
+                }
+                float reach = radius + stroke->width * 0.5f;
+                struct gn_stroke_pos pos = grid_entry_pos(stroke, entry);
+                float dist_sq;
+                if (stroke->curved) {
+                    struct gn_vec2 c[4];
+                    stroke_pos_cubic(pos, c);
+                    dist_sq = cubic_dist_sq(c, a, b);
+                } else {
+                    struct gn_vec2 p, q;
+                    stroke_pos_seg(pos, &p, &q);
+                    dist_sq = gn_seg_dist_sq(p, q, a, b);
+                }
+                if (dist_sq > reach * reach) {
+                    continue;
+                }
+
+                if (grid->n_hits == grid->c_hits) {
+                    size_t c_hits = grid->c_hits == 0
+                                        ? GN_GRID_CELL_INIT_ENTRIES
+                                        : grid->c_hits * 2;
+                    struct gn_grid_entry *hits = realloc(
+                        grid->hits, c_hits * sizeof(struct gn_grid_entry));
+                    if (hits == NULL) {
+                        fprintf(stderr,
+                                "Failed to allocate memory for hits\n");
+                        goto done;
+                    }
+                    grid->hits = hits;
+                    grid->c_hits = c_hits;
+                }
+                grid->hits[grid->n_hits++] = entry;
+            }
+        }
+    }
+
+done:
+    if (grid->n_hits == 0) {
+        return 0;
+    }
+    // segments spanning several cells are found once per cell
+    qsort(grid->hits, grid->n_hits, sizeof(struct gn_grid_entry),
+          compare_entries);
+    size_t n = 1;
+    for (size_t i = 1; i < grid->n_hits; i++) {
+        if (compare_entries(&grid->hits[i], &grid->hits[n - 1]) != 0) {
+            grid->hits[n++] = grid->hits[i];
+        }
+    }
+    grid->n_hits = n;
+    return n;
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glassnote.h"
+#include "grid.h"
+#include "history.h"
+#include "journal.h"
+#include "stroke.h"
+#include "table.h"
+
+// a packed stroke reads its points from the session file, it has no chunks
+// until it is unpacked
+static size_t stroke_n_chunks(struct gn_stroke *stroke) {
+    if (stroke_is_packed(stroke)) {
+        return 0;
+    }
+    return (stroke->n_pts + STROKE_CHUNK_PTS - 1) / STROKE_CHUNK_PTS;
+}
+
+static void hide_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    journal_remove(state, stroke);
+    canvas_damage(state, stroke->bbox);
+    unindex_stroke(state, stroke);
+    canvas_discard(state, stroke);
+    stroke_table_hide(&state->strokes, stroke);
+    state->history.n_hidden_chunks += stroke_n_chunks(stroke);
+}
+
+static void show_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    state->history.n_hidden_chunks -= stroke_n_chunks(stroke);
+    stroke_table_show(&state->strokes, stroke);
+    index_stroke(state, stroke);
+    canvas_upload(state, stroke);
+    canvas_damage(state, stroke->bbox);
+    journal_add(state, stroke);
+}
+
+// frees a hidden stroke once no command can bring it back
+static void free_hidden(struct gn_state *state, struct gn_stroke *stroke) {
+    state->history.n_hidden_chunks -= stroke_n_chunks(stroke);
+    destroy_stroke(stroke);
+    stroke_table_remove(&state->strokes, stroke);
+}
+
+static struct gn_stroke *ref_stroke(struct gn_state *state, uint32_t ref) {
+    return stroke_table_at(&state->strokes, ref & ~GN_HISTORY_ADDED);
+}
+
+static bool ref_added(uint32_t ref) {
+    return (ref & GN_HISTORY_ADDED) != 0;
+}
+
+// frees the strokes the command hid when it was applied, or the ones undoing
+// it hid if added
+static void free_cmd_strokes(struct gn_state *state,
+                             struct gn_history_cmd cmd, bool added) {
+    uint32_t *refs = &state->history.refs[cmd.ref];
+    for (size_t i = 0; i < cmd.n_refs; i++) {
+        if (ref_added(refs[i]) == added) {
+            free_hidden(state, ref_stroke(state, refs[i]));
+        }
+    }
+}
+
+static void drop_first(struct gn_state *state) {
+    struct gn_history *history = &state->history;
+    free_cmd_strokes(state, history->cmds[history->st], false);
+    history->st++;
+    if (history->st == history->n) {
+        history->st = history->pos = history->n = 0;
+        history->refs_st = history->n_refs = 0;
+    } else {
+        history->refs_st = history->cmds[history->st].ref;
+    }
+}
+
+static void drop_last(struct gn_state *state) {
+    struct gn_history *history = &state->history;
+    struct gn_history_cmd cmd = history->cmds[history->n - 1];
+    free_cmd_strokes(state, cmd, true);
+    history->n--;
+    history->n_refs = cmd.ref;
+}
+
+static bool push_cmd(struct gn_history *history) {
+    if (history->n == history->c_cmds) {
+        // the room of dropped commands is reused once it is half the log
+        if (history->st > 0 && history->st >= history->n / 2) {
+            memmove(history->cmds, &history->cmds[history->st],
+                    (history->n - history->st) * sizeof(*history->cmds));
+            history->pos -= history->st;
+            history->n -= history->st;
+            history->st = 0;
+        } else {
+            size_t c_cmds = history->c_cmds == 0 ? GN_HISTORY_INIT_CMDS
+                                                 : history->c_cmds * 2;
+            struct gn_history_cmd *cmds =
+                realloc(history->cmds, c_cmds * sizeof(*cmds));
+            if (cmds == NULL) {
+                fprintf(stderr, "Failed to allocate memory for history\n");
+                return false;
+            }
+            history->cmds = cmds;
+            history->c_cmds = c_cmds;
+        }
+    }
+    history->cmds[history->n++] =
+        (struct gn_history_cmd){.ref = history->n_refs};
+    return true;
+}
+
+// adds a ref to the open command
+static bool push_ref(struct gn_history *history, uint32_t ref) {
+    if (history->n_refs == history->c_refs) {
+        if (history->refs_st > 0 && history->refs_st >= history->n_refs / 2) {
+            memmove(history->refs, &history->refs[history->refs_st],
+                    (history->n_refs - history->refs_st) * sizeof(uint32_t));
+            for (size_t i = history->st; i < history->n; i++) {
+                history->cmds[i].ref -= history->refs_st;
+            }
+            history->n_refs -= history->refs_st;
+            history->refs_st = 0;
+        } else {
+            size_t c_refs = history->c_refs == 0 ? GN_HISTORY_INIT_REFS
+                                                 : history->c_refs * 2;
+            uint32_t *refs = realloc(history->refs, c_refs * sizeof(uint32_t));
+            if (refs == NULL) {
+                fprintf(stderr, "Failed to allocate memory for history\n");
+                return false;
+            }
+            history->refs = refs;
+            history->c_refs = c_refs;
+        }
+    }
+    history->refs[history->n_refs++] = ref;
+    history->cmds[history->n - 1].n_refs++;
+    return true;
+}
+
+void history_begin(struct gn_state *state) {
+    struct gn_history *history = &state->history;
+    if (history->n_open++ > 0) {
+        return;
+    }
+    // a new step replaces the ones that were undone
+    while (history->n > history->pos) {
+        drop_last(state);
+    }
+    if (!push_cmd(history)) {
+        history->n_open = 0;
+    }
+}
+
+void history_end(struct gn_state *state) {
+    struct gn_history *history = &state->history;
+    if (history->n_open == 0 || --history->n_open > 0) {
+        return;
+    }
+
+    struct gn_history_cmd *cmd = &history->cmds[history->n - 1];
+    for (size_t i = 0; i < cmd->n_refs; i++) {
+        ref_stroke(state, history->refs[cmd->ref + i])->recording = false;
+    }
+    if (cmd->n_refs == 0) {
+        history->n--;
+    }
+    history->pos = history->n;
+
+    while (history_bytes(history) > history->budget &&
+           history->st < history->n) {
+        if (history->st < history->pos) {
+            drop_first(state);
+        } else {
+            drop_last(state);
+        }
+    }
+}
+
+void history_add(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_history *history = &state->history;
+    journal_add(state, stroke);
+    bool own = history->n_open == 0;
+    if (own) {
+        history_begin(state);
+    }
+    if (history->n_open > 0 &&
+        push_ref(history, stroke->handle.ind | GN_HISTORY_ADDED)) {
+        stroke->recording = true;
+    }
+    if (own) {
+        history_end(state);
+    }
+}
+
+void history_erase(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_history *history = &state->history;
+    if (stroke->recording) {
+        // no step can bring back a stroke added by the one being recorded
+        struct gn_history_cmd *cmd = &history->cmds[history->n - 1];
+        uint32_t *refs = &history->refs[cmd->ref];
+        uint32_t ref = stroke->handle.ind | GN_HISTORY_ADDED;
+        for (size_t i = cmd->n_refs; i-- > 0;) {
+            if (refs[i] == ref) {
+                memmove(&refs[i], &refs[i + 1],
+                        (cmd->n_refs - i - 1) * sizeof(uint32_t));
+                cmd->n_refs--;
+                history->n_refs--;
+                break;
+            }
+        }
+        journal_remove(state, stroke);
+        remove_stroke(state, stroke);
+        return;
+    }
+
+    bool own = history->n_open == 0;
+    if (own) {
+        history_begin(state);
+    }
+    if (history->n_open > 0 && push_ref(history, stroke->handle.ind)) {
+        hide_stroke(state, stroke);
+    } else {
+        journal_remove(state, stroke);
+        remove_stroke(state, stroke);
+    }
+    if (own) {
+        history_end(state);
+    }
+}
+
+// undo and redo end the gestures still recording
+static void history_close(struct gn_state *state) {
+    if (state->history.n_open > 0) {
+        state->history.n_open = 1;
+        history_end(state);
+    }
+}
+
+bool history_undo(struct gn_state *state) {
+    struct gn_history *history = &state->history;
+    history_close(state);
+    if (history->pos == history->st) {
+        return false;
+    }
+    struct gn_history_cmd cmd = history->cmds[--history->pos];
+    uint32_t *refs = &history->refs[cmd.ref];
+    for (size_t i = 0; i < cmd.n_refs; i++) {
+        if (ref_added(refs[i])) {
+            hide_stroke(state, ref_stroke(state, refs[i]));
+        }
+    }
+    for (size_t i = 0; i < cmd.n_refs; i++) {
+        if (!ref_added(refs[i])) {
+            show_stroke(state, ref_stroke(state, refs[i]));
+        }
+    }
+    return true;
+}
+
+bool history_redo(struct gn_state *state) {
+    struct gn_history *history = &state->history;
+    history_close(state);
+    if (history->pos == history->n) {
+        return false;
+    }
+    struct gn_history_cmd cmd = history->cmds[history->pos++];
+    uint32_t *refs = &history->refs[cmd.ref];
+    for (size_t i = 0; i < cmd.n_refs; i++) {
+        if (!ref_added(refs[i])) {
+            hide_stroke(state, ref_stroke(state, refs[i]));
+        }
+    }
+    for (size_t i = 0; i < cmd.n_refs; i++) {
+        if (ref_added(refs[i])) {
+            show_stroke(state, ref_stroke(state, refs[i]));
+        }
+    }
+    return true;
+}
+
+size_t history_bytes(struct gn_history *history) {
+    return history->n_hidden_chunks * sizeof(struct gn_stroke_chunk) +
+           history->c_cmds * sizeof(struct gn_history_cmd) +
+           history->c_refs * sizeof(uint32_t);
+}
+
+void cleanup_history(struct gn_history *history) {
+    free(history->cmds);
+    free(history->refs);
+    *history = (struct gn_history){.budget = history->budget};
+}
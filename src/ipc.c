@@ -14,17 +14,35 @@
 #include "glassnote.h"
 #include "gnctl.h"
 #include "ipc.h"
+#include "journal.h"
+#include "pool.h"
+#include "session.h"
+#include "stats.h"
+#include "stroke.h"
+
+// false if no output is configured to take it
+static bool set_input_regions(struct gn_state *state,
+                              struct wl_region *region) {
+    bool any = false;
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (output->configured) {
+            wl_surface_set_input_region(output->surface, region);
+            wl_surface_commit(output->surface);
+            any = true;
+        }
+    }
+    return any;
+}
 
 static int on_show_overlay(sd_bus_message *m, void *userdata,
                            sd_bus_error *ret) {
     struct gn_state *state = userdata;
     bool success = false;
 
-    if (state->output.configured && !state->active) {
-        wl_surface_set_input_region(state->output.surface, NULL);
-        set_output_dirty(state);
+    if (!state->active && set_input_regions(state, NULL)) {
         state->active = true;
-        wl_surface_commit(state->output.surface);
+        damage_output_full(state);
         success = true;
     }
 
@@ -36,23 +54,106 @@ static int on_hide_overlay(sd_bus_message *m, void *userdata,
     struct gn_state *state = userdata;
     bool success = false;
 
-    if (state->output.configured && state->active) {
-        wl_surface_set_input_region(state->output.surface, state->empty_region);
-        set_output_dirty(state);
+    if (state->active && set_input_regions(state, state->empty_region)) {
         state->active = false;
-        wl_surface_commit(state->output.surface);
+        damage_output_full(state);
+        // nothing is drawn while hidden, a good time to give memory back
+        // and to snapshot the canvas
+        compact_pool(state);
+        maybe_compact_journal(state);
         success = true;
     }
 
     return sd_bus_reply_method_return(m, "b", success);
 }
 
+static int on_get_usage(sd_bus_message *m, void *userdata, sd_bus_error *ret) {
+    struct gn_state *state = userdata;
+    uint64_t n_strokes = state->strokes.n_live, n_pts = 0;
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        n_pts += stroke->n_pts;
+    }
+    struct gn_pool_usage usage = pool_usage(&state->pool);
+
+    return sd_bus_reply_method_return(m, "tttt", n_strokes, n_pts,
+                                      (uint64_t)usage.used_bytes,
+                                      (uint64_t)usage.reserved_bytes);
+}
+
+static int on_save_session(sd_bus_message *m, void *userdata,
+                           sd_bus_error *ret) {
+    struct gn_state *state = userdata;
+    const char *path;
+    int r = sd_bus_message_read(m, "s", &path);
+    if (r < 0) {
+        return r;
+    }
+    // an empty path snapshots the session given at startup, which is
+    // written with its journal
+    if (path[0] == '\0') {
+        path = state->session_path;
+        if (compact_journal(state)) {
+            return sd_bus_reply_method_return(m, "b", true);
+        }
+    }
+    bool success = path != NULL && save_session(state, path);
+
+    return sd_bus_reply_method_return(m, "b", success);
+}
+
+static int append_histogram(sd_bus_message *reply, const char *name,
+                            const struct gn_histogram *hist) {
+    return sd_bus_message_append(reply, "(sttttt)", name, hist->n,
+                                 histogram_percentile(hist, 0.5),
+                                 histogram_percentile(hist, 0.9),
+                                 histogram_percentile(hist, 0.99), hist->max);
+}
+
+// each histogram as its name, count and p50, p90, p99 and max in us, then
+// the frames presented, missed and discarded
+static int on_get_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret) {
+    struct gn_state *state = userdata;
+    struct gn_stats *stats = &state->stats;
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_message_new_method_return(m, &reply);
+    if (r < 0) {
+        return r;
+    }
+
+    r = sd_bus_message_open_container(reply, 'a', "(sttttt)");
+    if (r >= 0) {
+        r = append_histogram(reply, "latency", &stats->latency);
+    }
+    if (r >= 0) {
+        r = append_histogram(reply, "render", &stats->render);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_append(reply, "ttt", stats->n_presented,
+                                  stats->n_missed, stats->n_discarded);
+    }
+    if (r >= 0) {
+        r = sd_bus_send(NULL, reply, NULL);
+    }
+    sd_bus_message_unref(reply);
+    return r;
+}
+
 static const sd_bus_vtable ipc_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_METHOD(GN_SD_BUS_SHOW_CMD, "", "b", on_show_overlay,
                   SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD(GN_SD_BUS_HIDE_CMD, "", "b", on_hide_overlay,
                   SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD(GN_SD_BUS_USAGE_CMD, "", "tttt", on_get_usage,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD(GN_SD_BUS_SAVE_CMD, "s", "b", on_save_session,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD(GN_SD_BUS_STATS_CMD, "", "a(sttttt)ttt", on_get_stats,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END};
 
 int setup_dbus(struct gn_state *state) {
@@ -0,0 +1,557 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "glassnote.h"
+#include "journal.h"
+#include "session.h"
+#include "stroke.h"
+#include "table.h"
+
+// u8 type, u32 n_pts, u32 n_bytes, f32 bbox x y w h, f32 width, i32 color,
+// u32 flags
+#define GN_JOURNAL_ADD_SZ 37
+#define GN_JOURNAL_ADD_V1_SZ 21
+// u8 type, u32 id
+#define GN_JOURNAL_REMOVE_SZ 5
+#define GN_JOURNAL_INIT_IDS 256
+
+// version 1 hashed a byte at a time, version 2 takes the payload a little
+// endian u32 at a time and the bytes left over one by one, which checks a
+// journal on replay in a quarter of the time
+static uint32_t fnv1a(uint32_t version, const uint8_t *data, size_t n) {
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+    if (version > 1) {
+        for (; i + 4 <= n; i += 4) {
+            hash = (hash ^ get_u32(&data[i])) * 16777619u;
+        }
+    }
+    for (; i < n; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// the inode and size of the session file, zero if there is none
+static bool session_id(const char *path, uint64_t *ino, uint64_t *size) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        *ino = *size = 0;
+        return errno == ENOENT;
+    }
+    *ino = st.st_ino;
+    *size = st.st_size;
+    return true;
+}
+
+// replaces the journal with an empty one following the session file as it
+// is now, returning its fd
+static int create_journal(struct gn_journal *journal) {
+    uint8_t header[GN_JOURNAL_HEADER_SZ];
+    uint64_t ino, size;
+    if (!session_id(journal->session_path, &ino, &size)) {
+        return -1;
+    }
+    memcpy(header, GN_JOURNAL_MAGIC, 4);
+    put_u32(&header[4], GN_JOURNAL_VERSION);
+    put_u64(&header[8], ino);
+    put_u64(&header[16], size);
+
+    char *tmp_path = malloc(strlen(journal->path) + sizeof(".tmp"));
+    if (tmp_path == NULL) {
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", journal->path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd >= 0 && (!write_all(fd, header, sizeof(header)) || fsync(fd) != 0 ||
+                    rename(tmp_path, journal->path) != 0)) {
+        close(fd);
+        unlink(tmp_path);
+        fd = -1;
+    }
+    free(tmp_path);
+    return fd;
+}
+
+// replaces the session file and starts the journal after it
+static bool write_snapshot(struct gn_journal *journal, const uint8_t *data,
+                           size_t size) {
+    if (!write_session(journal->session_path, data, size)) {
+        return false;
+    }
+    int fd = create_journal(journal);
+    if (fd < 0) {
+        return false;
+    }
+    if (journal->fd >= 0) {
+        close(journal->fd);
+    }
+    journal->fd = fd;
+    return true;
+}
+
+static void *run_writer(void *data) {
+    struct gn_journal *journal = data;
+    uint8_t *records = NULL;
+    size_t c_records = 0;
+
+    pthread_mutex_lock(&journal->lock);
+    while (true) {
+        while (journal->n_pending == 0 && journal->snapshot == NULL &&
+               !journal->stop) {
+            pthread_cond_wait(&journal->cond, &journal->lock);
+        }
+        if (journal->n_pending == 0 && journal->snapshot == NULL) {
+            break;
+        }
+
+        // buffers are swapped so records keep coming in while these are
+        // written
+        uint8_t *pending = journal->pending;
+        size_t n = journal->n_pending, c = journal->c_pending;
+        journal->pending = records;
+        journal->c_pending = c_records;
+        journal->n_pending = 0;
+        records = pending;
+        c_records = c;
+        uint8_t *snapshot = journal->snapshot;
+        size_t snapshot_sz = journal->snapshot_sz;
+        size_t cut = snapshot != NULL ? journal->snapshot_cut : n;
+        journal->snapshot = NULL;
+        bool ok = !journal->failed;
+        pthread_mutex_unlock(&journal->lock);
+
+        ok = ok && write_all(journal->fd, records, cut);
+        if (snapshot != NULL) {
+            ok = ok && write_snapshot(journal, snapshot, snapshot_sz);
+            free(snapshot);
+        }
+        // one sync for every record taken
+        ok = ok && write_all(journal->fd, &records[cut], n - cut) &&
+             fdatasync(journal->fd) == 0;
+
+        pthread_mutex_lock(&journal->lock);
+        if (!ok && !journal->failed) {
+            fprintf(stderr, "Failed to write journal %s\n", journal->path);
+            journal->failed = true;
+        }
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    free(records);
+    return NULL;
+}
+
+// room for a record of up to size bytes at the end of pending, NULL once
+// records are no longer kept
+static uint8_t *reserve_record(struct gn_journal *journal, size_t size) {
+    if (journal->failed) {
+        return NULL;
+    }
+    size_t need = journal->n_pending + GN_JOURNAL_RECORD_SZ + size;
+    if (need > journal->c_pending) {
+        size_t c_pending = journal->c_pending == 0 ? GN_JOURNAL_INIT_PENDING
+                                                   : journal->c_pending;
+        while (c_pending < need) {
+            c_pending *= 2;
+        }
+        uint8_t *pending = realloc(journal->pending, c_pending);
+        if (pending == NULL) {
+            // a lost record would throw off the ids of every one after it
+            fprintf(stderr, "Failed to allocate memory for journal\n");
+            journal->failed = true;
+            return NULL;
+        }
+        journal->pending = pending;
+        journal->c_pending = c_pending;
+    }
+    return &journal->pending[journal->n_pending + GN_JOURNAL_RECORD_SZ];
+}
+
+static void commit_record(struct gn_journal *journal, size_t size) {
+    uint8_t *record = &journal->pending[journal->n_pending];
+    put_u32(&record[0], size);
+    put_u32(&record[4],
+            fnv1a(GN_JOURNAL_VERSION, &record[GN_JOURNAL_RECORD_SZ], size));
+    journal->n_pending += GN_JOURNAL_RECORD_SZ + size;
+    journal->n_since_snapshot += GN_JOURNAL_RECORD_SZ + size;
+    pthread_cond_signal(&journal->cond);
+}
+
+void journal_add(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_journal *journal = &state->journal;
+    if (!journal->open || !session_keeps_stroke(stroke)) {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    uint8_t *p = reserve_record(journal, GN_JOURNAL_ADD_SZ +
+                                             stroke->n_pts *
+                                                 GN_SESSION_MAX_PT_BYTES);
+    if (p != NULL) {
+        struct gn_box bbox;
+        size_t n_bytes =
+            encode_session_points(stroke, &p[GN_JOURNAL_ADD_SZ], &bbox);
+        p[0] = GN_JOURNAL_ADD;
+        put_u32(&p[1], stroke->n_pts);
+        put_u32(&p[5], n_bytes);
+        put_f32(&p[9], bbox.pos.x);
+        put_f32(&p[13], bbox.pos.y);
+        put_f32(&p[17], bbox.size.x);
+        put_f32(&p[21], bbox.size.y);
+        put_f32(&p[25], stroke->width);
+        put_u32(&p[29], (uint32_t)stroke->color);
+        put_u32(&p[33], stroke->curved ? GN_SESSION_FLAG_CURVED : 0);
+        commit_record(journal, GN_JOURNAL_ADD_SZ + n_bytes);
+        stroke->journal_id = ++journal->last_id;
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_remove(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_journal *journal = &state->journal;
+    if (!journal->open || stroke->journal_id == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    uint8_t *p = reserve_record(journal, GN_JOURNAL_REMOVE_SZ);
+    if (p != NULL) {
+        p[0] = GN_JOURNAL_REMOVE;
+        put_u32(&p[1], stroke->journal_id);
+        commit_record(journal, GN_JOURNAL_REMOVE_SZ);
+    }
+    stroke->journal_id = 0;
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// numbers the strokes a snapshot keeps in the order it loads them
+static void number_strokes(struct gn_state *state) {
+    uint32_t id = 0;
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        stroke->journal_id = session_keeps_stroke(stroke) ? ++id : 0;
+    }
+    state->journal.last_id = id;
+}
+
+bool compact_journal(struct gn_state *state) {
+    struct gn_journal *journal = &state->journal;
+    if (!journal->open) {
+        return false;
+    }
+    // encoding takes a fraction of what writing does, which the writer does
+    size_t size;
+    uint8_t *snapshot = encode_session(state, &size);
+    if (snapshot == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    bool ok = !journal->failed;
+    if (ok) {
+        // a snapshot not written yet is outdated by this one
+        free(journal->snapshot);
+        journal->snapshot = snapshot;
+        journal->snapshot_sz = size;
+        journal->snapshot_cut = journal->n_pending;
+        number_strokes(state);
+        journal->n_since_snapshot = 0;
+        journal->last_snapshot_sz = size;
+        pthread_cond_signal(&journal->cond);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    if (!ok) {
+        free(snapshot);
+    }
+    return ok;
+}
+
+bool journal_compact_due(struct gn_state *state) {
+    struct gn_journal *journal = &state->journal;
+    return journal->open &&
+           journal->n_since_snapshot > GN_JOURNAL_COMPACT_BYTES &&
+           journal->n_since_snapshot > journal->last_snapshot_sz;
+}
+
+void maybe_compact_journal(struct gn_state *state) {
+    if (journal_compact_due(state)) {
+        compact_journal(state);
+    }
+}
+
+// strokes of the session and the journal by id
+struct gn_journal_ids {
+    struct gn_stroke_handle *handles;
+    size_t n, c;
+};
+
+static bool push_id(struct gn_journal_ids *ids, struct gn_stroke_handle h) {
+    if (ids->n == ids->c) {
+        size_t c = ids->c == 0 ? GN_JOURNAL_INIT_IDS : ids->c * 2;
+        struct gn_stroke_handle *handles =
+            realloc(ids->handles, c * sizeof(*handles));
+        if (handles == NULL) {
+            fprintf(stderr, "Failed to allocate memory to replay journal\n");
+            return false;
+        }
+        ids->handles = handles;
+        ids->c = c;
+    }
+    ids->handles[ids->n++] = h;
+    return true;
+}
+
+static bool replay_record(struct gn_state *state, const uint8_t *p,
+                          size_t size, uint32_t version,
+                          struct gn_journal_ids *ids) {
+    size_t add_sz = version == 1 ? GN_JOURNAL_ADD_V1_SZ : GN_JOURNAL_ADD_SZ;
+    if (p[0] == GN_JOURNAL_ADD && size >= add_sz &&
+        get_u32(&p[5]) == size - add_sz) {
+        // width, color and flags end the fields in either version
+        const uint8_t *f = &p[add_sz - 12];
+        struct gn_session_stroke s = {
+            .data = &p[add_sz],
+            .n_bytes = size - add_sz,
+            .n_pts = get_u32(&p[1]),
+            .width = get_f32(&f[0]),
+            .color = (int32_t)get_u32(&f[4]),
+            .flags = get_u32(&f[8]),
+        };
+        if (version > 1) {
+            s.bbox = (struct gn_box){{get_f32(&p[9]), get_f32(&p[13])},
+                                     {get_f32(&p[17]), get_f32(&p[21])}};
+        }
+        struct gn_stroke *stroke = load_session_stroke(state, s);
+        if (stroke == NULL) {
+            return false;
+        }
+        stroke->journal_id = ids->n + 1;
+        return push_id(ids, stroke->handle);
+    }
+    if (p[0] == GN_JOURNAL_REMOVE && size == GN_JOURNAL_REMOVE_SZ) {
+        uint32_t id = get_u32(&p[1]);
+        if (id == 0 || id > ids->n) {
+            return false;
+        }
+        // one of the snapshot's strokes that could not be loaded
+        if (ids->handles[id - 1].gen == 0) {
+            return true;
+        }
+        struct gn_stroke *stroke =
+            stroke_table_get(&state->strokes, ids->handles[id - 1]);
+        if (stroke == NULL) {
+            return false;
+        }
+        remove_stroke(state, stroke);
+        return true;
+    }
+    return false;
+}
+
+// applies the journal's records to the strokes loaded from its session,
+// false if it does not follow the session, a record could not be applied or
+// it is of an older version, which is not appended to. *len is the size of
+// the journal up to its last whole record. the journal stays mapped in
+// gn_state::journal_map.
+static bool replay_journal(struct gn_state *state, size_t *len) {
+    struct gn_journal *journal = &state->journal;
+    *len = 0;
+    int fd = open(journal->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        fprintf(stderr, "Failed to open %s: %s\n", journal->path,
+                strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < GN_JOURNAL_HEADER_SZ) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    const uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", journal->path,
+                strerror(errno));
+        return false;
+    }
+
+    uint64_t ino, session_sz;
+    uint32_t version = get_u32(&file[4]);
+    if (memcmp(file, GN_JOURNAL_MAGIC, 4) != 0 || version == 0 ||
+        version > GN_JOURNAL_VERSION ||
+        !session_id(journal->session_path, &ino, &session_sz) ||
+        get_u64(&file[8]) != ino || get_u64(&file[16]) != session_sz) {
+        fprintf(stderr, "Ignoring journal %s, it does not follow %s\n",
+                journal->path, journal->session_path);
+        munmap((void *)file, size);
+        return false;
+    }
+    // the strokes added are read from the journal as they are unpacked
+    state->journal_map = (struct gn_file_map){file, size};
+
+    // the snapshot's strokes are 1..last_id, those not loaded stay empty
+    struct gn_journal_ids ids = {0};
+    bool ok = true;
+    for (uint32_t id = 0; ok && id < journal->last_id; id++) {
+        ok = push_id(&ids, (struct gn_stroke_handle){0});
+    }
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        if (ok && stroke->journal_id != 0) {
+            ids.handles[stroke->journal_id - 1] = stroke->handle;
+        }
+    }
+
+    size_t off = GN_JOURNAL_HEADER_SZ;
+    while (ok && size - off >= GN_JOURNAL_RECORD_SZ) {
+        const uint8_t *record = &file[off];
+        size_t record_sz = get_u32(&record[0]);
+        const uint8_t *p = &record[GN_JOURNAL_RECORD_SZ];
+        if (record_sz == 0 ||
+            record_sz > size - off - GN_JOURNAL_RECORD_SZ ||
+            fnv1a(version, p, record_sz) != get_u32(&record[4])) {
+            break;
+        }
+        if (!replay_record(state, p, record_sz, version, &ids)) {
+            fprintf(stderr, "Failed to replay journal %s\n", journal->path);
+            ok = false;
+        }
+        off += GN_JOURNAL_RECORD_SZ + record_sz;
+    }
+    if (ok && off < size) {
+        fprintf(stderr, "Dropping the end of journal %s, cut short\n",
+                journal->path);
+    }
+    *len = off;
+    journal->last_id = ids.n;
+
+    free(ids.handles);
+    return ok && version == GN_JOURNAL_VERSION;
+}
+
+enum gn_journal_open open_journal(struct gn_state *state) {
+    struct gn_journal *journal = &state->journal;
+    journal->session_path = state->session_path;
+    journal->path = malloc(strlen(state->session_path) + sizeof(".journal"));
+    if (journal->path == NULL) {
+        fprintf(stderr, "Failed to allocate memory for journal\n");
+        return GN_JOURNAL_FAILED;
+    }
+    sprintf(journal->path, "%s.journal", state->session_path);
+
+    uint32_t n_entries;
+    if (load_session(state, journal->session_path, &n_entries) ==
+        GN_SESSION_UNREADABLE) {
+        // neither is written over, a snapshot would lose them for good
+        free(journal->path);
+        journal->path = NULL;
+        return GN_JOURNAL_UNREADABLE;
+    }
+    journal->last_id = n_entries;
+    uint64_t ino, session_sz;
+    if (session_id(journal->session_path, &ino, &session_sz)) {
+        journal->last_snapshot_sz = session_sz;
+    }
+    // whether the journal follows the session is told by its inode and
+    // size, which holds even if some of its strokes were not loaded
+    size_t len = 0;
+    bool clean = replay_journal(state, &len);
+
+    journal->fd = -1;
+    if (clean && len > 0) {
+        // records are appended after the last whole one
+        journal->fd = open(journal->path, O_WRONLY | O_CLOEXEC);
+        if (journal->fd >= 0 && (ftruncate(journal->fd, len) != 0 ||
+                                 lseek(journal->fd, len, SEEK_SET) < 0)) {
+            close(journal->fd);
+            journal->fd = -1;
+        }
+        journal->n_since_snapshot = len;
+    } else if (clean) {
+        journal->fd = create_journal(journal);
+    }
+    if (clean && journal->fd < 0) {
+        fprintf(stderr, "Failed to open journal %s: %s\n", journal->path,
+                strerror(errno));
+        free(journal->path);
+        journal->path = NULL;
+        return GN_JOURNAL_FAILED;
+    }
+
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->cond, NULL);
+    if (pthread_create(&journal->thread, NULL, run_writer, journal) != 0) {
+        fprintf(stderr, "Failed to start journal writer\n");
+        pthread_mutex_destroy(&journal->lock);
+        pthread_cond_destroy(&journal->cond);
+        if (journal->fd >= 0) {
+            close(journal->fd);
+        }
+        free(journal->path);
+        journal->path = NULL;
+        return GN_JOURNAL_FAILED;
+    }
+    journal->open = true;
+
+    // what was restored is written out again, as a snapshot the journal can
+    // follow
+    if (!clean) {
+        compact_journal(state);
+    } else {
+        maybe_compact_journal(state);
+    }
+    return GN_JOURNAL_OPENED;
+}
+
+bool close_journal(struct gn_state *state) {
+    struct gn_journal *journal = &state->journal;
+    if (!journal->open) {
+        return false;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    journal->stop = true;
+    pthread_cond_signal(&journal->cond);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->thread, NULL);
+
+    bool ok = !journal->failed;
+    if (journal->fd >= 0) {
+        close(journal->fd);
+    }
+    pthread_mutex_destroy(&journal->lock);
+    pthread_cond_destroy(&journal->cond);
+    free(journal->pending);
+    free(journal->path);
+    *journal = (struct gn_journal){0};
+    return ok;
+}
@@ -3,7 +3,9 @@
 #include <GLES3/gl32.h>
 #include <assert.h>
 #include <errno.h>
+#include <math.h>
 #include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,104 +16,38 @@
 #include <xkbcommon/xkbcommon.h>
 
 #include "cursor-shape-v1-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
 #include "glassnote.h"
+#include "grid.h"
+#include "history.h"
 #include "ipc.h"
+#include "journal.h"
+#include "output.h"
+#include "pool.h"
+#include "predict.h"
+#include "presentation-time-client-protocol.h"
 #include "render.h"
 #include "seat.h"
+#include "session.h"
+#include "stats.h"
 #include "stroke.h"
+#include "table.h"
+#include "trace.h"
+#include "viewporter-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "xdg-output-unstable-v1-client-protocol.h"
 
 void noop() { ; }
 
-static const struct wl_callback_listener output_frame_listener;
-
-void set_output_dirty(struct gn_state *state) {
-    struct gn_output *output = &state->output;
-    output->dirty = true;
-    if (output->frame_callback) {
-        return;
-    }
-
-    output->frame_callback = wl_surface_frame(output->surface);
-    wl_callback_add_listener(output->frame_callback, &output_frame_listener,
-                             state);
-    wl_surface_commit(output->surface);
-}
-
-static void send_frame(struct gn_state *state) {
-    struct gn_output *output = &state->output;
-    if (!output->configured) {
-        return;
-    }
-
-    render(state);
-    eglSwapBuffers(state->egl_display, output->egl_surface);
-
-    output->frame_callback = wl_surface_frame(output->surface);
-    wl_callback_add_listener(output->frame_callback, &output_frame_listener,
-                             state);
-
-    wl_surface_set_opaque_region(output->surface, NULL);
-    wl_surface_commit(output->surface);
-    output->dirty = false;
-}
-
-static void output_frame_handle_done(void *data, struct wl_callback *callback,
-                                     uint32_t time) {
-    struct gn_state *state = data;
-    struct gn_output *output = &state->output;
-
-    wl_callback_destroy(callback);
-    output->frame_callback = NULL;
-
-    if (output->dirty) {
-        send_frame(state);
-    }
-}
-
-static const struct wl_callback_listener output_frame_listener = {
-    .done = output_frame_handle_done,
-};
-
-static void layer_surface_handle_configure(
-    void *data, struct zwlr_layer_surface_v1 *surface, uint32_t serial,
-    uint32_t width, uint32_t height) {
-    struct gn_state *state = data;
-    struct gn_output *output = &state->output;
-
-    output->width = width;
-    output->height = height;
-    if (!output->configured) {
-        // TODO: error checking
-        output->configured = true;
-
-        output->egl_window =
-            wl_egl_window_create(output->surface, width, height);
-        output->egl_surface = eglCreateWindowSurface(
-            state->egl_display, state->egl_config,
-            (EGLNativeWindowType)output->egl_window, NULL);
-
-        eglMakeCurrent(state->egl_display, output->egl_surface,
-                       output->egl_surface, state->egl_context);
-
-        init_gl(state);
-    }
-    wl_egl_window_resize(output->egl_window, width, height, 0, 0);
-    glViewport(0, 0, width, height);
-
-    zwlr_layer_surface_v1_ack_configure(surface, serial);
-    send_frame(state);
-}
-
-static void layer_surface_handle_closed(void *data,
-                                        struct zwlr_layer_surface_v1 *surface) {
+static void presentation_handle_clock_id(void *data,
+                                        struct wp_presentation *presentation,
+                                        uint32_t clk_id) {
     struct gn_state *state = data;
-    state->running = false;
+    state->stats.clock = clk_id;
 }
 
-static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
-    .configure = layer_surface_handle_configure,
-    .closed = layer_surface_handle_closed,
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_handle_clock_id,
 };
 
 static void registry_handle_global(void *data, struct wl_registry *registry,
@@ -125,20 +61,99 @@ static void registry_handle_global(void *data, struct wl_registry *registry,
         state->layer_shell =
             wl_registry_bind(registry, name, &zwlr_layer_shell_v1_interface, 1);
     } else if (strcmp(iface, wl_seat_interface.name) == 0) {
-        struct wl_seat *wl_seat =
-            wl_registry_bind(registry, name, &wl_seat_interface, 1);
+        struct wl_seat *wl_seat = wl_registry_bind(
+            registry, name, &wl_seat_interface,
+            version < GN_SEAT_VERSION ? version : GN_SEAT_VERSION);
         create_seat(state, wl_seat);
+    } else if (strcmp(iface, wl_output_interface.name) == 0) {
+        struct wl_output *wl_output = wl_registry_bind(
+            registry, name, &wl_output_interface,
+            version < GN_OUTPUT_VERSION ? version : GN_OUTPUT_VERSION);
+        create_output(state, wl_output, name);
     } else if (strcmp(iface, wp_cursor_shape_manager_v1_interface.name) == 0) {
         state->cursor_shape_manager = wl_registry_bind(
             registry, name, &wp_cursor_shape_manager_v1_interface, 1);
+    } else if (strcmp(iface, wp_presentation_interface.name) == 0) {
+        state->presentation =
+            wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(state->presentation,
+                                     &presentation_listener, state);
+    } else if (strcmp(iface, wp_viewporter_interface.name) == 0) {
+        state->viewporter =
+            wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    } else if (strcmp(iface, wp_fractional_scale_manager_v1_interface.name) ==
+               0) {
+        state->fractional_scale_manager = wl_registry_bind(
+            registry, name, &wp_fractional_scale_manager_v1_interface, 1);
+    } else if (strcmp(iface, zxdg_output_manager_v1_interface.name) == 0) {
+        state->xdg_output_manager = wl_registry_bind(
+            registry, name, &zxdg_output_manager_v1_interface,
+            version < GN_XDG_OUTPUT_VERSION ? version : GN_XDG_OUTPUT_VERSION);
+        // the outputs announced before it
+        struct gn_output *output;
+        wl_list_for_each(output, &state->outputs, link) {
+            watch_output_position(output);
+        }
+    }
+}
+
+static void registry_handle_global_remove(void *data,
+                                          struct wl_registry *registry,
+                                          uint32_t name) {
+    struct gn_state *state = data;
+    struct gn_output *output, *tmp;
+    wl_list_for_each_safe(output, tmp, &state->outputs, link) {
+        if (output->wl_name == name) {
+            destroy_output(output);
+        }
     }
 }
 
 static const struct wl_registry_listener registry_listener = {
     .global = registry_handle_global,
-    .global_remove = NULL,
+    .global_remove = registry_handle_global_remove,
 };
 
+// input that came in while the frame timers ran makes it into the frames
+// they fired for, which are looked up again in case it took their outputs
+static void handle_frame_timers(struct gn_state *state,
+                                const struct pollfd *fds, size_t n_fds) {
+    uint64_t st = stats_now(&state->stats);
+    struct pollfd fd = {.fd = wl_display_get_fd(state->display),
+                        .events = POLLIN};
+    if (poll(&fd, 1, 0) > 0 && wl_display_dispatch(state->display) < 0) {
+        fprintf(stderr, "Wayland dispatch error\n");
+    }
+    struct gn_output *output, *tmp;
+    wl_list_for_each_safe(output, tmp, &state->outputs, link) {
+        for (size_t i = 0; i < n_fds; i++) {
+            if (fds[i].fd >= 0 && fds[i].fd == output->schedule.timer_fd &&
+                (fds[i].revents & POLLIN)) {
+                handle_frame_timer(output, st);
+            }
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage:\n"
+            "  %s [--curves] [--history MIB] [--session PATH] "
+            "[--record PATH]\n"
+            "     [--predict MS] [--dynamic-scale]\n"
+            "\n"
+            "  --curves        store finished strokes as fitted curves\n"
+            "  --history MIB   memory kept for undo and redo, 64 by default\n"
+            "  --session PATH  strokes restored at startup and kept in PATH\n"
+            "  --record PATH   input recorded to PATH, for render-bench\n"
+            "  --predict MS    draw the stroke MS ahead of the pointer, "
+            "%d to %d\n"
+            "  --dynamic-scale draw at a lower resolution while frames take "
+            "too long\n",
+            prog, GN_PREDICT_MIN_MS, GN_PREDICT_MAX_MS);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv) {
     struct gn_state state = {
         .active = true,
@@ -149,16 +164,63 @@ int main(int argc, char **argv) {
                    GN_STATE_INIT_COLOR_3, GN_STATE_INIT_COLOR_4,
                    GN_STATE_INIT_COLOR_5},
         .cur_stroke_width = GN_STATE_INIT_WIDTH,
-        .c_strokes = GN_STATE_INIT_STROKES,
+        .tool = GN_TOOL_PEN,
+        .eraser_radius = GN_STATE_INIT_ERASER_RADIUS,
+        .history = {.budget = GN_HISTORY_INIT_BUDGET},
+        .canvas_listener = &display_canvas_listener,
     };
-
-    state.strokes = calloc(state.c_strokes, sizeof(struct gn_stroke));
-    if (state.strokes == NULL) {
-        fprintf(stderr, "Failed to allocate space for strokes");
-        return EXIT_FAILURE;
+    const char *record_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--curves") == 0) {
+            state.fit_curves = true;
+        } else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            char *end;
+            unsigned long mib = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || mib > SIZE_MAX >> 20) {
+                usage(argv[0]);
+            }
+            state.history.budget = (size_t)mib << 20;
+        } else if (strcmp(argv[i], "--session") == 0 && i + 1 < argc) {
+            state.session_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--predict") == 0 && i + 1 < argc) {
+            char *end;
+            unsigned long ms = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || ms < GN_PREDICT_MIN_MS ||
+                ms > GN_PREDICT_MAX_MS) {
+                usage(argv[0]);
+            }
+            state.predict_ms = ms;
+        } else if (strcmp(argv[i], "--dynamic-scale") == 0) {
+            state.dynamic_scale = true;
+        } else {
+            usage(argv[0]);
+        }
     }
 
+    init_stroke_table(&state.strokes);
     wl_list_init(&state.seats);
+    wl_list_init(&state.outputs);
+    init_stats(&state);
+
+    // strokes are uploaded once the GL context exists
+    if (state.session_path != NULL) {
+        enum gn_journal_open opened = open_journal(&state);
+        if (opened == GN_JOURNAL_UNREADABLE) {
+            // saving on exit would write over it
+            fprintf(stderr, "Not starting, %s is left as it is\n",
+                    state.session_path);
+            return EXIT_FAILURE;
+        } else if (opened == GN_JOURNAL_FAILED) {
+            fprintf(stderr, "Strokes will only be saved on exit\n");
+        }
+    }
+    // the trace starts from the canvas as it was restored
+    if (record_path != NULL && !start_trace(&state, record_path)) {
+        fprintf(stderr, "Input will not be recorded\n");
+    }
 
     if (setup_dbus(&state) != 0) {
         fprintf(stderr, "Failed to setup dbus IPC\n");
@@ -179,6 +241,8 @@ int main(int argc, char **argv) {
     state.registry = wl_display_get_registry(state.display);
     wl_registry_add_listener(state.registry, &registry_listener, &state);
     wl_display_roundtrip(state.display);
+    // for the positions of the outputs
+    wl_display_roundtrip(state.display);
 
     if (state.compositor == NULL) {
         fprintf(stderr, "Compositor doesn't support wl_compositor\n");
@@ -200,37 +264,40 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     };
 
-    state.output.surface = wl_compositor_create_surface(state.compositor);
-    state.output.layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-        state.layer_shell, state.output.surface, NULL,
-        ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "glassnote");
-    zwlr_layer_surface_v1_set_size(state.output.layer_surface, 0, 0);
-    zwlr_layer_surface_v1_set_anchor(state.output.layer_surface,
-                                     ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
-                                         ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
-                                         ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
-                                         ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
-    zwlr_layer_surface_v1_set_exclusive_zone(state.output.layer_surface, -1);
-    zwlr_layer_surface_v1_set_keyboard_interactivity(
-        state.output.layer_surface,
-        ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_ON_DEMAND);
-    zwlr_layer_surface_v1_add_listener(state.output.layer_surface,
-                                       &layer_surface_listener, &state);
-
-    wl_surface_commit(state.output.surface);
+    struct gn_output *output, *output_tmp;
+    wl_list_for_each(output, &state.outputs, link) {
+        show_output(output);
+    }
 
     state.running = true;
 
     int wl_fd = wl_display_get_fd(state.display);
     int bus_fd = sd_bus_get_fd(state.bus);
 
-    struct pollfd fds[2];
-    fds[0].fd = wl_fd;
-    fds[0].events = POLLIN;
-    fds[1].fd = bus_fd;
-    fds[1].events = POLLIN;
+    // the frame timers of the outputs follow
+    struct pollfd *fds = NULL;
+    size_t c_fds = 0;
 
     while (state.running) {
+        size_t n_fds = 2 + wl_list_length(&state.outputs);
+        if (n_fds > c_fds) {
+            struct pollfd *new_fds = realloc(fds, n_fds * sizeof(*fds));
+            if (new_fds == NULL) {
+                fprintf(stderr, "Failed to allocate memory for poll\n");
+                break;
+            }
+            fds = new_fds;
+            c_fds = n_fds;
+        }
+        fds[0] = (struct pollfd){.fd = wl_fd, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = bus_fd, .events = POLLIN};
+        size_t i = 2;
+        wl_list_for_each(output, &state.outputs, link) {
+            // ignored by poll if there is no timer
+            fds[i++] = (struct pollfd){.fd = output->schedule.timer_fd,
+                                       .events = POLLIN};
+        }
+
         wl_display_flush(state.display);
         sd_bus_flush(state.bus);
 
@@ -242,7 +309,7 @@ int main(int argc, char **argv) {
         }
         int timeout_ms = (ret == 0) ? -1 : (int)(usec / 1000);
 
-        int poll_ret = poll(fds, 2, timeout_ms);
+        int poll_ret = poll(fds, n_fds, timeout_ms);
         if (poll_ret < 0) {
             if (errno == EINTR) {
                 continue;
@@ -258,6 +325,13 @@ int main(int argc, char **argv) {
             }
         }
 
+        for (i = 2; i < n_fds; i++) {
+            if (fds[i].revents & POLLIN) {
+                handle_frame_timers(&state, &fds[2], n_fds - 2);
+                break;
+            }
+        }
+
         if (poll_ret == 0 || (fds[1].revents & POLLIN)) {
             int r;
             do {
@@ -270,7 +344,22 @@ int main(int argc, char **argv) {
         }
     }
 
+    free(fds);
+    stop_trace(&state);
+    // a session only keeps finished strokes. done once the trace has ended,
+    // its replays end without it.
     struct gn_seat *seat_tmp, *seat;
+    wl_list_for_each(seat, &state.seats, link) {
+        seat_finish_drawing(seat);
+    }
+    if (state.session_path != NULL) {
+        // the last snapshot leaves an empty journal behind
+        bool saved = compact_journal(&state);
+        if (!close_journal(&state) || !saved) {
+            save_session(&state, state.session_path);
+        }
+    }
+
     wl_list_for_each_safe(seat, seat_tmp, &state.seats, link) {
         destroy_seat(seat);
     }
@@ -278,17 +367,18 @@ int main(int argc, char **argv) {
     // Ensure compositor has unmapped surfaces
     wl_display_roundtrip(state.display);
 
-    if (state.output.frame_callback) {
-        wl_callback_destroy(state.output.frame_callback);
+    // GL is torn down with any surface of the context current
+    wl_list_for_each(output, &state.outputs, link) {
+        if (output->configured) {
+            eglMakeCurrent(state.egl_display, output->egl_surface,
+                           output->egl_surface, state.egl_context);
+            cleanup_gl(&state);
+            break;
+        }
     }
-    if (state.output.configured) {
-        cleanup_gl(&state);
-        eglDestroySurface(state.egl_display, state.output.egl_surface);
-        wl_egl_window_destroy(state.output.egl_window);
-        state.output.configured = false;
+    wl_list_for_each_safe(output, output_tmp, &state.outputs, link) {
+        destroy_output(output);
     }
-    zwlr_layer_surface_v1_destroy(state.output.layer_surface);
-    wl_surface_destroy(state.output.surface);
 
     cleanup_egl(&state);
 
@@ -296,6 +386,18 @@ int main(int argc, char **argv) {
 
     zwlr_layer_shell_v1_destroy(state.layer_shell);
     wp_cursor_shape_manager_v1_destroy(state.cursor_shape_manager);
+    if (state.presentation != NULL) {
+        wp_presentation_destroy(state.presentation);
+    }
+    if (state.fractional_scale_manager != NULL) {
+        wp_fractional_scale_manager_v1_destroy(state.fractional_scale_manager);
+    }
+    if (state.viewporter != NULL) {
+        wp_viewporter_destroy(state.viewporter);
+    }
+    if (state.xdg_output_manager != NULL) {
+        zxdg_output_manager_v1_destroy(state.xdg_output_manager);
+    }
     wl_compositor_destroy(state.compositor);
     wl_registry_destroy(state.registry);
     xkb_context_unref(state.xkb_context);
@@ -303,10 +405,18 @@ int main(int argc, char **argv) {
 
     cleanup_dbus(&state);
 
-    for (size_t i = 0; i < state.n_strokes; i++) {
-        destroy_stroke(&state.strokes[i]);
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state.strokes.order, link) {
+        destroy_stroke(stroke);
+    }
+    wl_list_for_each(stroke, &state.strokes.hidden, link) {
+        destroy_stroke(stroke);
     }
-    free(state.strokes);
+    cleanup_history(&state.history);
+    cleanup_stroke_table(&state.strokes);
+    cleanup_pool(&state.pool);
+    cleanup_grid(&state.grid);
+    cleanup_session_maps(&state);
 
     return EXIT_SUCCESS;
 }
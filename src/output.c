@@ -0,0 +1,526 @@
+#include <EGL/egl.h>
+#include <EGL/eglplatform.h>
+#include <GLES3/gl32.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wayland-client-protocol.h>
+#include <wayland-client.h>
+#include <wayland-egl.h>
+#include <wayland-util.h>
+
+#include "fractional-scale-v1-client-protocol.h"
+#include "glassnote.h"
+#include "grid.h"
+#include "journal.h"
+#include "output.h"
+#include "render.h"
+#include "schedule.h"
+#include "seat.h"
+#include "stats.h"
+#include "trace.h"
+#include "viewporter-client-protocol.h"
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "xdg-output-unstable-v1-client-protocol.h"
+
+static const struct wl_callback_listener output_frame_listener;
+
+void set_output_dirty(struct gn_output *output) {
+    output->dirty = true;
+    // whatever waited for the output to rest waits for the next pause
+    cancel_idle(&output->schedule);
+    // the frame callback or the frame timer draws it, or the first configure
+    if (!output->configured || output->frame_callback ||
+        output->schedule.armed) {
+        return;
+    }
+
+    output->frame_callback = wl_surface_frame(output->surface);
+    wl_callback_add_listener(output->frame_callback, &output_frame_listener,
+                             output);
+    output->frame_drawn = false;
+    wl_surface_commit(output->surface);
+}
+
+// the grid covers the box around the outputs, which may start left of or
+// above the global space's origin
+static void resize_canvas(struct gn_state *state) {
+    int32_t x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (!output->configured) {
+            continue;
+        }
+        x0 = output->x < x0 ? output->x : x0;
+        y0 = output->y < y0 ? output->y : y0;
+        if (output->x + output->width > x1) {
+            x1 = output->x + output->width;
+        }
+        if (output->y + output->height > y1) {
+            y1 = output->y + output->height;
+        }
+    }
+    if (x0 > x1) {
+        return;
+    }
+    // traces replay on one output at the origin, as far as it reaches
+    trace_configure(state, x1 > 0 ? x1 : 0, y1 > 0 ? y1 : 0);
+    resize_grid(state, x0, y0, x1 - x0, y1 - y0);
+}
+
+// sizes the buffer for the scale the compositor asks for times the render
+// scale. the viewport shows it at the surface's size.
+static void resize_buffer(struct gn_output *output) {
+    float scale = 1.f;
+    if (output->viewport != NULL) {
+        scale = output->scale_120 / 120.f * output->render_scale;
+        wp_viewport_set_destination(output->viewport, output->width,
+                                    output->height);
+    }
+    int32_t width = lroundf(output->width * scale);
+    int32_t height = lroundf(output->height * scale);
+    width = width < 1 ? 1 : width;
+    height = height < 1 ? 1 : height;
+    if (width == output->buffer_width && height == output->buffer_height) {
+        return;
+    }
+    output->buffer_width = width;
+    output->buffer_height = height;
+    wl_egl_window_resize(output->egl_window, width, height, 0, 0);
+    output->damage.full = true;
+    output->scale_changed = true;
+}
+
+// with --dynamic-scale, the next frames are drawn smaller once a few in a
+// row take longer than a refresh, until the output rests
+static void adapt_render_scale(struct gn_output *output, uint64_t frame_ns) {
+    struct gn_state *state = output->state;
+    if (!state->dynamic_scale || output->viewport == NULL) {
+        return;
+    }
+    // a frame right after a resize redraws the whole cache
+    if (output->scale_changed) {
+        output->scale_changed = false;
+        output->slow_frames = 0;
+        return;
+    }
+    uint64_t budget = output->schedule.refresh_ns != 0
+                          ? output->schedule.refresh_ns
+                          : GN_OUTPUT_FRAME_BUDGET_NS;
+    if (frame_ns <= budget) {
+        output->slow_frames = 0;
+    } else if (++output->slow_frames >= GN_OUTPUT_SLOW_FRAMES &&
+               output->render_scale > GN_OUTPUT_MIN_SCALE) {
+        output->slow_frames = 0;
+        output->render_scale -= GN_OUTPUT_SCALE_STEP;
+        if (output->render_scale < GN_OUTPUT_MIN_SCALE) {
+            output->render_scale = GN_OUTPUT_MIN_SCALE;
+        }
+        resize_buffer(output);
+    }
+}
+
+static void restore_render_scale(struct gn_output *output) {
+    output->render_scale = 1.f;
+    output->slow_frames = 0;
+    resize_buffer(output);
+    set_output_dirty(output);
+}
+
+static void swap_buffers(struct gn_output *output) {
+    struct gn_state *state = output->state;
+    struct gn_damage *damage = &output->damage;
+
+    if (state->swap_buffers_with_damage == NULL || damage->full) {
+        eglSwapBuffers(state->egl_display, output->egl_surface);
+        return;
+    }
+
+    // EGL wants rects with the origin at the bottom left
+    EGLint rects[GN_DAMAGE_MAX_RECTS * 4];
+    for (size_t i = 0; i < damage->n_rects; i++) {
+        struct gn_box rect = buffer_rect(output, damage->rects[i]);
+        rects[i * 4 + 0] = rect.pos.x;
+        rects[i * 4 + 1] = output->buffer_height - (rect.pos.y + rect.size.y);
+        rects[i * 4 + 2] = rect.size.x;
+        rects[i * 4 + 3] = rect.size.y;
+    }
+    state->swap_buffers_with_damage(state->egl_display, output->egl_surface,
+                                    rects, damage->n_rects);
+}
+
+// follows is whether the frame is drawn as soon as the one before it was
+// shown, rather than after a pause. st is when work on it started.
+static void send_frame(struct gn_output *output, bool follows, uint64_t st) {
+    struct gn_state *state = output->state;
+    if (!output->configured) {
+        return;
+    }
+
+    // the outputs share the context
+    if (eglGetCurrentSurface(EGL_DRAW) != output->egl_surface) {
+        eglMakeCurrent(state->egl_display, output->egl_surface,
+                       output->egl_surface, state->egl_context);
+    }
+    glViewport(0, 0, output->buffer_width, output->buffer_height);
+
+    uint64_t render_st = stats_now(&state->stats);
+    bool predicted = predict_tails(state, output, render_st);
+    EGLint age = 0;
+    if (state->has_buffer_age) {
+        eglQuerySurface(state->egl_display, output->egl_surface,
+                        EGL_BUFFER_AGE_EXT, &age);
+    }
+    struct gn_damage repaint = repaint_damage(output, age);
+
+    render(state, output, &repaint);
+    // the swap commits the frame, the feedback is for the next commit
+    request_feedback(output, follows);
+    swap_buffers(output);
+    push_damage(output);
+    uint64_t end = stats_now(&state->stats);
+    stats_rendered(&state->stats, end - render_st);
+    schedule_rendered(&output->schedule, end - st);
+
+    output->frame_callback = wl_surface_frame(output->surface);
+    wl_callback_add_listener(output->frame_callback, &output_frame_listener,
+                             output);
+    output->frame_drawn = true;
+
+    wl_surface_set_opaque_region(output->surface, NULL);
+    wl_surface_commit(output->surface);
+    // a predicted tail is taken down once the pointer rests
+    output->dirty = predicted;
+    adapt_render_scale(output, end - render_st);
+    // work left for when the output rests
+    if (!output->dirty &&
+        (output->render_scale < 1.f || journal_compact_due(state))) {
+        schedule_idle(&output->schedule, GN_OUTPUT_IDLE_NS);
+    }
+}
+
+static void output_frame_handle_done(void *data, struct wl_callback *callback,
+                                     uint32_t time) {
+    struct gn_output *output = data;
+
+    wl_callback_destroy(callback);
+    output->frame_callback = NULL;
+
+    if (output->dirty && !schedule_frame(output, output->frame_drawn)) {
+        send_frame(output, output->frame_drawn,
+                   stats_now(&output->state->stats));
+    }
+}
+
+static const struct wl_callback_listener output_frame_listener = {
+    .done = output_frame_handle_done,
+};
+
+void handle_frame_timer(struct gn_output *output, uint64_t st) {
+    bool idle;
+    if (!frame_due(&output->schedule, &idle)) {
+        if (idle) {
+            if (output->render_scale < 1.f) {
+                restore_render_scale(output);
+            }
+            maybe_compact_journal(output->state);
+        }
+        return;
+    }
+    output->schedule.armed = false;
+    if (output->dirty) {
+        send_frame(output, output->schedule.follows, st);
+    }
+}
+
+static void layer_surface_handle_configure(
+    void *data, struct zwlr_layer_surface_v1 *surface, uint32_t serial,
+    uint32_t width, uint32_t height) {
+    struct gn_output *output = data;
+    struct gn_state *state = output->state;
+
+    // the surface fills the output, so is as large as xdg-output says it is
+    if (output->xdg_width > 0 && ((int32_t)width != output->xdg_width ||
+                                  (int32_t)height != output->xdg_height)) {
+        fprintf(stderr,
+                "Output is %dx%d but its overlay %ux%u, strokes may be "
+                "misplaced on it\n",
+                output->xdg_width, output->xdg_height, width, height);
+    }
+    output->width = width;
+    output->height = height;
+    if (!output->configured) {
+        // TODO: error checking
+        output->configured = true;
+
+        output->egl_window =
+            wl_egl_window_create(output->surface, width, height);
+        output->egl_surface = eglCreateWindowSurface(
+            state->egl_display, state->egl_config,
+            (EGLNativeWindowType)output->egl_window, NULL);
+        output->buffer_width = width;
+        output->buffer_height = height;
+    }
+    eglMakeCurrent(state->egl_display, output->egl_surface,
+                   output->egl_surface, state->egl_context);
+    // the first output to be configured brings up GL for all of them
+    if (state->gl.program_id == 0) {
+        init_gl(state);
+    }
+    resize_buffer(output);
+    resize_canvas(state);
+
+    zwlr_layer_surface_v1_ack_configure(surface, serial);
+    output->damage.full = true;
+    send_frame(output, false, stats_now(&state->stats));
+}
+
+static void layer_surface_handle_closed(void *data,
+                                        struct zwlr_layer_surface_v1 *surface) {
+    struct gn_output *output = data;
+    struct gn_state *state = output->state;
+    destroy_output(output);
+    if (wl_list_empty(&state->outputs)) {
+        state->running = false;
+    }
+}
+
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+    .configure = layer_surface_handle_configure,
+    .closed = layer_surface_handle_closed,
+};
+
+// the output shows the part of the global space at x, y
+static void place_output(struct gn_output *output, int32_t x, int32_t y) {
+    if (output->x == x && output->y == y) {
+        return;
+    }
+    output->x = x;
+    output->y = y;
+    output->cache.valid = false;
+    if (output->configured) {
+        resize_canvas(output->state);
+        output->damage.full = true;
+        set_output_dirty(output);
+    }
+}
+
+static void output_handle_geometry(void *data, struct wl_output *wl_output,
+                                   int32_t x, int32_t y,
+                                   int32_t physical_width,
+                                   int32_t physical_height, int32_t subpixel,
+                                   const char *make, const char *model,
+                                   int32_t transform) {
+    struct gn_output *output = data;
+    // only to go by without xdg-output, wlroots sends 0,0 for every output
+    if (output->xdg_output == NULL) {
+        place_output(output, x, y);
+    }
+}
+
+// takes the logical position xdg-output sent, once it came with a size
+static void output_handle_done(void *data, struct wl_output *wl_output) {
+    struct gn_output *output = data;
+    if (output->xdg_output != NULL && output->xdg_width > 0 &&
+        output->xdg_height > 0) {
+        place_output(output, output->xdg_x, output->xdg_y);
+    }
+}
+
+static void xdg_output_handle_logical_position(void *data,
+                                               struct zxdg_output_v1 *xdg,
+                                               int32_t x, int32_t y) {
+    struct gn_output *output = data;
+    output->xdg_x = x;
+    output->xdg_y = y;
+}
+
+static void xdg_output_handle_logical_size(void *data,
+                                           struct zxdg_output_v1 *xdg,
+                                           int32_t width, int32_t height) {
+    struct gn_output *output = data;
+    output->xdg_width = width;
+    output->xdg_height = height;
+}
+
+// sent before version 3, after it the changes end with wl_output.done
+static void xdg_output_handle_done(void *data, struct zxdg_output_v1 *xdg) {
+    output_handle_done(data, NULL);
+}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+    .logical_position = xdg_output_handle_logical_position,
+    .logical_size = xdg_output_handle_logical_size,
+    .done = xdg_output_handle_done,
+    .name = noop,
+    .description = noop,
+};
+
+// a new scale the surface is to be drawn at, in 120ths
+static void set_output_scale(struct gn_output *output, uint32_t scale_120) {
+    if (output->scale_120 == scale_120) {
+        return;
+    }
+    output->scale_120 = scale_120;
+    if (output->configured) {
+        resize_buffer(output);
+        set_output_dirty(output);
+    }
+}
+
+static void output_handle_scale(void *data, struct wl_output *wl_output,
+                                int32_t factor) {
+    struct gn_output *output = data;
+    // the fractional scale is the one to go by where there is one
+    if (output->fractional_scale == NULL && factor > 0) {
+        set_output_scale(output, factor * 120);
+    }
+}
+
+static void fractional_scale_handle_preferred_scale(
+    void *data, struct wp_fractional_scale_v1 *fractional_scale,
+    uint32_t scale) {
+    set_output_scale(data, scale);
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener =
+    {
+        .preferred_scale = fractional_scale_handle_preferred_scale,
+};
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_handle_geometry,
+    .mode = noop,
+    .done = output_handle_done,
+    .scale = output_handle_scale,
+    .name = noop,
+    .description = noop,
+};
+
+void create_output(struct gn_state *state, struct wl_output *wl_output,
+                   uint32_t name) {
+    struct gn_output *output = calloc(1, sizeof(struct gn_output));
+    if (output == NULL) {
+        fprintf(stderr, "Failed to allocate memory for output\n");
+        wl_output_destroy(wl_output);
+        return;
+    }
+
+    output->state = state;
+    output->wl_output = wl_output;
+    output->wl_name = name;
+    output->scale_120 = 120;
+    output->render_scale = 1.f;
+    wl_list_init(&output->feedback);
+    init_schedule(&output->schedule);
+
+    wl_list_insert(state->outputs.prev, &output->link);
+    wl_output_add_listener(wl_output, &output_listener, output);
+    watch_output_position(output);
+    // outputs that come and go later are shown as they come
+    if (state->egl_context != EGL_NO_CONTEXT) {
+        show_output(output);
+    }
+}
+
+void watch_output_position(struct gn_output *output) {
+    struct gn_state *state = output->state;
+    if (state->xdg_output_manager == NULL || output->xdg_output != NULL) {
+        return;
+    }
+    output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+        state->xdg_output_manager, output->wl_output);
+    zxdg_output_v1_add_listener(output->xdg_output, &xdg_output_listener,
+                                output);
+}
+
+void show_output(struct gn_output *output) {
+    struct gn_state *state = output->state;
+
+    output->surface = wl_compositor_create_surface(state->compositor);
+    if (!state->active) {
+        wl_surface_set_input_region(output->surface, state->empty_region);
+    }
+    // the buffer can only be scaled through a viewport
+    if (state->viewporter != NULL) {
+        output->viewport =
+            wp_viewporter_get_viewport(state->viewporter, output->surface);
+    }
+    if (output->viewport != NULL && state->fractional_scale_manager != NULL) {
+        output->fractional_scale =
+            wp_fractional_scale_manager_v1_get_fractional_scale(
+                state->fractional_scale_manager, output->surface);
+        wp_fractional_scale_v1_add_listener(output->fractional_scale,
+                                            &fractional_scale_listener, output);
+    }
+    output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+        state->layer_shell, output->surface, output->wl_output,
+        ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "glassnote");
+    zwlr_layer_surface_v1_set_size(output->layer_surface, 0, 0);
+    zwlr_layer_surface_v1_set_anchor(output->layer_surface,
+                                     ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+                                         ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM |
+                                         ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+                                         ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
+    zwlr_layer_surface_v1_set_exclusive_zone(output->layer_surface, -1);
+    zwlr_layer_surface_v1_set_keyboard_interactivity(
+        output->layer_surface,
+        ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_ON_DEMAND);
+    zwlr_layer_surface_v1_add_listener(output->layer_surface,
+                                       &layer_surface_listener, output);
+
+    wl_surface_commit(output->surface);
+}
+
+void destroy_output(struct gn_output *output) {
+    struct gn_state *state = output->state;
+    struct gn_seat *seat;
+    wl_list_for_each(seat, &state->seats, link) {
+        if (seat->pointer_output == output) {
+            seat->pointer_output = NULL;
+        }
+        for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+            if (seat->touches[i].output == output) {
+                seat->touches[i].output = NULL;
+            }
+        }
+    }
+    wl_list_remove(&output->link);
+
+    if (output->frame_callback) {
+        wl_callback_destroy(output->frame_callback);
+    }
+    cleanup_feedback(output);
+    cleanup_schedule(&output->schedule);
+    if (output->configured) {
+        // the cache belongs to the context, which needs a surface current
+        eglMakeCurrent(state->egl_display, output->egl_surface,
+                       output->egl_surface, state->egl_context);
+        cleanup_canvas_cache(&output->cache);
+        eglDestroySurface(state->egl_display, output->egl_surface);
+        wl_egl_window_destroy(output->egl_window);
+    }
+    if (output->fractional_scale) {
+        wp_fractional_scale_v1_destroy(output->fractional_scale);
+    }
+    if (output->viewport) {
+        wp_viewport_destroy(output->viewport);
+    }
+    if (output->layer_surface) {
+        zwlr_layer_surface_v1_destroy(output->layer_surface);
+    }
+    if (output->surface) {
+        wl_surface_destroy(output->surface);
+    }
+    if (output->xdg_output) {
+        zxdg_output_v1_destroy(output->xdg_output);
+    }
+    if (wl_output_get_version(output->wl_output) >=
+        WL_OUTPUT_RELEASE_SINCE_VERSION) {
+        wl_output_release(output->wl_output);
+    } else {
+        wl_output_destroy(output->wl_output);
+    }
+    free(output);
+}
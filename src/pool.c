@@ -0,0 +1,184 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glassnote.h"
+#include "grid.h"
+#include "pool.h"
+#include "stroke.h"
+
+struct gn_chunk_slab {
+    // filled in by compact_pool
+    size_t n_free;
+    bool evacuate;
+    struct gn_stroke_chunk chunks[GN_POOL_SLAB_CHUNKS];
+};
+
+static bool pool_grow(struct gn_chunk_pool *pool) {
+    if (pool->n_slabs == pool->c_slabs) {
+        size_t c_slabs =
+            pool->c_slabs == 0 ? GN_POOL_INIT_SLABS : pool->c_slabs * 2;
+        struct gn_chunk_slab **slabs =
+            realloc(pool->slabs, c_slabs * sizeof(struct gn_chunk_slab *));
+        if (slabs == NULL) {
+            return false;
+        }
+        pool->slabs = slabs;
+        pool->c_slabs = c_slabs;
+    }
+
+    struct gn_chunk_slab *slab = malloc(sizeof(struct gn_chunk_slab));
+    if (slab == NULL) {
+        return false;
+    }
+    pool->slabs[pool->n_slabs++] = slab;
+    for (size_t i = GN_POOL_SLAB_CHUNKS; i-- > 0;) {
+        struct gn_stroke_chunk *chunk = &slab->chunks[i];
+        chunk->slab = slab;
+        chunk->next = pool->free;
+        pool->free = chunk;
+    }
+    pool->n_free += GN_POOL_SLAB_CHUNKS;
+    return true;
+}
+
+struct gn_stroke_chunk *pool_alloc_chunk(struct gn_chunk_pool *pool) {
+    if (pool->free == NULL && !pool_grow(pool)) {
+        fprintf(stderr, "Failed to allocate memory for stroke points\n");
+        return NULL;
+    }
+    struct gn_stroke_chunk *chunk = pool->free;
+    pool->free = chunk->next;
+    pool->n_free--;
+    pool->n_used++;
+    chunk->prev = chunk->next = NULL;
+    return chunk;
+}
+
+void pool_free_chunk(struct gn_chunk_pool *pool,
+                     struct gn_stroke_chunk *chunk) {
+    pool_free_chunks(pool, chunk, chunk, 1);
+}
+
+void pool_free_chunks(struct gn_chunk_pool *pool, struct gn_stroke_chunk *head,
+                      struct gn_stroke_chunk *tail, size_t n) {
+    if (head == NULL) {
+        return;
+    }
+    tail->next = pool->free;
+    pool->free = head;
+    pool->n_free += n;
+    pool->n_used -= n;
+}
+
+struct gn_pool_usage pool_usage(struct gn_chunk_pool *pool) {
+    return (struct gn_pool_usage){
+        .n_slabs = pool->n_slabs,
+        .n_used = pool->n_used,
+        .n_free = pool->n_free,
+        .used_bytes = pool->n_used * sizeof(struct gn_stroke_chunk),
+        .reserved_bytes = pool->n_slabs * sizeof(struct gn_chunk_slab),
+    };
+}
+
+static int compare_slabs(const void *a, const void *b) {
+    const struct gn_chunk_slab *sa = *(struct gn_chunk_slab *const *)a;
+    const struct gn_chunk_slab *sb = *(struct gn_chunk_slab *const *)b;
+    return sa->n_free < sb->n_free ? -1 : sa->n_free > sb->n_free;
+}
+
+// moves the stroke's chunks out of the slabs being evacuated
+static void evacuate_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_chunk_pool *pool = &state->pool;
+    bool moves = false;
+    for (struct gn_stroke_chunk *c = stroke->head; c != NULL; c = c->next) {
+        moves |= c->slab->evacuate;
+    }
+    if (!moves) {
+        return;
+    }
+
+    // grid entries point at the chunks, hidden strokes are not in the grid
+    unindex_stroke(state, stroke);
+    for (struct gn_stroke_chunk *c = stroke->head; c != NULL; c = c->next) {
+        if (!c->slab->evacuate) {
+            continue;
+        }
+        struct gn_stroke_chunk *chunk = pool->free;
+        pool->free = chunk->next;
+        memcpy(chunk->pts, c->pts, sizeof(c->pts));
+        chunk->prev = c->prev;
+        chunk->next = c->next;
+        if (c->prev != NULL) {
+            c->prev->next = chunk;
+        } else {
+            stroke->head = chunk;
+        }
+        if (c->next != NULL) {
+            c->next->prev = chunk;
+        } else {
+            stroke->tail = chunk;
+        }
+        c = chunk;
+    }
+    if (!stroke->hidden) {
+        index_stroke(state, stroke);
+    }
+}
+
+void compact_pool(struct gn_state *state) {
+    struct gn_chunk_pool *pool = &state->pool;
+    if (pool->n_slabs == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < pool->n_slabs; i++) {
+        pool->slabs[i]->n_free = 0;
+    }
+    for (struct gn_stroke_chunk *c = pool->free; c != NULL; c = c->next) {
+        c->slab->n_free++;
+    }
+
+    // the fullest slabs that can hold every chunk in use are kept
+    size_t n_keep =
+        (pool->n_used + GN_POOL_SLAB_CHUNKS - 1) / GN_POOL_SLAB_CHUNKS;
+    qsort(pool->slabs, pool->n_slabs, sizeof(struct gn_chunk_slab *),
+          compare_slabs);
+    for (size_t i = 0; i < pool->n_slabs; i++) {
+        pool->slabs[i]->evacuate = i >= n_keep;
+    }
+
+    // the kept slabs have room for every chunk that moves
+    struct gn_stroke_chunk *kept = NULL;
+    for (struct gn_stroke_chunk *c = pool->free, *next; c != NULL; c = next) {
+        next = c->next;
+        if (!c->slab->evacuate) {
+            c->next = kept;
+            kept = c;
+        }
+    }
+    pool->free = kept;
+
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        evacuate_stroke(state, stroke);
+    }
+    wl_list_for_each(stroke, &state->strokes.hidden, link) {
+        evacuate_stroke(state, stroke);
+    }
+
+    for (size_t i = n_keep; i < pool->n_slabs; i++) {
+        free(pool->slabs[i]);
+    }
+    pool->n_slabs = n_keep;
+    pool->n_free = n_keep * GN_POOL_SLAB_CHUNKS - pool->n_used;
+}
+
+void cleanup_pool(struct gn_chunk_pool *pool) {
+    for (size_t i = 0; i < pool->n_slabs; i++) {
+        free(pool->slabs[i]);
+    }
+    free(pool->slabs);
+    *pool = (struct gn_chunk_pool){0};
+}
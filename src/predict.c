@@ -0,0 +1,111 @@
+#include <math.h>
+
+#include "predict.h"
+
+void predictor_reset(struct gn_predictor *predictor) {
+    predictor->n = predictor->pos = 0;
+}
+
+void predictor_add(struct gn_predictor *predictor, uint64_t time_us,
+                   struct gn_vec2 pt) {
+    predictor->time_us[predictor->pos] = time_us;
+    predictor->pts[predictor->pos] = pt;
+    predictor->pos = (predictor->pos + 1) % GN_PREDICT_SAMPLES;
+    if (predictor->n < GN_PREDICT_SAMPLES) {
+        predictor->n++;
+    }
+}
+
+// 3x3 determinant of the rows a, b and c
+static double det3(const double a[3], const double b[3], const double c[3]) {
+    return a[0] * (b[1] * c[2] - b[2] * c[1]) -
+           a[1] * (b[0] * c[2] - b[2] * c[0]) +
+           a[2] * (b[0] * c[1] - b[1] * c[0]);
+}
+
+bool predictor_predict(const struct gn_predictor *predictor, float ahead_ms,
+                       struct gn_vec2 *out) {
+    if (predictor->n < 2) {
+        return false;
+    }
+    size_t last = (predictor->pos + GN_PREDICT_SAMPLES - 1) %
+                  GN_PREDICT_SAMPLES;
+    uint64_t last_us = predictor->time_us[last];
+
+    // ms before the last sample, newest first
+    double t[GN_PREDICT_SAMPLES], x[GN_PREDICT_SAMPLES], y[GN_PREDICT_SAMPLES];
+    size_t n = 0;
+    double t_mean = 0.;
+    for (size_t i = 0; i < predictor->n; i++) {
+        size_t j = (last + GN_PREDICT_SAMPLES - i) % GN_PREDICT_SAMPLES;
+        uint64_t age = last_us - predictor->time_us[j];
+        if (predictor->time_us[j] > last_us || age > GN_PREDICT_WINDOW_US) {
+            break;
+        }
+        t[n] = -(double)age / 1000.;
+        x[n] = predictor->pts[j].x;
+        y[n] = predictor->pts[j].y;
+        t_mean += t[n];
+        n++;
+    }
+    if (n < 2 || t[n - 1] == 0.) {
+        return false;
+    }
+    t_mean /= n;
+
+    // sums of the powers of the centered times, and of the coordinates times
+    // them, for the normal equations
+    double s[5] = {0}, sx[3] = {0}, sy[3] = {0};
+    for (size_t i = 0; i < n; i++) {
+        double u = t[i] - t_mean, p = 1.;
+        for (size_t k = 0; k < 5; k++) {
+            s[k] += p;
+            if (k < 3) {
+                sx[k] += p * x[i];
+                sy[k] += p * y[i];
+            }
+            p *= u;
+        }
+    }
+
+    // fitted as c0 + c1 u + c2 u^2 with u = t - t_mean, the last sample is
+    // at u = -t_mean, so moving on by h adds c1 h + c2 (h^2 - 2 h t_mean)
+    double h = ahead_ms;
+    double dx, dy;
+    double det = 0.;
+    if (n >= GN_PREDICT_MIN_QUADRATIC &&
+        -t[n - 1] * 1000. >= GN_PREDICT_MIN_QUADRATIC_US) {
+        double r0[3] = {s[0], s[1], s[2]}, r1[3] = {s[1], s[2], s[3]},
+               r2[3] = {s[2], s[3], s[4]};
+        det = det3(r0, r1, r2);
+    }
+    if (fabs(det) > 1e-9) {
+        // Cramer's rule for c1 and c2
+        double r0x[3] = {s[0], sx[0], s[2]}, r1x[3] = {s[1], sx[1], s[3]},
+               r2x[3] = {s[2], sx[2], s[4]};
+        double r0y[3] = {s[0], sy[0], s[2]}, r1y[3] = {s[1], sy[1], s[3]},
+               r2y[3] = {s[2], sy[2], s[4]};
+        double q0x[3] = {s[0], s[1], sx[0]}, q1x[3] = {s[1], s[2], sx[1]},
+               q2x[3] = {s[2], s[3], sx[2]};
+        double q0y[3] = {s[0], s[1], sy[0]}, q1y[3] = {s[1], s[2], sy[1]},
+               q2y[3] = {s[2], s[3], sy[2]};
+        double k = h * h - 2. * h * t_mean;
+        dx = det3(r0x, r1x, r2x) / det * h + det3(q0x, q1x, q2x) / det * k;
+        dy = det3(r0y, r1y, r2y) / det * h + det3(q0y, q1y, q2y) / det * k;
+    } else {
+        // the centered sums make the slope sx[1] / s[2]
+        dx = sx[1] / s[2] * h;
+        dy = sy[1] / s[2] * h;
+    }
+
+    struct gn_vec2 d = {(float)dx, (float)dy};
+    float dist = gn_vec2_norm(d);
+    if (!isfinite(dist)) {
+        return false;
+    }
+    if (dist > GN_PREDICT_MAX_DIST) {
+        d = gn_vec2_scale(d, GN_PREDICT_MAX_DIST / dist);
+    }
+    *out = gn_vec2_add(predictor->pts[last], d);
+    return true;
+}
@@ -7,22 +7,34 @@
 #include <string.h>
 
 #include "glassnote.h"
+#include "seat.h"
 #include "stroke.h"
 #include "utils.h"
 
 #define GL_UTILS_SHDR_VERSION "#version 320 es\n"
 #define GL_UTILS_SHDR_SOURCE(x) #x
+#define GL_UTILS_SHDR_INT(x) GL_UTILS_SHDR_SOURCE(x)
 
 #define GN_LINES_ROUND_RES 8
 #define GN_LINES_INSTANCE_SZ (6 * GN_LINES_ROUND_RES + 6)
+#define GN_LINES_INIT_INSTANCES 4096
+// most lines the vertex shader tessellates one curve instance into
+#define GN_CURVES_MAX_LINES 16
+#define GN_CURVES_INSTANCE_SZ                                                  \
+    (6 * GN_CURVES_MAX_LINES + 6 * GN_LINES_ROUND_RES)
+#define GN_CURVES_INIT_INSTANCES 1024
+#define GN_STORE_INIT_BATCHES 16
+#define GN_STREAM_INIT_INSTANCES 256
+#define GN_STREAM_MIN_SPAN 32
+#define GN_FENCE_TIMEOUT_NS 1000000000ull
 
 static const float inv255 = 1.0f / 255.0f;
 
-static void unpack_rgba_i32(int32_t rgba, float out[static 4]) {
-    out[0] = ((rgba >> 24) & 0xFF) * inv255;
-    out[1] = ((rgba >> 16) & 0xFF) * inv255;
-    out[2] = ((rgba >> 8) & 0xFF) * inv255;
-    out[3] = (rgba & 0xFF) * inv255;
+static void pack_rgba_u8(int32_t rgba, uint8_t out[static 4]) {
+    out[0] = (rgba >> 24) & 0xFF;
+    out[1] = (rgba >> 16) & 0xFF;
+    out[2] = (rgba >> 8) & 0xFF;
+    out[3] = rgba & 0xFF;
 }
 
 static void unpack_rgba_i32_premul(int32_t rgba, float out[static 4]) {
@@ -72,6 +84,29 @@ static GLuint link_program(GLuint vs, GLuint fs) {
     return p;
 }
 
+static bool has_extension(const char *extensions, const char *name) {
+    size_t len = strlen(name);
+    for (const char *ext = extensions; ext && (ext = strstr(ext, name));
+         ext += len) {
+        if ((ext == extensions || ext[-1] == ' ') &&
+            (ext[len] == ' ' || ext[len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_gl_extension(const char *name) {
+    GLint n_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n_extensions);
+    for (GLint i = 0; i < n_extensions; i++) {
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 int init_egl(struct gn_state *state) {
     eglBindAPI(EGL_OPENGL_ES_API);
     state->egl_display = eglGetDisplay((EGLNativeDisplayType)state->display);
@@ -105,6 +140,19 @@ int init_egl(struct gn_state *state) {
                                   EGL_CONTEXT_MINOR_VERSION, 2, EGL_NONE};
     state->egl_context = eglCreateContext(state->egl_display, state->egl_config,
                                           EGL_NO_CONTEXT, ctx_attribs);
+
+    const char *extensions =
+        eglQueryString(state->egl_display, EGL_EXTENSIONS);
+    if (has_extension(extensions, "EGL_KHR_swap_buffers_with_damage")) {
+        state->swap_buffers_with_damage =
+            (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress(
+                "eglSwapBuffersWithDamageKHR");
+    } else if (has_extension(extensions, "EGL_EXT_swap_buffers_with_damage")) {
+        state->swap_buffers_with_damage =
+            (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress(
+                "eglSwapBuffersWithDamageEXT");
+    }
+    state->has_buffer_age = has_extension(extensions, "EGL_EXT_buffer_age");
     return 0;
 }
 
@@ -113,44 +161,965 @@ void cleanup_egl(struct gn_state *state) {
     eglTerminate(state->egl_display);
 }
 
+static size_t stroke_n_segments(struct gn_stroke *stroke) {
+    return stroke->n_pts < 2 ? 0 : stroke->n_pts - 1;
+}
+
+// cubics needing more lines than the curve mesh has are drawn in equal pieces
+static size_t cubic_n_pieces(const struct gn_vec2 c[4]) {
+    size_t n = gn_cubic_n_lines(c, STROKE_FLATTEN_TOLERANCE);
+    return (n + GN_CURVES_MAX_LINES - 1) / GN_CURVES_MAX_LINES;
+}
+
+static size_t stroke_n_curve_pieces(struct gn_stroke *stroke) {
+    size_t n = 0;
+    struct gn_stroke_pos pos = {stroke->head, 0};
+    for (size_t i = 0; i < stroke_n_cubics(stroke); i++) {
+        struct gn_vec2 c[4];
+        stroke_pos_cubic(pos, c);
+        n += cubic_n_pieces(c);
+        for (size_t j = 0; j < 3; j++) {
+            stroke_pos_next(&pos);
+        }
+    }
+    return n;
+}
+
+static void fill_curve_instances(struct gn_stroke *stroke,
+                                 struct gn_curves_instance *out) {
+    struct gn_curves_instance instance = {.width = stroke->width};
+    pack_rgba_u8(stroke->color, instance.color);
+    struct gn_stroke_pos pos = {stroke->head, 0};
+    for (size_t i = 0; i < stroke_n_cubics(stroke); i++) {
+        struct gn_vec2 c[4];
+        stroke_pos_cubic(pos, c);
+        size_t n = cubic_n_pieces(c);
+        for (size_t j = 0; j < n; j++) {
+            gn_cubic_sub(c, (float)j / n, (float)(j + 1) / n, instance.pts);
+            *out++ = instance;
+        }
+        for (size_t j = 0; j < 3; j++) {
+            stroke_pos_next(&pos);
+        }
+    }
+}
+
+// writes segments [first, last) of the stroke to out. a segment's end point
+// may be the first point of the next chunk.
+static void fill_instances(struct gn_stroke *stroke, size_t first, size_t last,
+                           struct gn_lines_instance *out) {
+    if (first >= last) {
+        return;
+    }
+    struct gn_lines_instance instance = {.width = stroke->width};
+    pack_rgba_u8(stroke->color, instance.color);
+    struct gn_stroke_pos pos = stroke_seek(stroke, first);
+    instance.pt2 = *stroke_pos_pt(pos);
+    for (size_t i = first; i < last; i++) {
+        stroke_pos_next(&pos);
+        instance.pt1 = instance.pt2;
+        instance.pt2 = *stroke_pos_pt(pos);
+        *out++ = instance;
+    }
+}
+
+static void *reserve_scratch(struct gn_lines_device *gl, size_t size) {
+    if (size <= gl->c_scratch) {
+        return gl->scratch;
+    }
+
+    size_t capacity = gl->c_scratch ? gl->c_scratch
+                                    : GN_LINES_INIT_INSTANCES *
+                                          sizeof(struct gn_lines_instance);
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    void *scratch = realloc(gl->scratch, capacity);
+    if (scratch == NULL) {
+        fprintf(stderr, "Failed to allocate memory for instance data\n");
+        return NULL;
+    }
+    gl->scratch = scratch;
+    gl->c_scratch = capacity;
+    return scratch;
+}
+
+static size_t instance_size(struct gn_instance_buffer *buf) {
+    return buf->curves ? sizeof(struct gn_curves_instance)
+                       : sizeof(struct gn_lines_instance);
+}
+
+static void instance_attrib(GLuint loc, GLint size, GLenum type,
+                            GLboolean normalized, size_t stride,
+                            size_t offset) {
+    glEnableVertexAttribArray(loc);
+    glVertexAttribPointer(loc, size, type, normalized, stride, (void *)offset);
+    glVertexAttribDivisor(loc, 1);
+}
+
+static void bind_curve_attribs(struct gn_lines_device *gl,
+                               struct gn_instance_buffer *buf, size_t first) {
+    size_t stride = sizeof(struct gn_curves_instance);
+    size_t base = first * stride;
+    glBindVertexArray(buf->vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, gl->curve_mesh_vbo);
+    glEnableVertexAttribArray(gl->curve_attribs.a_pos);
+    glVertexAttribPointer(gl->curve_attribs.a_pos, 3, GL_FLOAT, GL_FALSE,
+                          sizeof(struct gn_vec3), 0);
+    glVertexAttribDivisor(gl->curve_attribs.a_pos, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buf->vbo);
+    for (size_t i = 0; i < 4; i++) {
+        instance_attrib(gl->curve_attribs.a_pts[i], 2, GL_FLOAT, GL_FALSE,
+                        stride,
+                        base + offsetof(struct gn_curves_instance, pts) +
+                            i * sizeof(struct gn_vec2));
+    }
+    instance_attrib(gl->curve_attribs.a_width, 1, GL_FLOAT, GL_FALSE, stride,
+                    base + offsetof(struct gn_curves_instance, width));
+    instance_attrib(gl->curve_attribs.a_color, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                    stride, base + offsetof(struct gn_curves_instance, color));
+}
+
+// points the instance attributes of buf's vao at instance `first`, since
+// GLES has no base instance for instanced draws
+static void bind_instance_attribs(struct gn_lines_device *gl,
+                                  struct gn_instance_buffer *buf,
+                                  size_t first) {
+    if (buf->curves) {
+        bind_curve_attribs(gl, buf, first);
+        return;
+    }
+    size_t stride = sizeof(struct gn_lines_instance);
+    size_t base = first * stride;
+    glBindVertexArray(buf->vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, gl->mesh_vbo);
+    glEnableVertexAttribArray(gl->attribs.a_pos);
+    glVertexAttribPointer(gl->attribs.a_pos, 3, GL_FLOAT, GL_FALSE,
+                          sizeof(struct gn_vec3), 0);
+    glVertexAttribDivisor(gl->attribs.a_pos, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buf->vbo);
+    instance_attrib(gl->attribs.a_pt1, 2, GL_FLOAT, GL_FALSE, stride,
+                    base + offsetof(struct gn_lines_instance, pt1));
+    instance_attrib(gl->attribs.a_pt2, 2, GL_FLOAT, GL_FALSE, stride,
+                    base + offsetof(struct gn_lines_instance, pt2));
+    instance_attrib(gl->attribs.a_width, 1, GL_FLOAT, GL_FALSE, stride,
+                    base + offsetof(struct gn_lines_instance, width));
+    instance_attrib(gl->attribs.a_color, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                    base + offsetof(struct gn_lines_instance, color));
+}
+
+static void init_instance_buffer(struct gn_lines_device *gl,
+                                 struct gn_instance_buffer *buf, bool curves,
+                                 size_t capacity, GLenum usage) {
+    buf->curves = curves;
+    glGenVertexArrays(1, &buf->vao);
+    glGenBuffers(1, &buf->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, buf->vbo);
+    glBufferData(GL_ARRAY_BUFFER, capacity * instance_size(buf), NULL, usage);
+    buf->n_instances = 0;
+    buf->c_instances = capacity;
+    buf->n_dead = 0;
+    bind_instance_attribs(gl, buf, 0);
+}
+
+static void cleanup_instance_buffer(struct gn_instance_buffer *buf) {
+    glDeleteBuffers(1, &buf->vbo);
+    glDeleteVertexArrays(1, &buf->vao);
+    *buf = (struct gn_instance_buffer){0};
+}
+
+// grows the buffer on the GPU side, existing instances are never re-uploaded
+static bool reserve_instance_buffer(struct gn_lines_device *gl,
+                                    struct gn_instance_buffer *buf, size_t n,
+                                    GLenum usage) {
+    if (n <= buf->c_instances) {
+        return true;
+    }
+
+    size_t capacity = buf->c_instances;
+    while (capacity < n) {
+        capacity *= 2;
+    }
+
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity * instance_size(buf), NULL,
+                 usage);
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        fprintf(stderr, "Failed to allocate GPU memory for strokes\n");
+        glDeleteBuffers(1, &vbo);
+        return false;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, buf->vbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        buf->n_instances * instance_size(buf));
+    glDeleteBuffers(1, &buf->vbo);
+
+    buf->vbo = vbo;
+    buf->c_instances = capacity;
+    bind_instance_attribs(gl, buf, 0);
+    return true;
+}
+
+static void free_stream_storage(struct gn_lines_device *gl) {
+    if (gl->stream_map != NULL) {
+        glBindBuffer(GL_ARRAY_BUFFER, gl->stream.vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        gl->stream_map = NULL;
+    }
+    cleanup_instance_buffer(&gl->stream);
+}
+
+// where to write instances [offset, offset + n) of the stream, which no frame
+// in flight reads from. end_stream_write follows once they are written.
+static struct gn_lines_instance *
+begin_stream_write(struct gn_lines_device *gl, size_t offset, size_t n) {
+    if (gl->stream_map != NULL) {
+        return gl->stream_map + offset;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, gl->stream.vbo);
+    return glMapBufferRange(GL_ARRAY_BUFFER,
+                            offset * sizeof(struct gn_lines_instance),
+                            n * sizeof(struct gn_lines_instance),
+                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+static void end_stream_write(struct gn_lines_device *gl) {
+    if (gl->stream_map == NULL) {
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+}
+
+// zero width instances rasterize nothing
+static void clear_stream(struct gn_lines_device *gl, size_t offset,
+                         size_t n) {
+    if (n == 0) {
+        return;
+    }
+    struct gn_lines_instance *dst = begin_stream_write(gl, offset, n);
+    if (dst != NULL) {
+        memset(dst, 0, n * sizeof(struct gn_lines_instance));
+        end_stream_write(gl);
+    }
+}
+
+// replaces the stream with a cleared one of capacity instances per copy,
+// the spans are written to it again from the start
+static bool alloc_stream_storage(struct gn_lines_device *gl,
+                                 size_t capacity) {
+    free_stream_storage(gl);
+
+    struct gn_instance_buffer *buf = &gl->stream;
+    size_t n = GN_STREAM_COPIES * capacity;
+    GLsizeiptr size = n * sizeof(struct gn_lines_instance);
+    glGenVertexArrays(1, &buf->vao);
+    glGenBuffers(1, &buf->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, buf->vbo);
+    if (gl->buffer_storage != NULL) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT |
+                           GL_MAP_COHERENT_BIT_EXT;
+        gl->buffer_storage(GL_ARRAY_BUFFER, size, NULL, flags);
+        gl->stream_map = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        if (gl->stream_map == NULL) {
+            fprintf(stderr, "Failed to map stroke stream\n");
+            cleanup_instance_buffer(buf);
+            return false;
+        }
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    }
+
+    buf->c_instances = capacity;
+    bind_instance_attribs(gl, buf, 0);
+    clear_stream(gl, 0, n);
+    struct gn_stream *stream;
+    wl_list_for_each(stream, &gl->streams, link) {
+        memset(stream->n_synced, 0, sizeof(stream->n_synced));
+        memset(stream->n_written, 0, sizeof(stream->n_written));
+    }
+    return true;
+}
+
+// makes room for n instances in each copy of the stream
+static bool reserve_stream(struct gn_lines_device *gl, size_t n) {
+    if (gl->stream.vbo != 0 && n <= gl->stream.c_instances) {
+        return true;
+    }
+    size_t capacity = gl->stream.c_instances == 0 ? GN_STREAM_INIT_INSTANCES
+                                                  : gl->stream.c_instances;
+    while (capacity < n) {
+        capacity *= 2;
+    }
+    return alloc_stream_storage(gl, capacity);
+}
+
+// the size of a span for a stroke of n instances, with room to grow
+static size_t stream_span(size_t n) {
+    n += n / 2;
+    return n < GN_STREAM_MIN_SPAN ? GN_STREAM_MIN_SPAN : n;
+}
+
+// a span of at least n instances, a free one if one is large enough, else
+// a new one after the others
+static struct gn_stream *acquire_stream(struct gn_lines_device *gl,
+                                        size_t n) {
+    struct gn_stream *stream;
+    wl_list_for_each(stream, &gl->streams, link) {
+        if (!stream->in_use && stream->c >= n) {
+            stream->in_use = true;
+            memset(stream->n_synced, 0, sizeof(stream->n_synced));
+            return stream;
+        }
+    }
+
+    stream = calloc(1, sizeof(struct gn_stream));
+    if (stream == NULL) {
+        fprintf(stderr, "Failed to allocate memory for stroke stream\n");
+        return NULL;
+    }
+    stream->c = stream_span(n);
+    if (!wl_list_empty(&gl->streams)) {
+        struct gn_stream *last =
+            wl_container_of(gl->streams.prev, last, link);
+        stream->st = last->st + last->c;
+    }
+    stream->in_use = true;
+    wl_list_insert(gl->streams.prev, &stream->link);
+    return stream;
+}
+
+// the span is cleared in each copy before that copy is drawn again
+static void release_stream(struct gn_stroke *stroke) {
+    if (stroke->stream != NULL) {
+        stroke->stream->in_use = false;
+        stroke->stream = NULL;
+    }
+}
+
+// the provisional segment from the stroke's last point to tail
+static void fill_tail(struct gn_stroke *stroke, struct gn_vec2 tail,
+                      struct gn_lines_instance *out) {
+    struct gn_lines_instance instance = {
+        .pt1 = *stroke_pt(stroke, stroke->n_pts - 1),
+        .pt2 = tail,
+        .width = stroke->width,
+    };
+    pack_rgba_u8(stroke->color, instance.color);
+    *out = instance;
+}
+
+// writes whatever changed in the stroke since `copy` was last written.
+// tail, if given, is drawn after the segments, where the next frame that
+// uses the copy writes over it.
+static void sync_stream(struct gn_lines_device *gl, struct gn_stroke *stroke,
+                        const struct gn_vec2 *tail, size_t copy) {
+    size_t n = stroke_n_segments(stroke);
+    size_t total = n + (tail != NULL);
+    struct gn_stream *stream = stroke->stream;
+    if (stream != NULL && total > stream->c) {
+        if (stream->link.next == &gl->streams) {
+            // the last span grows where it is
+            stream->c = stream_span(total);
+        } else {
+            // the stroke moves to a larger span
+            release_stream(stroke);
+        }
+    }
+    if (stroke->stream == NULL) {
+        stroke->stream = acquire_stream(gl, total);
+    }
+    stream = stroke->stream;
+    if (stream == NULL || !reserve_stream(gl, stream->st + stream->c)) {
+        return;
+    }
+
+    // what a longer write left in the copy is cleared after the segments
+    size_t first = stream->n_synced[copy] < n ? stream->n_synced[copy] : n;
+    size_t end = total > stream->n_written[copy] ? total
+                                                 : stream->n_written[copy];
+    if (first < end) {
+        struct gn_lines_instance *dst = begin_stream_write(
+            gl, copy * gl->stream.c_instances + stream->st + first,
+            end - first);
+        if (dst == NULL) {
+            return;
+        }
+        fill_instances(stroke, first, n, dst);
+        if (tail != NULL) {
+            fill_tail(stroke, *tail, dst + (n - first));
+        }
+        memset(dst + (total - first), 0,
+               (end - total) * sizeof(struct gn_lines_instance));
+        end_stream_write(gl);
+    }
+
+    // segments before seg_st no longer change while the stroke is in progress
+    stream->n_synced[copy] = stroke->seg_st < n ? stroke->seg_st : n;
+    stream->n_written[copy] = total;
+}
+
+// lays the spans in use out one after another again, once the free ones
+// between them are larger than they are and than a stream starts out. it
+// takes a new stream, as frames in flight may still read the old one.
+static void pack_streams(struct gn_lines_device *gl) {
+    size_t used = 0, end = 0;
+    struct gn_stream *stream, *tmp;
+    wl_list_for_each(stream, &gl->streams, link) {
+        if (stream->in_use) {
+            used += stream->c;
+            end = stream->st + stream->c;
+        }
+    }
+    if (end - used <= used || end - used <= GN_STREAM_INIT_INSTANCES) {
+        return;
+    }
+
+    size_t st = 0;
+    wl_list_for_each_safe(stream, tmp, &gl->streams, link) {
+        if (!stream->in_use) {
+            wl_list_remove(&stream->link);
+            free(stream);
+            continue;
+        }
+        stream->st = st;
+        st += stream->c;
+    }
+    free_stream_storage(gl);
+    reserve_stream(gl, st);
+}
+
+// clears what the spans given back left in copy and drops the free spans at
+// the end of the stream, returning the instances of the copy to draw
+static size_t sweep_streams(struct gn_lines_device *gl, size_t copy) {
+    size_t n = 0;
+    struct gn_stream *stream;
+    wl_list_for_each(stream, &gl->streams, link) {
+        if (stream->in_use) {
+            n = stream->st + stream->n_written[copy];
+        } else if (stream->n_written[copy] > 0) {
+            clear_stream(gl, copy * gl->stream.c_instances + stream->st,
+                         stream->n_written[copy]);
+            stream->n_written[copy] = 0;
+        }
+    }
+    while (!wl_list_empty(&gl->streams)) {
+        stream = wl_container_of(gl->streams.prev, stream, link);
+        for (size_t i = 0; i < GN_STREAM_COPIES; i++) {
+            if (stream->in_use || stream->n_written[i] > 0) {
+                return n;
+            }
+        }
+        wl_list_remove(&stream->link);
+        free(stream);
+    }
+    return n;
+}
+
+// appends instances [first, first + count) of the stroke's store to the
+// batches, merging them into the last batch when they follow it
+static bool push_batch(struct gn_lines_device *gl, bool curves, size_t first,
+                       size_t count) {
+    struct gn_store_batch *last =
+        gl->n_batches > 0 ? &gl->batches[gl->n_batches - 1] : NULL;
+    if (last != NULL && last->curves == curves &&
+        last->first + last->count == first) {
+        last->count += count;
+        gl->n_batched += count;
+        return true;
+    }
+
+    if (gl->n_batches == gl->c_batches) {
+        size_t c_batches =
+            gl->c_batches == 0 ? GN_STORE_INIT_BATCHES : gl->c_batches * 2;
+        struct gn_store_batch *batches =
+            realloc(gl->batches, c_batches * sizeof(struct gn_store_batch));
+        if (batches == NULL) {
+            fprintf(stderr, "Failed to allocate memory for store batches\n");
+            return false;
+        }
+        gl->batches = batches;
+        gl->c_batches = c_batches;
+    }
+    gl->batches[gl->n_batches++] =
+        (struct gn_store_batch){curves, first, count};
+    gl->n_batched += count;
+    return true;
+}
+
+void upload_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_lines_device *gl = &state->gl;
+    bool curves = stroke->curved;
+    struct gn_instance_buffer *store = curves ? &gl->curve_store : &gl->store;
+
+    release_stream(stroke);
+
+    // strokes finished before the GL context exists are uploaded by init_gl
+    if (gl->program_id == 0 || stroke->store_n != 0) {
+        return;
+    }
+    // a packed stroke is unpacked only for as long as it is uploaded
+    bool packed = stroke_is_packed(stroke);
+    if (packed && !unpack_stroke(stroke)) {
+        return;
+    }
+    size_t n =
+        curves ? stroke_n_curve_pieces(stroke) : stroke_n_segments(stroke);
+    size_t size = instance_size(store);
+    void *instances = NULL;
+    if (n > 0 && reserve_instance_buffer(gl, store, store->n_instances + n,
+                                         GL_STATIC_DRAW)) {
+        instances = reserve_scratch(gl, n * size);
+    }
+    if (instances != NULL) {
+        if (curves) {
+            fill_curve_instances(stroke, instances);
+        } else {
+            fill_instances(stroke, 0, n, instances);
+        }
+    }
+    if (packed) {
+        repack_stroke(stroke);
+    }
+    if (instances == NULL) {
+        return;
+    }
+    stroke->batch_pos = gl->n_batched;
+    if (!push_batch(gl, curves, store->n_instances, n)) {
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, store->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, store->n_instances * size, n * size,
+                    instances);
+    stroke->store_st = store->n_instances;
+    stroke->store_n = n;
+    store->n_instances += n;
+}
+
+void discard_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    struct gn_lines_device *gl = &state->gl;
+    struct gn_instance_buffer *store =
+        stroke->curved ? &gl->curve_store : &gl->store;
+    release_stream(stroke);
+    if (gl->program_id == 0 || stroke->store_n == 0) {
+        return;
+    }
+
+    // only the end of the last batch can be given back, anything before it
+    // is drawn in between other batches
+    struct gn_store_batch *last = &gl->batches[gl->n_batches - 1];
+    size_t size = instance_size(store);
+    if (last->curves == stroke->curved &&
+        stroke->store_st + stroke->store_n == store->n_instances) {
+        store->n_instances = stroke->store_st;
+        last->count -= stroke->store_n;
+        gl->n_batched -= stroke->store_n;
+        if (last->count == 0) {
+            gl->n_batches--;
+        }
+    } else {
+        // zero width instances rasterize nothing; the hole is reclaimed once
+        // enough of the store is dead
+        void *instances = reserve_scratch(gl, stroke->store_n * size);
+        if (instances == NULL) {
+            return;
+        }
+        memset(instances, 0, stroke->store_n * size);
+        glBindBuffer(GL_ARRAY_BUFFER, store->vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, stroke->store_st * size,
+                        stroke->store_n * size, instances);
+        store->n_dead += stroke->store_n;
+    }
+    // only the outputs the stroke was on have it in their cache
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        struct gn_canvas_cache *cache = &output->cache;
+        if (gn_box_is_empty(
+                gn_box_intersect(stroke->bbox, output_box(output)))) {
+            // the store may have shrunk under what it composited
+            if (cache->n_drawn > gl->n_batched) {
+                cache->n_drawn = gl->n_batched;
+            }
+        } else {
+            cache->valid = false;
+        }
+    }
+    stroke->store_st = 0;
+    stroke->store_n = 0;
+}
+
+const struct gn_canvas_listener display_canvas_listener = {
+    .damage = damage_output,
+    .upload = upload_stroke,
+    .discard = discard_stroke,
+};
+
+static void rebuild_store(struct gn_state *state) {
+    struct gn_lines_device *gl = &state->gl;
+    // the batches the caches count into are gone
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        output->cache.valid = false;
+    }
+    gl->store.n_instances = 0;
+    gl->store.n_dead = 0;
+    gl->curve_store.n_instances = 0;
+    gl->curve_store.n_dead = 0;
+    gl->n_batches = 0;
+    gl->n_batched = 0;
+    // in z order, which is the order they were uploaded in
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        stroke->store_n = 0;
+        if (stroke->finished) {
+            upload_stroke(state, stroke);
+        }
+    }
+}
+
+static void draw_instances(struct gn_lines_device *gl,
+                           struct gn_instance_buffer *buf, size_t first,
+                           size_t count) {
+    if (count == 0) {
+        return;
+    }
+    glUseProgram(buf->curves ? gl->curve_program_id : gl->program_id);
+    if (first != 0) {
+        bind_instance_attribs(gl, buf, first);
+    } else {
+        glBindVertexArray(buf->vao);
+    }
+    glDrawArraysInstanced(GL_TRIANGLES, 0,
+                          buf->curves ? GN_CURVES_INSTANCE_SZ
+                                      : GN_LINES_INSTANCE_SZ,
+                          count);
+    if (first != 0) {
+        bind_instance_attribs(gl, buf, 0);
+    }
+}
+
+// the link of the first of the strokes uploaded since n_drawn instances were,
+// which are the last in z order, or the end of the order if there are none
+static struct wl_list *first_new_stroke(struct gn_state *state,
+                                        size_t n_drawn) {
+    struct wl_list *first = &state->strokes.order;
+    struct gn_stroke *stroke;
+    wl_list_for_each_reverse(stroke, &state->strokes.order, link) {
+        if (stroke->store_n == 0) {
+            continue;
+        }
+        if (stroke->batch_pos < n_drawn) {
+            break;
+        }
+        first = &stroke->link;
+    }
+    return first;
+}
+
+// draws the finished strokes on output in z order, from the one linked at
+// from on, and returns what they cover. consecutive strokes of the same
+// store are drawn at once.
+static struct gn_box draw_output_strokes(struct gn_state *state,
+                                         struct gn_output *output,
+                                         struct wl_list *from) {
+    struct gn_lines_device *gl = &state->gl;
+    struct gn_box box = output_box(output), drawn = {0};
+    struct gn_instance_buffer *buf = NULL;
+    size_t first = 0, count = 0;
+    for (struct wl_list *link = from; link != &state->strokes.order;
+         link = link->next) {
+        struct gn_stroke *stroke = wl_container_of(link, stroke, link);
+        if (stroke->store_n == 0 ||
+            gn_box_is_empty(gn_box_intersect(stroke->bbox, box))) {
+            continue;
+        }
+        drawn = gn_box_union(drawn, stroke->bbox);
+        struct gn_instance_buffer *store =
+            stroke->curved ? &gl->curve_store : &gl->store;
+        if (store == buf && first + count == stroke->store_st) {
+            count += stroke->store_n;
+            continue;
+        }
+        if (buf != NULL) {
+            draw_instances(gl, buf, first, count);
+        }
+        buf = store;
+        first = stroke->store_st;
+        count = stroke->store_n;
+    }
+    if (buf != NULL) {
+        draw_instances(gl, buf, first, count);
+    }
+    return gn_box_intersect(drawn, box);
+}
+
+void cleanup_canvas_cache(struct gn_canvas_cache *cache) {
+    glDeleteFramebuffers(1, &cache->ms_fbo);
+    glDeleteRenderbuffers(1, &cache->ms_rbo);
+    glDeleteFramebuffers(1, &cache->fbo);
+    glDeleteTextures(1, &cache->tex);
+    *cache = (struct gn_canvas_cache){0};
+}
+
+static void resize_cache(struct gn_canvas_cache *cache, int32_t width,
+                         int32_t height, GLint samples) {
+    cleanup_canvas_cache(cache);
+
+    glGenTextures(1, &cache->tex);
+    glBindTexture(GL_TEXTURE_2D, cache->tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenFramebuffers(1, &cache->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           cache->tex, 0);
+
+    // match the output's antialiasing, the texture is the resolve target
+    if (samples > 0) {
+        glGenRenderbuffers(1, &cache->ms_rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, cache->ms_rbo);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8,
+                                         width, height);
+        glGenFramebuffers(1, &cache->ms_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, cache->ms_fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_RENDERBUFFER, cache->ms_rbo);
+    }
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Canvas cache framebuffer is incomplete\n");
+    }
+
+    cache->width = width;
+    cache->height = height;
+    cache->samples = samples;
+}
+
+// composites the strokes on the output that are not yet in its cache, or
+// redraws them all when the cache was invalidated
+static void update_cache(struct gn_state *state, struct gn_output *output) {
+    struct gn_lines_device *gl = &state->gl;
+    struct gn_canvas_cache *cache = &output->cache;
+    int32_t width = output->buffer_width;
+    int32_t height = output->buffer_height;
+
+    GLint samples;
+    glGetIntegerv(GL_SAMPLES, &samples);
+    if (cache->fbo == 0 || cache->width != width || cache->height != height ||
+        cache->samples != samples) {
+        resize_cache(cache, width, height, samples);
+    }
+    if (cache->active != state->active) {
+        cache->valid = false;
+    }
+    if (cache->valid && cache->n_drawn == gl->n_batched) {
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER,
+                      cache->samples > 0 ? cache->ms_fbo : cache->fbo);
+    struct gn_box drawn = output_box(output);
+    if (!cache->valid) {
+        // a full redraw is the only time the holes in the store matter
+        size_t n_dead = gl->store.n_dead + gl->curve_store.n_dead;
+        if (n_dead * 2 > gl->n_batched) {
+            rebuild_store(state);
+        }
+
+        float buf[4];
+        unpack_rgba_i32_premul(state->bg_colors[state->active], buf);
+
+        // glClearColor wants premultiplied alpha values
+        glClearColor(buf[0], buf[1], buf[2], buf[3]);
+        glClear(GL_COLOR_BUFFER_BIT);
+        draw_output_strokes(state, output, state->strokes.order.next);
+    } else {
+        // strokes on other outputs cost this one nothing
+        drawn = draw_output_strokes(state, output,
+                                    first_new_stroke(state, cache->n_drawn));
+    }
+
+    // only what was drawn on is resolved
+    if (cache->samples > 0 && !gn_box_is_empty(drawn)) {
+        drawn.pos.x -= output->x;
+        drawn.pos.y -= output->y;
+        struct gn_box rect = buffer_rect(output, drawn);
+        GLint x0 = rect.pos.x, x1 = rect.pos.x + rect.size.x;
+        // y grows upwards
+        GLint y0 = height - (rect.pos.y + rect.size.y);
+        GLint y1 = height - rect.pos.y;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, cache->ms_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cache->fbo);
+        glBlitFramebuffer(x0, y0, x1, y1, x0, y0, x1, y1, GL_COLOR_BUFFER_BIT,
+                          GL_NEAREST);
+    }
+
+    cache->valid = true;
+    cache->active = state->active;
+    cache->n_drawn = gl->n_batched;
+}
+
 void init_gl(struct gn_state *state) {
     // clang-format off
     static const char *vs_src = 
         GL_UTILS_SHDR_VERSION 
+        "#define MAX_CULL " GL_UTILS_SHDR_INT(GN_DAMAGE_MAX_RECTS) "\n"
         GL_UTILS_SHDR_SOURCE(
             layout(location = 0) in vec3 a_pos; 
             layout(location = 1) in vec2 a_pt1;
             layout(location = 2) in vec2 a_pt2;
+            layout(location = 3) in float a_width;
+            layout(location = 4) in vec4 a_color;
             uniform vec2 u_resolution;
-            uniform float u_width;
+            uniform vec2 u_origin;
+            uniform float u_alpha;
+            // corners of the boxes an instance is drawn on, if any are given
+            uniform vec4 u_cull[MAX_CULL];
+            uniform int u_n_cull;
+            flat out vec4 v_color;
 
             void main() {
-                vec2 xBasis = normalize(a_pt2 - a_pt1);
+                vec2 lo = min(a_pt1, a_pt2) - a_width;
+                vec2 hi = max(a_pt1, a_pt2) + a_width;
+                bool on = u_n_cull == 0;
+                for (int i = 0; i < u_n_cull; i++) {
+                    on = on || (all(lessThan(lo, u_cull[i].zw)) &&
+                                all(lessThan(u_cull[i].xy, hi)));
+                }
+                if (!on || a_width == 0.0) {
+                    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+                    v_color = vec4(0.0);
+                    return;
+                }
+                vec2 dir = a_pt2 - a_pt1;
+                vec2 xBasis = dot(dir, dir) > 0.0 ? normalize(dir) : vec2(1.0, 0.0);
                 vec2 yBasis = vec2(-xBasis.y, xBasis.x);
-                vec2 offsetA = a_pt1 + u_width * (a_pos.x * xBasis + a_pos.y * yBasis);
-                vec2 offsetB = a_pt2 + u_width * (a_pos.x * xBasis + a_pos.y * yBasis);
+                vec2 offsetA = a_pt1 + a_width * (a_pos.x * xBasis + a_pos.y * yBasis);
+                vec2 offsetB = a_pt2 + a_width * (a_pos.x * xBasis + a_pos.y * yBasis);
                 vec2 pt = mix(offsetA, offsetB, a_pos.z);
-                vec2 clipSpace = pt / u_resolution * 2.0 - 1.0;
+                vec2 clipSpace = (pt - u_origin) / u_resolution * 2.0 - 1.0;
                 gl_Position = vec4(clipSpace * vec2(1.0, -1.0), 0.0, 1.0);
+                v_color = vec4(a_color.rgb, u_alpha);
             }
         );
     static const char *fs_src =
         GL_UTILS_SHDR_VERSION
         GL_UTILS_SHDR_SOURCE(
             precision mediump float;
+            flat in vec4 v_color;
             out vec4 fragColor;
-            uniform vec4 u_color;
 
             void main() {
-              fragColor = u_color;
+              fragColor = v_color;
+            }
+        );
+    static const char *curve_vs_src =
+        GL_UTILS_SHDR_VERSION
+        GL_UTILS_SHDR_SOURCE(
+            layout(location = 0) in vec3 a_pos;
+            layout(location = 1) in vec2 a_p0;
+            layout(location = 2) in vec2 a_p1;
+            layout(location = 3) in vec2 a_p2;
+            layout(location = 4) in vec2 a_p3;
+            layout(location = 5) in float a_width;
+            layout(location = 6) in vec4 a_color;
+            uniform vec2 u_resolution;
+            uniform vec2 u_origin;
+            uniform float u_alpha;
+            uniform float u_tolerance;
+            uniform float u_max_lines;
+            flat out vec4 v_color;
+
+            vec2 point(float t) {
+                float s = 1.0 - t;
+                return s * s * s * a_p0 + 3.0 * s * s * t * a_p1 +
+                       3.0 * s * t * t * a_p2 + t * t * t * a_p3;
+            }
+
+            vec2 tangent(float t) {
+                float s = 1.0 - t;
+                vec2 d = s * s * (a_p1 - a_p0) + 2.0 * s * t * (a_p2 - a_p1) +
+                         t * t * (a_p3 - a_p2);
+                // a control point on top of an end leaves no derivative there
+                if (dot(d, d) == 0.0) {
+                    d = t < 0.5 ? a_p2 - a_p0 : a_p3 - a_p1;
+                }
+                if (dot(d, d) == 0.0) {
+                    d = a_p3 - a_p0;
+                }
+                return dot(d, d) > 0.0 ? normalize(d) : vec2(1.0, 0.0);
+            }
+
+            void main() {
+                // lines needed to stay within the tolerance on screen, from
+                // Wang's formula; vertices of the lines past them collapse
+                // onto the end of the curve
+                vec2 dd1 = a_p0 - 2.0 * a_p1 + a_p2;
+                vec2 dd2 = a_p1 - 2.0 * a_p2 + a_p3;
+                float m = sqrt(max(dot(dd1, dd1), dot(dd2, dd2)));
+                float n = ceil(sqrt(0.75 * m / u_tolerance));
+                n = clamp(n, 1.0, u_max_lines);
+                // caps are marked with x = -1 at the start and -2 at the end
+                float t = min(a_pos.x, n) / n;
+                if (a_pos.x < 0.0) {
+                    t = a_pos.x < -1.5 ? 1.0 : 0.0;
+                }
+                vec2 xBasis = tangent(t);
+                vec2 yBasis = vec2(-xBasis.y, xBasis.x);
+                vec2 offset = a_pos.y * xBasis + a_pos.z * yBasis;
+                vec2 pt = point(t) + a_width * offset;
+                vec2 clipSpace = (pt - u_origin) / u_resolution * 2.0 - 1.0;
+                gl_Position = vec4(clipSpace * vec2(1.0, -1.0), 0.0, 1.0);
+                v_color = vec4(a_color.rgb, u_alpha);
+            }
+        );
+    static const char *blit_vs_src =
+        GL_UTILS_SHDR_VERSION
+        GL_UTILS_SHDR_SOURCE(
+            void main() {
+                // one triangle covering the whole viewport
+                vec2 pos = vec2((gl_VertexID & 1) << 2, (gl_VertexID & 2) << 1);
+                gl_Position = vec4(pos - 1.0, 0.0, 1.0);
+            }
+        );
+    static const char *blit_fs_src =
+        GL_UTILS_SHDR_VERSION
+        GL_UTILS_SHDR_SOURCE(
+            precision mediump float;
+            uniform sampler2D u_tex;
+            out vec4 fragColor;
+
+            void main() {
+              fragColor = texelFetch(u_tex, ivec2(gl_FragCoord.xy), 0);
             }
         );
     // clang-format on
 
     struct gn_lines_device *gl = &state->gl;
 
-    GLuint vs = compile_shader(GL_VERTEX_SHADER, vs_src);
-    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fs_src);
+    GLuint vs = compile_shader(GL_VERTEX_SHADER, blit_vs_src);
+    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, blit_fs_src);
+    gl->blit_program_id = link_program(vs, fs);
+    glDetachShader(gl->blit_program_id, vs);
+    glDetachShader(gl->blit_program_id, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    gl->u_blit_tex = glGetUniformLocation(gl->blit_program_id, "u_tex");
+    glUseProgram(gl->blit_program_id);
+    glUniform1i(gl->u_blit_tex, 0);
+    glGenVertexArrays(1, &gl->blit_vao);
+
+    vs = compile_shader(GL_VERTEX_SHADER, vs_src);
+    fs = compile_shader(GL_FRAGMENT_SHADER, fs_src);
     gl->program_id = link_program(vs, fs);
     glDetachShader(gl->program_id, vs);
     glDetachShader(gl->program_id, fs);
@@ -159,12 +1128,16 @@ void init_gl(struct gn_state *state) {
 
     gl->uniforms.u_resolution =
         glGetUniformLocation(gl->program_id, "u_resolution");
-    gl->uniforms.u_width = glGetUniformLocation(gl->program_id, "u_width");
-    gl->uniforms.u_color = glGetUniformLocation(gl->program_id, "u_color");
+    gl->uniforms.u_origin = glGetUniformLocation(gl->program_id, "u_origin");
+    gl->uniforms.u_alpha = glGetUniformLocation(gl->program_id, "u_alpha");
+    gl->uniforms.u_cull = glGetUniformLocation(gl->program_id, "u_cull");
+    gl->uniforms.u_n_cull = glGetUniformLocation(gl->program_id, "u_n_cull");
 
     gl->attribs.a_pos = glGetAttribLocation(gl->program_id, "a_pos");
     gl->attribs.a_pt1 = glGetAttribLocation(gl->program_id, "a_pt1");
     gl->attribs.a_pt2 = glGetAttribLocation(gl->program_id, "a_pt2");
+    gl->attribs.a_width = glGetAttribLocation(gl->program_id, "a_width");
+    gl->attribs.a_color = glGetAttribLocation(gl->program_id, "a_color");
 
     struct gn_vec3 line_instance[GN_LINES_INSTANCE_SZ] = {
         {0, -0.5, 0}, {0, -0.5, 1}, {0, 0.5, 1},
@@ -186,38 +1159,82 @@ void init_gl(struct gn_state *state) {
     }
 
     glUseProgram(gl->program_id);
-    glGenVertexArrays(1, &gl->vao);
     glGenBuffers(1, &gl->mesh_vbo);
-    glGenBuffers(1, &gl->instance_vbo);
-
-    glBindVertexArray(gl->vao);
-
     glBindBuffer(GL_ARRAY_BUFFER, gl->mesh_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(line_instance), line_instance,
                  GL_STATIC_DRAW);
-    glEnableVertexAttribArray(gl->attribs.a_pos);
-    glVertexAttribPointer(gl->attribs.a_pos, 3, GL_FLOAT, GL_FALSE,
-                          sizeof(struct gn_vec3), 0);
-    glVertexAttribDivisor(gl->attribs.a_pos, 0);
 
-    glBindBuffer(GL_ARRAY_BUFFER, gl->instance_vbo);
-    glBufferData(GL_ARRAY_BUFFER, STROKE_MAX_PTS * sizeof(struct gn_vec2), NULL,
-                 GL_DYNAMIC_DRAW);
-    glEnableVertexAttribArray(gl->attribs.a_pt1);
-    glVertexAttribPointer(gl->attribs.a_pt1, 2, GL_FLOAT, GL_FALSE,
-                          sizeof(struct gn_vec2), 0);
-    glVertexAttribDivisor(gl->attribs.a_pt1, 1);
+    vs = compile_shader(GL_VERTEX_SHADER, curve_vs_src);
+    fs = compile_shader(GL_FRAGMENT_SHADER, fs_src);
+    gl->curve_program_id = link_program(vs, fs);
+    glDetachShader(gl->curve_program_id, vs);
+    glDetachShader(gl->curve_program_id, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLuint curve_program = gl->curve_program_id;
+    gl->curve_uniforms.u_resolution =
+        glGetUniformLocation(curve_program, "u_resolution");
+    gl->curve_uniforms.u_origin =
+        glGetUniformLocation(curve_program, "u_origin");
+    gl->curve_uniforms.u_alpha = glGetUniformLocation(curve_program, "u_alpha");
+    gl->curve_uniforms.u_tolerance =
+        glGetUniformLocation(curve_program, "u_tolerance");
+    gl->curve_uniforms.u_max_lines =
+        glGetUniformLocation(curve_program, "u_max_lines");
+
+    gl->curve_attribs.a_pos = glGetAttribLocation(curve_program, "a_pos");
+    gl->curve_attribs.a_pts[0] = glGetAttribLocation(curve_program, "a_p0");
+    gl->curve_attribs.a_pts[1] = glGetAttribLocation(curve_program, "a_p1");
+    gl->curve_attribs.a_pts[2] = glGetAttribLocation(curve_program, "a_p2");
+    gl->curve_attribs.a_pts[3] = glGetAttribLocation(curve_program, "a_p3");
+    gl->curve_attribs.a_width = glGetAttribLocation(curve_program, "a_width");
+    gl->curve_attribs.a_color = glGetAttribLocation(curve_program, "a_color");
+
+    // x is the index of the line end along the curve and z the side of the
+    // ribbon, the caps reuse the line caps in the frame of the end's tangent
+    struct gn_vec3 curve_instance[GN_CURVES_INSTANCE_SZ];
+    ptr = 0;
+    for (size_t i = 0; i < GN_CURVES_MAX_LINES; i++) {
+        float k0 = i, k1 = i + 1;
+        curve_instance[ptr++] = (struct gn_vec3){k0, 0, -0.5};
+        curve_instance[ptr++] = (struct gn_vec3){k1, 0, -0.5};
+        curve_instance[ptr++] = (struct gn_vec3){k1, 0, 0.5};
+        curve_instance[ptr++] = (struct gn_vec3){k0, 0, -0.5};
+        curve_instance[ptr++] = (struct gn_vec3){k1, 0, 0.5};
+        curve_instance[ptr++] = (struct gn_vec3){k0, 0, 0.5};
+    }
+    for (size_t i = 6; i < GN_LINES_INSTANCE_SZ; i++) {
+        struct gn_vec3 v = line_instance[i];
+        curve_instance[ptr++] =
+            (struct gn_vec3){v.z == 0.f ? -1.f : -2.f, v.x, v.y};
+    }
+
+    glUseProgram(curve_program);
+    glUniform1f(gl->curve_uniforms.u_max_lines, GN_CURVES_MAX_LINES);
+    glGenBuffers(1, &gl->curve_mesh_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, gl->curve_mesh_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(curve_instance), curve_instance,
+                 GL_STATIC_DRAW);
 
-    glEnableVertexAttribArray(gl->attribs.a_pt2);
-    glVertexAttribPointer(
-        gl->attribs.a_pt2, 2, GL_FLOAT, GL_FALSE, sizeof(struct gn_vec2),
-        (void *)sizeof(struct gn_vec2)); // start one vec2 later
-    glVertexAttribDivisor(gl->attribs.a_pt2, 1);
+    init_instance_buffer(gl, &gl->store, false, GN_LINES_INIT_INSTANCES,
+                         GL_STATIC_DRAW);
+    init_instance_buffer(gl, &gl->curve_store, true, GN_CURVES_INIT_INSTANCES,
+                         GL_STATIC_DRAW);
+    wl_list_init(&gl->streams);
+
+    if (has_gl_extension("GL_EXT_buffer_storage")) {
+        gl->buffer_storage = (PFNGLBUFFERSTORAGEEXTPROC)eglGetProcAddress(
+            "glBufferStorageEXT");
+    }
 
     glEnable(GL_BLEND);
     glBlendFuncSeparate(GL_SRC_ALPHA, GL_ZERO, GL_ONE, GL_ONE);
     glBlendEquationSeparate(GL_FUNC_ADD, GL_MAX);
     glEnable(GL_MULTISAMPLE);
+
+    // strokes may have been created before the first configure
+    rebuild_store(state);
 }
 
 void cleanup_gl(struct gn_state *state) {
@@ -225,40 +1242,144 @@ void cleanup_gl(struct gn_state *state) {
 
     glUseProgram(0);
     glDeleteProgram(gl->program_id);
+    glDeleteProgram(gl->curve_program_id);
+    glDeleteProgram(gl->blit_program_id);
+    glDeleteVertexArrays(1, &gl->blit_vao);
     glDeleteBuffers(1, &gl->mesh_vbo);
-    glDeleteBuffers(1, &gl->instance_vbo);
-    glDeleteVertexArrays(1, &gl->vao);
+    glDeleteBuffers(1, &gl->curve_mesh_vbo);
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        cleanup_canvas_cache(&output->cache);
+    }
+    cleanup_instance_buffer(&gl->store);
+    cleanup_instance_buffer(&gl->curve_store);
+    free(gl->batches);
+    struct gn_stream *stream, *stream_tmp;
+    wl_list_for_each_safe(stream, stream_tmp, &gl->streams, link) {
+        free(stream);
+    }
+    free_stream_storage(gl);
+    for (size_t i = 0; i < GN_STREAM_COPIES; i++) {
+        glDeleteSync(gl->fences[i]);
+    }
+    free(gl->scratch);
+    *gl = (struct gn_lines_device){0};
 }
 
-void render(struct gn_state *state) {
+static void draw_cache(struct gn_state *state, struct gn_output *output) {
     struct gn_lines_device *gl = &state->gl;
 
-    float buf[4];
-    unpack_rgba_i32_premul(state->bg_colors[state->active], buf);
+    // the cache already contains the background, so copy it unblended
+    glDisable(GL_BLEND);
+    glUseProgram(gl->blit_program_id);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, output->cache.tex);
+    glBindVertexArray(gl->blit_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEnable(GL_BLEND);
+}
 
-    // glClearColor wants premultiplied alpha values
-    glClearColor(buf[0], buf[1], buf[2], buf[3]);
-    glClear(GL_COLOR_BUFFER_BIT);
+// scissor y grows upwards
+static void scissor_rect(struct gn_output *output, struct gn_box box) {
+    struct gn_box rect = buffer_rect(output, box);
+    glScissor(rect.pos.x, output->buffer_height - (rect.pos.y + rect.size.y),
+              rect.size.x, rect.size.y);
+}
+
+// redraws only the damaged rects
+static void draw_damaged(struct gn_state *state, struct gn_output *output,
+                         const struct gn_damage *damage, size_t copy) {
+    struct gn_lines_device *gl = &state->gl;
+
+    glEnable(GL_SCISSOR_TEST);
+    struct gn_box bounds = {0};
+    GLfloat cull[GN_DAMAGE_MAX_RECTS * 4];
+    for (size_t i = 0; i < damage->n_rects; i++) {
+        struct gn_box rect = damage->rects[i];
+        scissor_rect(output, rect);
+        draw_cache(state, output);
+        bounds = gn_box_union(bounds, rect);
+        cull[i * 4 + 0] = output->x + rect.pos.x;
+        cull[i * 4 + 1] = output->y + rect.pos.y;
+        cull[i * 4 + 2] = output->x + rect.pos.x + rect.size.x;
+        cull[i * 4 + 3] = output->y + rect.pos.y + rect.size.y;
+    }
+    // every stroke in progress at once, the segments off the rects are left
+    // out by the vertex shader. a stroke replaces the color of what it is
+    // drawn over, so drawing it again between the rects changes nothing.
+    scissor_rect(output, bounds);
+    glUseProgram(gl->program_id);
+    glUniform4fv(gl->uniforms.u_cull, damage->n_rects, cull);
+    glUniform1i(gl->uniforms.u_n_cull, damage->n_rects);
+    draw_instances(gl, &gl->stream, copy * gl->stream.c_instances,
+                   gl->stream.n_instances);
+    glUniform1i(gl->uniforms.u_n_cull, 0);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+void render(struct gn_state *state, struct gn_output *output,
+            const struct gn_damage *damage) {
+    struct gn_lines_device *gl = &state->gl;
+
+    GLint target;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
 
     glUseProgram(gl->program_id);
-    glBindVertexArray(gl->vao);
-    glUniform2f(gl->uniforms.u_resolution, (float)state->output.width,
-                (float)state->output.height);
-
-    glBindBuffer(GL_ARRAY_BUFFER, gl->instance_vbo);
-    for (size_t i = 0; i < state->n_strokes; i++) {
-        // printf("stroke %zu has n_pts %zu reported pts %zu\n", i,
-        //        state->strokes[i].n_pts, state->strokes[i].pts_reported);
-        struct gn_stroke *stroke = &state->strokes[i];
-
-        unpack_rgba_i32(stroke->color, buf);
-        glUniform4f(gl->uniforms.u_color, buf[0], buf[1], buf[2],
-                    state->active ? 1.0 : 0.3);
-        glUniform1f(gl->uniforms.u_width, stroke->width);
-
-        glBufferSubData(GL_ARRAY_BUFFER, 0,
-                        stroke->n_pts * sizeof(struct gn_vec2), stroke->pts);
-        glDrawArraysInstanced(GL_TRIANGLES, 0, GN_LINES_INSTANCE_SZ,
-                              stroke->n_pts - 1);
+    glUniform2f(gl->uniforms.u_resolution, (float)output->width,
+                (float)output->height);
+    glUniform2f(gl->uniforms.u_origin, (float)output->x, (float)output->y);
+    glUniform1f(gl->uniforms.u_alpha, state->active ? 1.0 : 0.3);
+    glUseProgram(gl->curve_program_id);
+    glUniform2f(gl->curve_uniforms.u_resolution, (float)output->width,
+                (float)output->height);
+    glUniform2f(gl->curve_uniforms.u_origin, (float)output->x,
+                (float)output->y);
+    glUniform1f(gl->curve_uniforms.u_alpha, state->active ? 1.0 : 0.3);
+    // curves are flattened to the tolerance in buffer pixels
+    glUniform1f(gl->curve_uniforms.u_tolerance,
+                STROKE_FLATTEN_TOLERANCE * output->width /
+                    output->buffer_width);
+    update_cache(state, output);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+    size_t copy = gl->frame % GN_STREAM_COPIES;
+    if (gl->fences[copy] != NULL) {
+        glClientWaitSync(gl->fences[copy], GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GN_FENCE_TIMEOUT_NS);
+        glDeleteSync(gl->fences[copy]);
+        gl->fences[copy] = NULL;
+    }
+    pack_streams(gl);
+    // the strokes on other outputs too, so what is drawn of them is never
+    // left behind in a copy
+    struct gn_seat *seat;
+    wl_list_for_each(seat, &state->seats, link) {
+        struct gn_stroke *stroke =
+            stroke_table_get(&state->strokes, seat->cur_stroke);
+        if (stroke) {
+            bool tail = seat->has_tail && stroke->n_pts > 0;
+            sync_stream(gl, stroke, tail ? &seat->tail : NULL, copy);
+        }
+        for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+            struct gn_touch *touch = &seat->touches[i];
+            stroke = touch->active
+                         ? stroke_table_get(&state->strokes, touch->stroke)
+                         : NULL;
+            if (stroke) {
+                sync_stream(gl, stroke, NULL, copy);
+            }
+        }
+    }
+    gl->stream.n_instances = sweep_streams(gl, copy);
+
+    if (damage->full) {
+        draw_cache(state, output);
+        draw_instances(gl, &gl->stream, copy * gl->stream.c_instances,
+                       gl->stream.n_instances);
+    } else {
+        draw_damaged(state, output, damage, copy);
     }
+
+    gl->fences[copy] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->frame++;
 }
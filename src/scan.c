@@ -0,0 +1,209 @@
+#include <stdbool.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GN_SCAN_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GN_SCAN_NEON
+#endif
+
+#define GN_SCAN_MAX_KERNELS 4
+
+// the products are rounded before they are subtracted, as in the vector
+// kernels, rather than fused by the compiler
+static inline float scan_cross_sq(struct gn_vec2 p, struct gn_vec2 a,
+                                  struct gn_vec2 ab) {
+    float ux = p.x - a.x;
+    float uy = p.y - a.y;
+    float l = ab.x * uy;
+    float r = ab.y * ux;
+    float c = l - r;
+    return c * c;
+}
+
+// carries on from max over pts[i, n)
+static struct gn_scan_max scan_tail(const struct gn_vec2 *pts, uint32_t i,
+                                    uint32_t n, struct gn_vec2 a,
+                                    struct gn_vec2 ab, struct gn_scan_max max) {
+    for (; i < n; i++) {
+        float cross_sq = scan_cross_sq(pts[i], a, ab);
+        if (cross_sq > max.cross_sq) {
+            max = (struct gn_scan_max){cross_sq, i};
+        }
+    }
+    return max;
+}
+
+static struct gn_scan_max scan_scalar(const struct gn_vec2 *pts, uint32_t n,
+                                      struct gn_vec2 a, struct gn_vec2 b) {
+    return scan_tail(pts, 0, n, a, gn_vec2_minus(b, a),
+                     (struct gn_scan_max){0.f, UINT32_MAX});
+}
+
+#if defined(GN_SCAN_X86) || defined(GN_SCAN_NEON)
+// every lane keeps the first of its points with the largest cross_sq, the
+// first of the lanes' is the first of all of them. lanes that never moved
+// off zero hold UINT32_MAX.
+static struct gn_scan_max scan_merge(const float *cross_sq,
+                                     const uint32_t *index, size_t n_lanes) {
+    struct gn_scan_max max = {0.f, UINT32_MAX};
+    for (size_t l = 0; l < n_lanes; l++) {
+        if (cross_sq[l] > max.cross_sq ||
+            (cross_sq[l] == max.cross_sq && index[l] < max.index)) {
+            max = (struct gn_scan_max){cross_sq[l], index[l]};
+        }
+    }
+    return max;
+}
+#endif
+
+#ifdef GN_SCAN_X86
+__attribute__((target("sse2"))) static struct gn_scan_max
+scan_sse2(const struct gn_vec2 *pts, uint32_t n, struct gn_vec2 a,
+          struct gn_vec2 b) {
+    struct gn_vec2 ab = gn_vec2_minus(b, a);
+    __m128 ax = _mm_set1_ps(a.x), ay = _mm_set1_ps(a.y);
+    __m128 dx = _mm_set1_ps(ab.x), dy = _mm_set1_ps(ab.y);
+    __m128 max = _mm_setzero_ps();
+    __m128i max_i = _mm_set1_epi32(-1);
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // two points per load, split into the xs and the ys of four
+        __m128 lo = _mm_loadu_ps(&pts[i].x);
+        __m128 hi = _mm_loadu_ps(&pts[i + 2].x);
+        __m128 x = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 y = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 l = _mm_mul_ps(dx, _mm_sub_ps(y, ay));
+        __m128 r = _mm_mul_ps(dy, _mm_sub_ps(x, ax));
+        __m128 c = _mm_sub_ps(l, r);
+        c = _mm_mul_ps(c, c);
+
+        __m128 gt = _mm_cmpgt_ps(c, max);
+        __m128i gt_i = _mm_castps_si128(gt);
+        max = _mm_or_ps(_mm_and_ps(gt, c), _mm_andnot_ps(gt, max));
+        max_i = _mm_or_si128(_mm_and_si128(gt_i, idx),
+                             _mm_andnot_si128(gt_i, max_i));
+        idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    }
+
+    float lanes[4];
+    uint32_t lanes_i[4];
+    _mm_storeu_ps(lanes, max);
+    _mm_storeu_si128((__m128i *)lanes_i, max_i);
+    return scan_tail(pts, i, n, a, ab, scan_merge(lanes, lanes_i, 4));
+}
+
+__attribute__((target("avx2"))) static struct gn_scan_max
+scan_avx2(const struct gn_vec2 *pts, uint32_t n, struct gn_vec2 a,
+          struct gn_vec2 b) {
+    struct gn_vec2 ab = gn_vec2_minus(b, a);
+    __m256 ax = _mm256_set1_ps(a.x), ay = _mm256_set1_ps(a.y);
+    __m256 dx = _mm256_set1_ps(ab.x), dy = _mm256_set1_ps(ab.y);
+    __m256 max = _mm256_setzero_ps();
+    __m256i max_i = _mm256_set1_epi32(-1);
+    // the shuffles work within each half, which leaves the points in this
+    // order
+    __m256i idx = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 lo = _mm256_loadu_ps(&pts[i].x);
+        __m256 hi = _mm256_loadu_ps(&pts[i + 4].x);
+        __m256 x = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 y = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256 l = _mm256_mul_ps(dx, _mm256_sub_ps(y, ay));
+        __m256 r = _mm256_mul_ps(dy, _mm256_sub_ps(x, ax));
+        __m256 c = _mm256_sub_ps(l, r);
+        c = _mm256_mul_ps(c, c);
+
+        __m256 gt = _mm256_cmp_ps(c, max, _CMP_GT_OQ);
+        max = _mm256_blendv_ps(max, c, gt);
+        max_i = _mm256_blendv_epi8(max_i, idx, _mm256_castps_si256(gt));
+        idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+    }
+
+    float lanes[8];
+    uint32_t lanes_i[8];
+    _mm256_storeu_ps(lanes, max);
+    _mm256_storeu_si256((__m256i *)lanes_i, max_i);
+    return scan_tail(pts, i, n, a, ab, scan_merge(lanes, lanes_i, 8));
+}
+#endif
+
+#ifdef GN_SCAN_NEON
+static struct gn_scan_max scan_neon(const struct gn_vec2 *pts, uint32_t n,
+                                    struct gn_vec2 a, struct gn_vec2 b) {
+    struct gn_vec2 ab = gn_vec2_minus(b, a);
+    float32x4_t ax = vdupq_n_f32(a.x), ay = vdupq_n_f32(a.y);
+    float32x4_t dx = vdupq_n_f32(ab.x), dy = vdupq_n_f32(ab.y);
+    float32x4_t max = vdupq_n_f32(0.f);
+    uint32x4_t max_i = vdupq_n_u32(UINT32_MAX);
+    static const uint32_t idx_init[4] = {0, 1, 2, 3};
+    uint32x4_t idx = vld1q_u32(idx_init);
+
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // loads four points split into their xs and ys
+        float32x4x2_t p = vld2q_f32(&pts[i].x);
+        float32x4_t l = vmulq_f32(dx, vsubq_f32(p.val[1], ay));
+        float32x4_t r = vmulq_f32(dy, vsubq_f32(p.val[0], ax));
+        float32x4_t c = vsubq_f32(l, r);
+        c = vmulq_f32(c, c);
+
+        uint32x4_t gt = vcgtq_f32(c, max);
+        max = vbslq_f32(gt, c, max);
+        max_i = vbslq_u32(gt, idx, max_i);
+        idx = vaddq_u32(idx, vdupq_n_u32(4));
+    }
+
+    float lanes[4];
+    uint32_t lanes_i[4];
+    vst1q_f32(lanes, max);
+    vst1q_u32(lanes_i, max_i);
+    return scan_tail(pts, i, n, a, ab, scan_merge(lanes, lanes_i, 4));
+}
+#endif
+
+size_t scan_kernels(const struct gn_scan_kernel **kernels) {
+    static struct gn_scan_kernel supported[GN_SCAN_MAX_KERNELS];
+    static size_t n_supported;
+    if (n_supported == 0) {
+        supported[n_supported++] =
+            (struct gn_scan_kernel){"scalar", scan_scalar};
+#ifdef GN_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) {
+            supported[n_supported++] =
+                (struct gn_scan_kernel){"sse2", scan_sse2};
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            supported[n_supported++] =
+                (struct gn_scan_kernel){"avx2", scan_avx2};
+        }
+#endif
+#ifdef GN_SCAN_NEON
+        // every cpu the build targets has it
+        supported[n_supported++] = (struct gn_scan_kernel){"neon", scan_neon};
+#endif
+    }
+    *kernels = supported;
+    return n_supported;
+}
+
+// strokes are only extended on the main thread, so picking the kernel on
+// the first call needs no lock
+struct gn_scan_max scan_line(const struct gn_vec2 *pts, uint32_t n,
+                             struct gn_vec2 a, struct gn_vec2 b) {
+    static gn_scan_fn *fn;
+    if (fn == NULL) {
+        const struct gn_scan_kernel *kernels;
+        size_t n_kernels = scan_kernels(&kernels);
+        fn = kernels[n_kernels - 1].fn;
+    }
+    return fn(pts, n, a, b);
+}
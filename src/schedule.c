@@ -0,0 +1,116 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "glassnote.h"
+#include "schedule.h"
+#include "stats.h"
+
+void init_schedule(struct gn_frame_schedule *schedule) {
+    *schedule = (struct gn_frame_schedule){0};
+    schedule->timer_fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (schedule->timer_fd < 0) {
+        fprintf(stderr, "Failed to create frame timer, frames are drawn as "
+                        "soon as the compositor asks\n");
+    }
+}
+
+// how long before the vblank a frame is started
+static uint64_t schedule_margin(struct gn_frame_schedule *schedule) {
+    uint64_t longest = 0;
+    for (size_t i = 0; i < schedule->n_render; i++) {
+        if (schedule->render_ns[i] > longest) {
+            longest = schedule->render_ns[i];
+        }
+    }
+    return longest + longest / 4 + GN_SCHEDULE_SLACK_NS;
+}
+
+bool schedule_frame(struct gn_output *output, bool follows) {
+    struct gn_frame_schedule *schedule = &output->schedule;
+    struct gn_stats *stats = &output->state->stats;
+    // without a vsynced presentation to go by, or a render time to leave,
+    // there is no deadline to wait for
+    if (schedule->timer_fd < 0 || stats->clock != CLOCK_MONOTONIC ||
+        schedule->vblank_ns == 0 || schedule->refresh_ns == 0 ||
+        schedule->n_render == 0) {
+        return false;
+    }
+    uint64_t now = stats_now(stats);
+    uint64_t margin = schedule_margin(schedule);
+    if (now > schedule->vblank_ns + GN_SCHEDULE_MAX_AGE_NS ||
+        margin >= schedule->refresh_ns) {
+        return false;
+    }
+
+    // the first vblank the frame can still make
+    uint64_t vblank = schedule->vblank_ns;
+    if (now + margin >= vblank) {
+        vblank += ((now + margin - vblank) / schedule->refresh_ns + 1) *
+                  schedule->refresh_ns;
+    }
+    uint64_t start = vblank - margin;
+    struct itimerspec spec = {
+        .it_value = {start / 1000000000, start % 1000000000},
+    };
+    if (timerfd_settime(schedule->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) <
+        0) {
+        return false;
+    }
+    schedule->armed = true;
+    // the frame takes the timer over
+    schedule->idle = false;
+    schedule->follows = follows;
+    return true;
+}
+
+bool frame_due(struct gn_frame_schedule *schedule, bool *idle) {
+    uint64_t expirations;
+    *idle = false;
+    if (read(schedule->timer_fd, &expirations, sizeof(expirations)) !=
+        sizeof(expirations)) {
+        return false;
+    }
+    *idle = schedule->idle;
+    schedule->idle = false;
+    return schedule->armed;
+}
+
+void schedule_idle(struct gn_frame_schedule *schedule, uint64_t delay_ns) {
+    if (schedule->timer_fd < 0 || schedule->armed) {
+        return;
+    }
+    struct itimerspec spec = {
+        .it_value = {delay_ns / 1000000000, delay_ns % 1000000000},
+    };
+    schedule->idle = timerfd_settime(schedule->timer_fd, 0, &spec, NULL) == 0;
+}
+
+void cancel_idle(struct gn_frame_schedule *schedule) {
+    if (!schedule->idle) {
+        return;
+    }
+    // disarming also drops an expiration not read yet
+    struct itimerspec spec = {0};
+    timerfd_settime(schedule->timer_fd, 0, &spec, NULL);
+    schedule->idle = false;
+}
+
+void schedule_rendered(struct gn_frame_schedule *schedule, uint64_t render_ns) {
+    schedule->render_ns[schedule->render_pos] = render_ns;
+    schedule->render_pos = (schedule->render_pos + 1) % GN_SCHEDULE_WINDOW;
+    if (schedule->n_render < GN_SCHEDULE_WINDOW) {
+        schedule->n_render++;
+    }
+}
+
+void cleanup_schedule(struct gn_frame_schedule *schedule) {
+    if (schedule->timer_fd >= 0) {
+        close(schedule->timer_fd);
+    }
+}
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,38 +10,384 @@
 
 #include "cursor-shape-v1-client-protocol.h"
 #include "glassnote.h"
+#include "grid.h"
+#include "history.h"
+#include "predict.h"
+#include "render.h"
 #include "seat.h"
+#include "stats.h"
 #include "stroke.h"
+#include "table.h"
+#include "trace.h"
 
-static void seat_handle_pressed(struct gn_seat *seat) {
-    if (seat->cur_stroke != NULL) {
+// erases what the eraser touches on its way from a to b
+static void seat_erase(struct gn_seat *seat, struct gn_vec2 a,
+                       struct gn_vec2 b) {
+    struct gn_state *state = seat->state;
+    struct gn_grid *grid = &state->grid;
+    size_t n_hits = grid_hit_test(state, a, b, state->eraser_radius);
+
+    // hits are grouped by stroke
+    for (size_t i = 0, j = 0; i < n_hits; i = j) {
+        uint32_t ind = grid->hits[i].stroke;
+        for (j = i + 1; j < n_hits && grid->hits[j].stroke == ind; j++) {
+        }
+        if (state->tool == GN_TOOL_PIXEL_ERASER) {
+            cut_stroke(state, ind, &grid->hits[i], j - i, a, b,
+                       state->eraser_radius);
+        } else {
+            history_erase(state, stroke_table_at(&state->strokes, ind));
+        }
+    }
+}
+
+// the stroke the seat is drawing, if it still exists
+static struct gn_stroke *seat_stroke(struct gn_seat *seat) {
+    return stroke_table_get(&seat->state->strokes, seat->cur_stroke);
+}
+
+void seat_handle_pressed(struct gn_seat *seat) {
+    if (seat_stroke(seat) != NULL || seat->erasing) {
         return;
     }
     struct gn_state *state = seat->state;
-    seat->cur_stroke = create_stroke(state, state->cur_stroke_width,
-                                     state->colors[state->color_ind]);
+    if (state->tool != GN_TOOL_PEN) {
+        // everything erased until release is undone at once
+        seat->erasing = true;
+        history_begin(state);
+        seat_erase(seat, seat->pointer_loc, seat->pointer_loc);
+        return;
+    }
+    struct gn_stroke *stroke = create_stroke(state, state->cur_stroke_width,
+                                             state->colors[state->color_ind]);
+    if (stroke != NULL) {
+        stroke->keep_input = state->fit_curves;
+        seat->cur_stroke = stroke->handle;
+    }
 }
 
-static void seat_handle_moved(struct gn_seat *seat) {
-    if (seat->cur_stroke == NULL) {
+// moves the pointer from prev_loc through pts
+static void seat_move(struct gn_seat *seat, struct gn_vec2 prev_loc,
+                      const struct gn_vec2 *pts, size_t n) {
+    if (seat->erasing) {
+        for (size_t i = 0; i < n; i++) {
+            seat_erase(seat, prev_loc, pts[i]);
+            prev_loc = pts[i];
+        }
+        return;
+    }
+    struct gn_stroke *stroke = seat_stroke(seat);
+    if (stroke == NULL) {
         return;
     }
-    extend_stroke(seat->cur_stroke, seat->pointer_loc.x, seat->pointer_loc.y);
-    set_output_dirty(seat->state);
+    struct gn_box damage = {0};
+    for (size_t i = 0; i < n; i++) {
+        extend_stroke(stroke, pts[i].x, pts[i].y, &damage);
+    }
+    index_stroke(seat->state, stroke);
+    damage_output(seat->state, damage);
 }
 
-static void seat_handle_released(struct gn_seat *seat) {
-    if (seat->cur_stroke == NULL) {
+void seat_handle_moved(struct gn_seat *seat, struct gn_vec2 prev_loc) {
+    seat_move(seat, prev_loc, &seat->pointer_loc, 1);
+}
+
+void seat_handle_motions(struct gn_seat *seat, const struct gn_vec2 *pts,
+                         size_t n) {
+    if (n == 0) {
         return;
     }
-    finish_stroke(seat->cur_stroke);
-    seat->cur_stroke = NULL;
+    struct gn_vec2 prev_loc = seat->pointer_loc;
+    seat->pointer_loc = pts[n - 1];
+    seat_move(seat, prev_loc, pts, n);
+}
+
+// ends a stroke the pointer or a touch point drew, as a step of the history
+static void seat_finish_stroke(struct gn_state *state,
+                               struct gn_stroke *stroke) {
+    // strokes finish on top of those finished while they were drawn, so the
+    // z order is the order they are uploaded in
+    stroke_table_raise(&state->strokes, stroke);
+    struct gn_box damage = {0};
+    finish_stroke(stroke, &damage);
+    if (state->fit_curves) {
+        // the fit rewrites segments that were indexed while drawing
+        unindex_stroke(state, stroke);
+        fit_stroke(stroke, &damage);
+    }
+    index_stroke(state, stroke);
+    upload_stroke(state, stroke);
+    history_add(state, stroke);
+    damage_output(state, damage);
+}
+
+void seat_handle_released(struct gn_seat *seat) {
+    if (seat->erasing) {
+        seat->erasing = false;
+        history_end(seat->state);
+    }
+    struct gn_stroke *stroke = seat_stroke(seat);
+    seat->cur_stroke = (struct gn_stroke_handle){0};
+    if (stroke != NULL) {
+        seat_finish_stroke(seat->state, stroke);
+    }
+}
+
+// the touch point of id that is down, if it was not left out
+static struct gn_touch *seat_touch(struct gn_seat *seat, int32_t id) {
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        struct gn_touch *touch = &seat->touches[i];
+        if (touch->active && !touch->up && touch->id == id) {
+            return touch;
+        }
+    }
+    return NULL;
+}
+
+// appends pt to a queue of positions, false if there is no memory for it
+static bool push_motion(struct gn_vec2 **motions, size_t *n, size_t *c,
+                        struct gn_vec2 pt) {
+    if (*n == *c) {
+        size_t new_c = *c == 0 ? GN_SEAT_INIT_MOTIONS : *c * 2;
+        struct gn_vec2 *new_motions =
+            realloc(*motions, new_c * sizeof(struct gn_vec2));
+        if (new_motions == NULL) {
+            return false;
+        }
+        *motions = new_motions;
+        *c = new_c;
+    }
+    (*motions)[(*n)++] = pt;
+    return true;
+}
+
+static bool touch_push(struct gn_touch *touch, struct gn_vec2 pt) {
+    return push_motion(&touch->motions, &touch->n_motions, &touch->c_motions,
+                       pt);
+}
+
+// clears the slot of touch, keeping its queue for the next point
+static void reset_touch(struct gn_touch *touch) {
+    *touch = (struct gn_touch){
+        .motions = touch->motions,
+        .c_motions = touch->c_motions,
+    };
+}
+
+void seat_handle_touch_down(struct gn_seat *seat, int32_t id,
+                            struct gn_vec2 pt) {
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        struct gn_touch *touch = &seat->touches[i];
+        if (!touch->active) {
+            reset_touch(touch);
+            // the stroke starts at the first position queued
+            if (touch_push(touch, pt)) {
+                touch->active = true;
+                touch->id = id;
+                touch->down = true;
+            }
+            return;
+        }
+    }
+}
+
+void seat_handle_touch_motion(struct gn_seat *seat, int32_t id,
+                              struct gn_vec2 pt) {
+    struct gn_touch *touch = seat_touch(seat, id);
+    if (touch != NULL) {
+        touch_push(touch, pt);
+    }
+}
+
+void seat_handle_touch_up(struct gn_seat *seat, int32_t id) {
+    struct gn_touch *touch = seat_touch(seat, id);
+    if (touch != NULL) {
+        touch->up = true;
+    }
+}
+
+// extends the stroke of touch through pts, or erases on the way there
+static void seat_touch_move(struct gn_seat *seat, struct gn_touch *touch,
+                            const struct gn_vec2 *pts, size_t n) {
+    struct gn_state *state = seat->state;
+    if (n == 0) {
+        return;
+    }
+    struct gn_vec2 prev_loc = touch->loc;
+    touch->loc = pts[n - 1];
+    if (touch->erasing) {
+        for (size_t i = 0; i < n; i++) {
+            seat_erase(seat, prev_loc, pts[i]);
+            prev_loc = pts[i];
+        }
+        return;
+    }
+    struct gn_stroke *stroke = stroke_table_get(&state->strokes, touch->stroke);
+    if (stroke == NULL) {
+        return;
+    }
+    struct gn_box damage = {0};
+    for (size_t i = 0; i < n; i++) {
+        extend_stroke(stroke, pts[i].x, pts[i].y, &damage);
+    }
+    index_stroke(state, stroke);
+    // one box per touch point per frame, not per position
+    damage_output(state, damage);
+}
+
+// what seat_handle_pressed does for the pointer
+static void seat_touch_start(struct gn_seat *seat, struct gn_touch *touch) {
+    struct gn_state *state = seat->state;
+    touch->loc = touch->motions[0];
+    if (state->tool != GN_TOOL_PEN) {
+        // erased with the other points down as one step
+        touch->erasing = true;
+        history_begin(state);
+    } else {
+        struct gn_stroke *stroke = create_stroke(
+            state, state->cur_stroke_width, state->colors[state->color_ind]);
+        if (stroke == NULL) {
+            return;
+        }
+        stroke->keep_input = state->fit_curves;
+        touch->stroke = stroke->handle;
+    }
+}
+
+static void seat_touch_end(struct gn_seat *seat, struct gn_touch *touch) {
+    if (touch->erasing) {
+        history_end(seat->state);
+    }
+    struct gn_stroke *stroke =
+        stroke_table_get(&seat->state->strokes, touch->stroke);
+    reset_touch(touch);
+    if (stroke != NULL) {
+        seat_finish_stroke(seat->state, stroke);
+    }
+}
+
+void seat_handle_touch_frame(struct gn_seat *seat) {
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        struct gn_touch *touch = &seat->touches[i];
+        if (!touch->active) {
+            continue;
+        }
+        if (touch->down) {
+            seat_touch_start(seat, touch);
+        }
+        seat_touch_move(seat, touch, touch->motions, touch->n_motions);
+        touch->down = false;
+        touch->n_motions = 0;
+        if (touch->up) {
+            seat_touch_end(seat, touch);
+        }
+    }
+}
+
+// what seat_touch_end does when the compositor takes the point over, which
+// takes its stroke off the canvas instead of finishing it
+static void seat_touch_drop(struct gn_seat *seat, struct gn_touch *touch) {
+    if (touch->erasing) {
+        history_end(seat->state);
+    }
+    struct gn_stroke *stroke =
+        stroke_table_get(&seat->state->strokes, touch->stroke);
+    reset_touch(touch);
+    if (stroke != NULL) {
+        // not in the history or the journal yet, only streamed
+        remove_stroke(seat->state, stroke);
+    }
+}
+
+void seat_handle_touch_cancel(struct gn_seat *seat) {
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        struct gn_touch *touch = &seat->touches[i];
+        if (touch->active) {
+            seat_touch_drop(seat, touch);
+        }
+    }
+}
+
+void seat_sample_motion(struct gn_seat *seat, uint64_t time_us,
+                        uint64_t arrival_ns, struct gn_vec2 pt) {
+    predictor_add(&seat->predictor, time_us, pt);
+    seat->moved_ns = arrival_ns;
+}
+
+static bool seat_predict(struct gn_seat *seat, struct gn_output *output,
+                         uint64_t now_ns) {
+    struct gn_state *state = seat->state;
+    struct gn_stroke *stroke = seat_stroke(seat);
+    struct gn_box box = {0};
+    seat->has_tail = stroke != NULL && stroke->n_pts > 0 &&
+                     state->predict_ms > 0.f && now_ns >= seat->moved_ns &&
+                     now_ns - seat->moved_ns < GN_PREDICT_IDLE_NS &&
+                     predictor_predict(&seat->predictor, state->predict_ms,
+                                       &seat->tail);
+    if (seat->has_tail) {
+        box = gn_box_from_segment(*stroke_pt(stroke, stroke->n_pts - 1),
+                                  seat->tail, stroke_damage_pad(stroke));
+    }
+    damage_frame(state, output, seat->tail_box);
+    damage_frame(state, output, box);
+    seat->tail_box = box;
+    return !gn_box_is_empty(gn_box_intersect(box, output_box(output)));
+}
+
+bool predict_tails(struct gn_state *state, struct gn_output *output,
+                   uint64_t now_ns) {
+    bool drawn = false;
+    struct gn_seat *seat;
+    wl_list_for_each(seat, &state->seats, link) {
+        drawn |= seat_predict(seat, output, now_ns);
+    }
+    return drawn;
+}
+
+static void adjust_size(struct gn_state *state, float delta) {
+    if (state->tool == GN_TOOL_PEN) {
+        state->cur_stroke_width =
+            fminf(fmaxf(state->cur_stroke_width + delta, STROKE_MIN_WIDTH),
+                  STROKE_MAX_WIDTH);
+    } else {
+        state->eraser_radius =
+            fminf(fmaxf(state->eraser_radius + delta * 2.f,
+                        GN_ERASER_MIN_RADIUS),
+                  GN_ERASER_MAX_RADIUS);
+    }
+}
+
+static void toggle_tool(struct gn_seat *seat, enum gn_tool tool) {
+    struct gn_state *state = seat->state;
+    seat_handle_released(seat);
+    state->tool = state->tool == tool ? GN_TOOL_PEN : tool;
+}
+
+// the output whose overlay surface is, if it is still there
+static struct gn_output *surface_output(struct gn_state *state,
+                                        struct wl_surface *surface) {
+    struct gn_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (output->surface == surface) {
+            return output;
+        }
+    }
+    return NULL;
+}
+
+// moves a position relative to output into the global space
+static void to_global(struct gn_output *output, wl_fixed_t *x, wl_fixed_t *y) {
+    if (output != NULL) {
+        *x += wl_fixed_from_int(output->x);
+        *y += wl_fixed_from_int(output->y);
+    }
 }
 
 static void pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
                                  uint32_t serial, struct wl_surface *surface,
                                  wl_fixed_t surface_x, wl_fixed_t surface_y) {
     struct gn_seat *seat = data;
+    seat->pointer_output = surface_output(seat->state, surface);
 
     // TODO: support compositors without shape manager
     struct wp_cursor_shape_device_v1 *device =
@@ -51,21 +398,67 @@ static void pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
     wp_cursor_shape_device_v1_destroy(device);
 }
 
+// hands the motion of the pointer frame to the stroke code at once
+static void seat_flush_motions(struct gn_seat *seat) {
+    if (seat->n_motions == 0) {
+        return;
+    }
+    struct gn_stats *stats = &seat->state->stats;
+    stats_begin_input(stats, seat->motion_ns);
+    seat_handle_motions(seat, seat->motions, seat->n_motions);
+    stats_end_input(stats);
+    seat->n_motions = 0;
+}
+
+static bool seat_add_motion(struct gn_seat *seat, struct gn_vec2 pt) {
+    if (seat->n_motions == 0) {
+        seat->motion_ns = stats_now(&seat->state->stats);
+    }
+    return push_motion(&seat->motions, &seat->n_motions, &seat->c_motions,
+                       pt);
+}
+
 static void pointer_handle_motion(void *data, struct wl_pointer *wl_pointer,
                                   uint32_t time, wl_fixed_t surface_x,
                                   wl_fixed_t surface_y) {
     struct gn_seat *seat = data;
+    // positions are kept in the global space
+    wl_fixed_t x = surface_x, y = surface_y;
+    to_global(seat->pointer_output, &x, &y);
+    trace_motion(seat, x, y);
 
-    seat->pointer_loc.x = wl_fixed_to_double(surface_x);
-    seat->pointer_loc.y = wl_fixed_to_double(surface_y);
-    seat_handle_moved(seat);
+    struct gn_vec2 pt = {wl_fixed_to_double(x), wl_fixed_to_double(y)};
+    if (seat->state->predict_ms > 0.f) {
+        // ms timestamps wrap around every 49 days
+        uint32_t dt_ms = time - seat->motion_time;
+        seat->motion_us += (uint64_t)dt_ms * 1000;
+        seat->motion_time = time;
+        seat_sample_motion(seat, seat->motion_us,
+                           stats_now(&seat->state->stats), pt);
+    }
+    if (!seat_add_motion(seat, pt)) {
+        // the motion so far is handled to make room
+        seat_flush_motions(seat);
+        if (!seat_add_motion(seat, pt)) {
+            fprintf(stderr, "Failed to allocate memory for pointer motion\n");
+            return;
+        }
+    }
+    // pointers before version 5 send no frame events
+    if (wl_pointer_get_version(wl_pointer) < WL_POINTER_FRAME_SINCE_VERSION) {
+        seat_flush_motions(seat);
+    }
 }
 
 static void pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
                                   uint32_t serial, uint32_t time,
                                   uint32_t button, uint32_t button_state) {
     struct gn_seat *seat = data;
+    trace_button(seat, button, button_state);
+    // the motion before the button in the same frame comes first
+    seat_flush_motions(seat);
 
+    stats_begin_input(&seat->state->stats, stats_now(&seat->state->stats));
     switch (button_state) {
     case WL_POINTER_BUTTON_STATE_PRESSED:
         seat_handle_pressed(seat);
@@ -74,6 +467,11 @@ static void pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
         seat_handle_released(seat);
         break;
     }
+    stats_end_input(&seat->state->stats);
+}
+
+static void pointer_handle_frame(void *data, struct wl_pointer *wl_pointer) {
+    seat_flush_motions(data);
 }
 
 static const struct wl_pointer_listener pointer_listener = {
@@ -82,6 +480,94 @@ static const struct wl_pointer_listener pointer_listener = {
     .motion = pointer_handle_motion,
     .button = pointer_handle_button,
     .axis = noop,
+    .frame = pointer_handle_frame,
+    .axis_source = noop,
+    .axis_stop = noop,
+    .axis_discrete = noop,
+};
+
+// keeps when the touch frame being received started
+static void touch_arrived(struct gn_seat *seat) {
+    if (seat->touch_ns == 0) {
+        seat->touch_ns = stats_now(&seat->state->stats);
+    }
+}
+
+static void touch_handle_down(void *data, struct wl_touch *wl_touch,
+                              uint32_t serial, uint32_t time,
+                              struct wl_surface *surface, int32_t id,
+                              wl_fixed_t surface_x, wl_fixed_t surface_y) {
+    struct gn_seat *seat = data;
+    struct gn_output *output = surface_output(seat->state, surface);
+    wl_fixed_t x = surface_x, y = surface_y;
+    to_global(output, &x, &y);
+    trace_touch(seat, GN_TRACE_TOUCH_DOWN, id, x, y);
+
+    touch_arrived(seat);
+    struct gn_vec2 pt = {wl_fixed_to_double(x), wl_fixed_to_double(y)};
+    seat_handle_touch_down(seat, id, pt);
+    struct gn_touch *touch = seat_touch(seat, id);
+    if (touch != NULL) {
+        touch->output = output;
+    }
+}
+
+static void touch_handle_up(void *data, struct wl_touch *wl_touch,
+                            uint32_t serial, uint32_t time, int32_t id) {
+    struct gn_seat *seat = data;
+    trace_touch_up(seat, id);
+    touch_arrived(seat);
+    seat_handle_touch_up(seat, id);
+}
+
+static void touch_handle_motion(void *data, struct wl_touch *wl_touch,
+                                uint32_t time, int32_t id,
+                                wl_fixed_t surface_x, wl_fixed_t surface_y) {
+    struct gn_seat *seat = data;
+    struct gn_touch *touch = seat_touch(seat, id);
+    if (touch == NULL) {
+        return;
+    }
+    wl_fixed_t x = surface_x, y = surface_y;
+    to_global(touch->output, &x, &y);
+    trace_touch(seat, GN_TRACE_TOUCH_MOTION, id, x, y);
+
+    touch_arrived(seat);
+    struct gn_vec2 pt = {wl_fixed_to_double(x), wl_fixed_to_double(y)};
+    seat_handle_touch_motion(seat, id, pt);
+}
+
+static void touch_handle_frame(void *data, struct wl_touch *wl_touch) {
+    struct gn_seat *seat = data;
+    trace_touch_frame(seat, GN_TRACE_TOUCH_FRAME);
+    if (seat->touch_ns == 0) {
+        return;
+    }
+    struct gn_stats *stats = &seat->state->stats;
+    stats_begin_input(stats, seat->touch_ns);
+    seat_handle_touch_frame(seat);
+    stats_end_input(stats);
+    seat->touch_ns = 0;
+}
+
+static void touch_handle_cancel(void *data, struct wl_touch *wl_touch) {
+    struct gn_seat *seat = data;
+    trace_touch_frame(seat, GN_TRACE_TOUCH_CANCEL);
+    struct gn_stats *stats = &seat->state->stats;
+    stats_begin_input(stats, stats_now(stats));
+    seat_handle_touch_cancel(seat);
+    stats_end_input(stats);
+    seat->touch_ns = 0;
+}
+
+static const struct wl_touch_listener touch_listener = {
+    .down = touch_handle_down,
+    .up = touch_handle_up,
+    .motion = touch_handle_motion,
+    .frame = touch_handle_frame,
+    .cancel = touch_handle_cancel,
+    .shape = noop,
+    .orientation = noop,
 };
 
 static void keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard,
@@ -110,54 +596,70 @@ static void keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard,
     seat->xkb_state = xkb_state_new(seat->xkb_keymap);
 }
 
+void seat_finish_drawing(struct gn_seat *seat) {
+    // positions queued for frames that have not ended are drawn first
+    seat_flush_motions(seat);
+    seat_handle_touch_frame(seat);
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        struct gn_touch *touch = &seat->touches[i];
+        if (touch->active) {
+            seat_touch_end(seat, touch);
+        }
+    }
+    seat_handle_released(seat);
+}
+
+void seat_handle_key(struct gn_seat *seat, uint32_t keysym) {
+    struct gn_state *state = seat->state;
+    switch (keysym) {
+    case XKB_KEY_Escape:
+        seat_handle_released(seat);
+        state->running = false;
+        break;
+    case XKB_KEY_1:
+    case XKB_KEY_2:
+    case XKB_KEY_3:
+    case XKB_KEY_4:
+    case XKB_KEY_5:
+        state->color_ind = (keysym & 0xF) - 1;
+        break;
+    case XKB_KEY_minus:
+    case XKB_KEY_q:
+        adjust_size(state, -1.f);
+        break;
+    case XKB_KEY_equal:
+    case XKB_KEY_w:
+        adjust_size(state, 1.f);
+        break;
+    case XKB_KEY_e:
+        toggle_tool(seat, GN_TOOL_ERASER);
+        break;
+    case XKB_KEY_x:
+        toggle_tool(seat, GN_TOOL_PIXEL_ERASER);
+        break;
+    case XKB_KEY_z:
+        seat_handle_released(seat);
+        history_undo(state);
+        break;
+    case XKB_KEY_Z:
+        seat_handle_released(seat);
+        history_redo(state);
+        break;
+    }
+}
+
 static void keyboard_handle_key(void *data, struct wl_keyboard *wl_keyboard,
                                 const uint32_t serial, const uint32_t time,
                                 const uint32_t key, const uint32_t key_state) {
     struct gn_seat *seat = data;
-    struct gn_state *state = seat->state;
     const xkb_keysym_t keysym =
         xkb_state_key_get_one_sym(seat->xkb_state, key + 8);
+    trace_key(seat, keysym, key_state);
 
-    switch (key_state) {
-    case WL_KEYBOARD_KEY_STATE_PRESSED:
-        switch (keysym) {
-        case XKB_KEY_Escape:
-            seat_handle_released(seat);
-            state->running = false;
-            break;
-        case XKB_KEY_1:
-        case XKB_KEY_2:
-        case XKB_KEY_3:
-        case XKB_KEY_4:
-        case XKB_KEY_5:
-            state->color_ind = (keysym & 0xF) - 1;
-            break;
-        case XKB_KEY_minus:
-        case XKB_KEY_q:
-            state->cur_stroke_width =
-                state->cur_stroke_width - 1.f < STROKE_MIN_WIDTH
-                    ? STROKE_MIN_WIDTH
-                    : state->cur_stroke_width - 1.f;
-            break;
-        case XKB_KEY_equal:
-        case XKB_KEY_w:
-            state->cur_stroke_width =
-                state->cur_stroke_width + 1.f > STROKE_MAX_WIDTH
-                    ? STROKE_MAX_WIDTH
-                    : state->cur_stroke_width + 1.f;
-            break;
-        case XKB_KEY_z:
-            seat_handle_released(seat);
-            if (state->n_strokes >= 1) {
-                destroy_stroke(&state->strokes[state->n_strokes - 1]);
-                state->n_strokes--;
-                set_output_dirty(state);
-            }
-            break;
-        }
-
-    case WL_KEYBOARD_KEY_STATE_RELEASED:
-        break;
+    if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+        // the pointer frame may still be open, its motion comes first
+        seat_flush_motions(seat);
+        seat_handle_key(seat, keysym);
     }
 }
 
@@ -177,6 +679,7 @@ static const struct wl_keyboard_listener keyboard_listener = {
     .leave = noop,
     .key = keyboard_handle_key,
     .modifiers = keyboard_handle_modifiers,
+    .repeat_info = noop,
 };
 
 static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
@@ -193,12 +696,13 @@ static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
     }
     if (capabilities & WL_SEAT_CAPABILITY_TOUCH) {
         seat->wl_touch = wl_seat_get_touch(wl_seat);
-        // TODO: listener
+        wl_touch_add_listener(seat->wl_touch, &touch_listener, seat);
     }
 }
 
 static const struct wl_seat_listener seat_listener = {
     .capabilities = seat_handle_capabilities,
+    .name = noop,
 };
 
 void create_seat(struct gn_state *state, struct wl_seat *wl_seat) {
@@ -210,6 +714,7 @@ void create_seat(struct gn_state *state, struct wl_seat *wl_seat) {
 
     seat->state = state;
     seat->wl_seat = wl_seat;
+    seat->id = wl_list_length(&state->seats);
     seat->wl_pointer = NULL;
     seat->wl_keyboard = NULL;
     seat->wl_touch = NULL;
@@ -229,8 +734,15 @@ void destroy_seat(struct gn_seat *seat) {
     if (seat->wl_touch) {
         wl_touch_destroy(seat->wl_touch);
     }
+    free(seat->motions);
+    for (size_t i = 0; i < GN_SEAT_MAX_TOUCHES; i++) {
+        free(seat->touches[i].motions);
+    }
     xkb_state_unref(seat->xkb_state);
     xkb_keymap_unref(seat->xkb_keymap);
-    wl_seat_destroy(seat->wl_seat);
+    // seats of a replayed trace have no wl_seat
+    if (seat->wl_seat) {
+        wl_seat_destroy(seat->wl_seat);
+    }
     free(seat);
 }
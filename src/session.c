@@ -0,0 +1,321 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "glassnote.h"
+#include "session.h"
+#include "stroke.h"
+#include "table.h"
+
+static size_t put_varint(uint8_t *p, int32_t v) {
+    uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+    size_t n = 0;
+    while (z >= 0x80) {
+        p[n++] = (uint8_t)(z | 0x80);
+        z >>= 7;
+    }
+    p[n++] = (uint8_t)z;
+    return n;
+}
+
+static int32_t quantize(float v) {
+    float q = roundf(v * GN_SESSION_QUANT);
+    // strokes never get near the range of an int32, but points are floats
+    if (!(q > -2147483520.f)) {
+        return INT32_MIN;
+    }
+    return q >= 2147483520.f ? INT32_MAX : (int32_t)q;
+}
+
+// stroke->bbox leaves the damage margin around the extent a file stores
+static struct gn_box add_bbox_margin(struct gn_stroke *stroke,
+                                     struct gn_box box, float sign) {
+    float m = sign * (stroke_damage_pad(stroke) - stroke->width * 0.5f);
+    return gn_box_from_corners(box.pos.x - m, box.pos.y - m,
+                               box.pos.x + box.size.x + m,
+                               box.pos.y + box.size.y + m);
+}
+
+size_t encode_session_points(struct gn_stroke *stroke, uint8_t *data,
+                             struct gn_box *bbox) {
+    // a stroke that was loaded is saved as it was
+    if (stroke->packed != NULL) {
+        *bbox = add_bbox_margin(stroke, stroke->bbox, -1.f);
+        memcpy(data, stroke->packed, stroke->n_packed);
+        return stroke->n_packed;
+    }
+
+    size_t n = 0;
+    int32_t px = 0, py = 0;
+    float pad = stroke->width * 0.5f;
+    *bbox = (struct gn_box){0};
+    struct gn_stroke_pos pos = {stroke->head, 0};
+    for (size_t i = 0; i < stroke->n_pts; i++, stroke_pos_next(&pos)) {
+        struct gn_vec2 pt = *stroke_pos_pt(pos);
+        int32_t x = quantize(pt.x), y = quantize(pt.y);
+        n += put_varint(&data[n], (int32_t)((uint32_t)x - (uint32_t)px));
+        n += put_varint(&data[n], (int32_t)((uint32_t)y - (uint32_t)py));
+        px = x;
+        py = y;
+        // the extent of the points as they will be loaded
+        struct gn_vec2 q = {(float)x / GN_SESSION_QUANT,
+                            (float)y / GN_SESSION_QUANT};
+        *bbox = gn_box_union(*bbox, gn_box_from_segment(q, q, pad));
+    }
+    return n;
+}
+
+uint8_t *encode_session(struct gn_state *state, size_t *size) {
+    size_t n_strokes = 0, max_bytes = 0;
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        if (session_keeps_stroke(stroke)) {
+            n_strokes++;
+            max_bytes += stroke->n_pts * GN_SESSION_MAX_PT_BYTES;
+        }
+    }
+    if (n_strokes > UINT32_MAX) {
+        fprintf(stderr, "Failed to save session, too many strokes\n");
+        return NULL;
+    }
+
+    size_t index_sz = GN_SESSION_HEADER_SZ + n_strokes * GN_SESSION_ENTRY_SZ;
+    uint8_t *file = malloc(index_sz + max_bytes);
+    if (file == NULL) {
+        fprintf(stderr, "Failed to allocate memory to save session\n");
+        return NULL;
+    }
+
+    memcpy(file, GN_SESSION_MAGIC, 4);
+    put_u32(&file[4], GN_SESSION_VERSION);
+    put_u32(&file[8], n_strokes);
+    put_u32(&file[12], GN_SESSION_QUANT);
+    uint8_t *entry = &file[GN_SESSION_HEADER_SZ];
+    size_t n = index_sz;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        if (!session_keeps_stroke(stroke)) {
+            continue;
+        }
+        struct gn_box bbox;
+        size_t n_bytes = encode_session_points(stroke, &file[n], &bbox);
+        put_u64(&entry[0], n);
+        put_u32(&entry[8], stroke->n_pts);
+        put_u32(&entry[12], n_bytes);
+        put_f32(&entry[16], bbox.pos.x);
+        put_f32(&entry[20], bbox.pos.y);
+        put_f32(&entry[24], bbox.size.x);
+        put_f32(&entry[28], bbox.size.y);
+        put_f32(&entry[32], stroke->width);
+        put_u32(&entry[36], (uint32_t)stroke->color);
+        put_u32(&entry[40], stroke->curved ? GN_SESSION_FLAG_CURVED : 0);
+        entry += GN_SESSION_ENTRY_SZ;
+        n += n_bytes;
+    }
+    *size = n;
+    return file;
+}
+
+bool write_session(const char *path, const uint8_t *data, size_t size) {
+    // written next to the old session, which is only replaced once the new
+    // one is complete
+    char *tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if (tmp_path == NULL) {
+        fprintf(stderr, "Failed to allocate memory to save session\n");
+        return false;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return false;
+    }
+    bool ok = fwrite(data, 1, size, file) == size && fflush(file) == 0 &&
+              fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (ok && rename(tmp_path, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to save session to %s: %s\n", path,
+                strerror(errno));
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return ok;
+}
+
+bool save_session(struct gn_state *state, const char *path) {
+    size_t size;
+    uint8_t *file = encode_session(state, &size);
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = write_session(path, file, size);
+    free(file);
+    return ok;
+}
+
+// every point is two varints, each ending in the one byte of it without the
+// high bit, the points are only decoded once the stroke is unpacked
+static bool check_points(const uint8_t *data, size_t n_bytes, size_t n_pts) {
+    size_t n_ends = 0, i = 0;
+    // eight bytes at a time, their cleared high bits summed by the multiply
+    for (; i + 8 <= n_bytes; i += 8) {
+        uint64_t w;
+        memcpy(&w, &data[i], sizeof(w));
+        uint64_t ends = (~w & 0x8080808080808080u) >> 7;
+        n_ends += ends * 0x0101010101010101u >> 56;
+    }
+    for (; i < n_bytes; i++) {
+        n_ends += data[i] < 0x80;
+    }
+    return n_ends == 2 * n_pts && data[n_bytes - 1] < 0x80;
+}
+
+static bool sound_bbox(struct gn_box box) {
+    return isfinite(box.pos.x) && isfinite(box.pos.y) &&
+           isfinite(box.size.x) && isfinite(box.size.y) &&
+           !gn_box_is_empty(box);
+}
+
+struct gn_stroke *load_session_stroke(struct gn_state *state,
+                                      struct gn_session_stroke s) {
+    // every point takes at least two bytes
+    if (s.n_pts == 0 || s.n_pts > s.n_bytes / 2 ||
+        s.n_bytes > s.n_pts * GN_SESSION_MAX_PT_BYTES ||
+        !(s.width >= STROKE_MIN_WIDTH) || !(s.width <= STROKE_MAX_WIDTH) ||
+        ((s.flags & GN_SESSION_FLAG_CURVED) && (s.n_pts - 1) % 3 != 0) ||
+        !check_points(s.data, s.n_bytes, s.n_pts)) {
+        return NULL;
+    }
+
+    struct gn_stroke *stroke = create_stroke(state, s.width, s.color);
+    if (stroke == NULL) {
+        return NULL;
+    }
+    stroke->packed = s.data;
+    stroke->n_packed = s.n_bytes;
+    stroke->n_pts = s.n_pts;
+    stroke->seg_st = s.n_pts - 1;
+    stroke->finished = true;
+    stroke->curved = s.flags & GN_SESSION_FLAG_CURVED;
+    if (sound_bbox(s.bbox)) {
+        stroke->bbox = add_bbox_margin(stroke, s.bbox, 1.f);
+    } else {
+        // the extent is taken from the points once
+        if (!unpack_stroke(stroke)) {
+            remove_stroke(state, stroke);
+            return NULL;
+        }
+        repack_stroke(stroke);
+    }
+    return stroke;
+}
+
+enum gn_session_load load_session(struct gn_state *state, const char *path,
+                                  uint32_t *n_entries) {
+    if (n_entries != NULL) {
+        *n_entries = 0;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return GN_SESSION_LOADED;
+        }
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return GN_SESSION_UNREADABLE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < GN_SESSION_HEADER_SZ) {
+        fprintf(stderr, "Failed to load session %s\n", path);
+        close(fd);
+        return GN_SESSION_UNREADABLE;
+    }
+    size_t size = st.st_size;
+    const uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return GN_SESSION_UNREADABLE;
+    }
+
+    // the strokes are read from the file as they are unpacked
+    state->session_map = (struct gn_file_map){file, size};
+    return load_session_data(state, file, size, path, n_entries);
+}
+
+void cleanup_session_maps(struct gn_state *state) {
+    struct gn_file_map *maps[] = {&state->session_map, &state->journal_map};
+    for (size_t i = 0; i < sizeof(maps) / sizeof(*maps); i++) {
+        if (maps[i]->data != NULL) {
+            munmap((void *)maps[i]->data, maps[i]->size);
+        }
+        *maps[i] = (struct gn_file_map){0};
+    }
+}
+
+enum gn_session_load load_session_data(struct gn_state *state,
+                                       const uint8_t *file, size_t size,
+                                       const char *name, uint32_t *n_entries) {
+    if (n_entries != NULL) {
+        *n_entries = 0;
+    }
+    if (size < GN_SESSION_HEADER_SZ ||
+        memcmp(file, GN_SESSION_MAGIC, 4) != 0 ||
+        get_u32(&file[4]) != GN_SESSION_VERSION ||
+        get_u32(&file[12]) != GN_SESSION_QUANT) {
+        fprintf(stderr, "Failed to load session %s, unknown format\n", name);
+        return GN_SESSION_UNREADABLE;
+    }
+    size_t n_strokes = get_u32(&file[8]);
+    if (n_strokes > (size - GN_SESSION_HEADER_SZ) / GN_SESSION_ENTRY_SZ) {
+        fprintf(stderr, "Failed to load session %s, truncated\n", name);
+        return GN_SESSION_UNREADABLE;
+    }
+    if (n_entries != NULL) {
+        *n_entries = n_strokes;
+    }
+
+    bool ok = true;
+    const uint8_t *entry = &file[GN_SESSION_HEADER_SZ];
+    for (size_t i = 0; i < n_strokes; i++, entry += GN_SESSION_ENTRY_SZ) {
+        uint64_t offset = get_u64(&entry[0]);
+        size_t n_bytes = get_u32(&entry[12]);
+        if (offset > size || n_bytes > size - offset) {
+            ok = false;
+            continue;
+        }
+        struct gn_session_stroke s = {
+            .data = &file[offset],
+            .n_bytes = n_bytes,
+            .n_pts = get_u32(&entry[8]),
+            .bbox = {{get_f32(&entry[16]), get_f32(&entry[20])},
+                     {get_f32(&entry[24]), get_f32(&entry[28])}},
+            .width = get_f32(&entry[32]),
+            .color = (int32_t)get_u32(&entry[36]),
+            .flags = get_u32(&entry[40]),
+        };
+        struct gn_stroke *stroke = load_session_stroke(state, s);
+        if (stroke == NULL) {
+            ok = false;
+            continue;
+        }
+        // the journal names the strokes of a snapshot by their entry, which
+        // holds even if some before them were not loaded
+        stroke->journal_id = i + 1;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to load some strokes of session %s\n", name);
+        return GN_SESSION_PARTIAL;
+    }
+    return GN_SESSION_LOADED;
+}
@@ -0,0 +1,175 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "glassnote.h"
+#include "presentation-time-client-protocol.h"
+#include "stats.h"
+
+// a frame waiting for its presentation feedback
+struct gn_frame_feedback {
+    struct gn_output *output;
+    struct wp_presentation_feedback *feedback;
+    // of the input the frame shows, 0 if it shows none
+    uint64_t input_ns;
+    bool follows;
+    struct wl_list link; // gn_output::feedback
+};
+
+static size_t histogram_bucket(uint64_t value) {
+    if (value < GN_HISTOGRAM_SUB) {
+        return value;
+    }
+    // value has e + 1 bits, the 3 below the top one pick the sub bucket
+    int e = 63 - __builtin_clzll(value);
+    size_t bucket = (size_t)(e - 2) * GN_HISTOGRAM_SUB +
+                    ((value >> (e - 3)) & (GN_HISTOGRAM_SUB - 1));
+    return bucket < GN_HISTOGRAM_BUCKETS ? bucket : GN_HISTOGRAM_BUCKETS - 1;
+}
+
+// the largest value that goes in bucket
+static uint64_t histogram_bucket_end(size_t bucket) {
+    if (bucket < GN_HISTOGRAM_SUB) {
+        return bucket;
+    }
+    if (bucket == GN_HISTOGRAM_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    int e = bucket / GN_HISTOGRAM_SUB + 2;
+    uint64_t sub = bucket % GN_HISTOGRAM_SUB;
+    return ((GN_HISTOGRAM_SUB + sub + 1) << (e - 3)) - 1;
+}
+
+void histogram_add(struct gn_histogram *hist, uint64_t value) {
+    hist->counts[histogram_bucket(value)]++;
+    hist->n++;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+uint64_t histogram_percentile(const struct gn_histogram *hist, double p) {
+    if (hist->n == 0) {
+        return 0;
+    }
+    uint64_t rank = ceil(p * hist->n);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < GN_HISTOGRAM_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank && seen > 0) {
+            uint64_t end = histogram_bucket_end(i);
+            return end < hist->max ? end : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void init_stats(struct gn_state *state) {
+    state->stats.clock = CLOCK_MONOTONIC;
+}
+
+uint64_t stats_now(struct gn_stats *stats) {
+    struct timespec ts;
+    clock_gettime((clockid_t)stats->clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_begin_input(struct gn_stats *stats, uint64_t event_ns) {
+    stats->event_ns = event_ns;
+}
+
+void stats_end_input(struct gn_stats *stats) { stats->event_ns = 0; }
+
+void stats_rendered(struct gn_stats *stats, uint64_t render_ns) {
+    histogram_add(&stats->render, render_ns / 1000);
+}
+
+static void frame_feedback_destroy(struct gn_frame_feedback *frame) {
+    wp_presentation_feedback_destroy(frame->feedback);
+    wl_list_remove(&frame->link);
+    free(frame);
+}
+
+static void frame_feedback_handle_presented(
+    void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi,
+    uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi,
+    uint32_t seq_lo, uint32_t flags) {
+    struct gn_frame_feedback *frame = data;
+    struct gn_stats *stats = &frame->output->state->stats;
+    struct gn_frame_schedule *schedule = &frame->output->schedule;
+    uint64_t present_ns =
+        ((uint64_t)tv_sec_hi << 32 | tv_sec_lo) * 1000000000 + tv_nsec;
+
+    stats->n_presented++;
+    if (frame->input_ns != 0 && present_ns > frame->input_ns) {
+        histogram_add(&stats->latency, (present_ns - frame->input_ns) / 1000);
+    }
+    // a frame drawn as soon as the one before it was shown should be shown
+    // one refresh after it
+    if (frame->follows && schedule->last_present_ns != 0 && refresh != 0 &&
+        present_ns > schedule->last_present_ns) {
+        uint64_t cycles =
+            (present_ns - schedule->last_present_ns + refresh / 2) / refresh;
+        if (cycles > 1) {
+            stats->n_missed += cycles - 1;
+        }
+    }
+    schedule->last_present_ns = present_ns;
+    if ((flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC) && refresh != 0) {
+        schedule->vblank_ns = present_ns;
+        schedule->refresh_ns = refresh;
+    }
+    frame_feedback_destroy(frame);
+}
+
+static void
+frame_feedback_handle_discarded(void *data,
+                                struct wp_presentation_feedback *feedback) {
+    struct gn_frame_feedback *frame = data;
+    frame->output->state->stats.n_discarded++;
+    // the next frame has nothing to be measured against
+    frame->output->schedule.last_present_ns = 0;
+    frame_feedback_destroy(frame);
+}
+
+static const struct wp_presentation_feedback_listener
+    frame_feedback_listener = {
+        .sync_output = noop,
+        .presented = frame_feedback_handle_presented,
+        .discarded = frame_feedback_handle_discarded,
+};
+
+void request_feedback(struct gn_output *output, bool follows) {
+    struct gn_state *state = output->state;
+    uint64_t input_ns = output->input_ns;
+    output->input_ns = 0;
+    if (state->presentation == NULL) {
+        return;
+    }
+
+    struct gn_frame_feedback *frame = malloc(sizeof(*frame));
+    if (frame == NULL) {
+        fprintf(stderr, "Failed to allocate memory for frame feedback\n");
+        return;
+    }
+    struct wl_surface *surface = output->surface;
+    *frame = (struct gn_frame_feedback){
+        .output = output,
+        .feedback = wp_presentation_feedback(state->presentation, surface),
+        .input_ns = input_ns,
+        .follows = follows,
+    };
+    wp_presentation_feedback_add_listener(frame->feedback,
+                                          &frame_feedback_listener, frame);
+    wl_list_insert(output->feedback.prev, &frame->link);
+}
+
+void cleanup_feedback(struct gn_output *output) {
+    struct gn_frame_feedback *frame, *tmp;
+    wl_list_for_each_safe(frame, tmp, &output->feedback, link) {
+        frame_feedback_destroy(frame);
+    }
+}
@@ -1,106 +1,951 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "glassnote.h"
+#include "grid.h"
+#include "history.h"
+#include "pool.h"
+#include "scan.h"
+#include "session.h"
 #include "stroke.h"
+#include "table.h"
 #include "utils.h"
 
 #define STROKE_SIMPLIFICATION_THRESHOLD 1.5f
+// antialiasing may touch pixels just outside of the stroke's width
+#define STROKE_DAMAGE_MARGIN 1.f
+// pieces left by the eraser shorter than this are dropped
+#define STROKE_CUT_MIN_LENGTH 0.01f
+#define STROKE_PI 3.14159265358979323846
+// directions this close to the edge of the wedge are checked exactly
+#define STROKE_WEDGE_MARGIN 1e-7
+// fitted curves stay this close to the input, flattening adds its tolerance
+#define STROKE_FIT_ERROR 0.75f
+// the input is sampled at least this densely before fitting
+#define STROKE_FIT_SPACING 2.f
+// turns sharper than this, as the cosine of the angle, are kept as corners
+#define STROKE_FIT_CORNER_COS 0.5f
+// turns are measured over this much input on either side, so the staircase
+// of integer positions is not mistaken for corners
+#define STROKE_FIT_CORNER_SPAN 4.f
+#define STROKE_FIT_ITERATIONS 4
+#define STROKE_INIT_INPUT 64
 
-struct gn_stroke *create_stroke(struct gn_state *state, double width,
-                                int32_t color) {
-    if (state->n_strokes == state->c_strokes) {
-        state->c_strokes *= 2;
-        state->strokes = realloc(state->strokes,
-                                 state->c_strokes * sizeof(struct gn_stroke));
+float stroke_damage_pad(struct gn_stroke *stroke) {
+    return stroke->width * 0.5f + STROKE_DAMAGE_MARGIN;
+}
 
-        if (state->strokes == NULL) {
-            fprintf(stderr, "Failed to allocate memory for more strokes\n");
-            return NULL;
+struct gn_stroke_pos stroke_seek(struct gn_stroke *stroke, size_t i) {
+    size_t target = i / STROKE_CHUNK_PTS;
+    size_t last = (stroke->n_pts - 1) / STROKE_CHUNK_PTS;
+    struct gn_stroke_chunk *chunk;
+    if (target <= last - target) {
+        chunk = stroke->head;
+        for (size_t c = 0; c < target; c++) {
+            chunk = chunk->next;
+        }
+    } else {
+        chunk = stroke->tail;
+        for (size_t c = last; c > target; c--) {
+            chunk = chunk->prev;
         }
     }
+    return (struct gn_stroke_pos){chunk, i % STROKE_CHUNK_PTS};
+}
 
-    struct gn_stroke *stroke = &state->strokes[state->n_strokes];
-    state->n_strokes++;
+static bool stroke_push(struct gn_stroke *stroke, struct gn_vec2 pt) {
+    size_t off = stroke->n_pts % STROKE_CHUNK_PTS;
+    if (off == 0) {
+        struct gn_stroke_chunk *chunk = pool_alloc_chunk(stroke->pool);
+        if (chunk == NULL) {
+            return false;
+        }
+        chunk->prev = stroke->tail;
+        if (stroke->tail != NULL) {
+            stroke->tail->next = chunk;
+        } else {
+            stroke->head = chunk;
+        }
+        stroke->tail = chunk;
+    }
+    stroke->tail->pts[off] = pt;
+    stroke->n_pts++;
+    return true;
+}
 
-    stroke->capacity = STROKE_DEFAULT_CAPACITY;
-    stroke->n_pts = 0;
-    stroke->pts_reported = 0;
-    stroke->width = width;
-    stroke->color = color;
-    stroke->pts = calloc(stroke->capacity, sizeof(struct gn_vec2));
+// drops every point from index n on, giving the chunks left empty back to the
+// pool in one splice
+static void stroke_truncate(struct gn_stroke *stroke, size_t n) {
+    // a packed stroke has no chunks to give back
+    size_t n_chunks =
+        stroke_is_packed(stroke)
+            ? 0
+            : (stroke->n_pts + STROKE_CHUNK_PTS - 1) / STROKE_CHUNK_PTS;
+    size_t keep = (n + STROKE_CHUNK_PTS - 1) / STROKE_CHUNK_PTS;
+    if (n_chunks > keep) {
+        struct gn_stroke_chunk *last = stroke->tail;
+        struct gn_stroke_chunk *first = last;
+        if (keep == 0) {
+            first = stroke->head;
+        } else {
+            for (size_t i = keep + 1; i < n_chunks; i++) {
+                first = first->prev;
+            }
+        }
+        stroke->tail = first->prev;
+        pool_free_chunks(stroke->pool, first, last, n_chunks - keep);
+    }
+    if (stroke->tail != NULL) {
+        stroke->tail->next = NULL;
+    } else {
+        stroke->head = NULL;
+    }
+    stroke->n_pts = n;
+}
+
+// damage of every segment from pts[st] to the end of the stroke
+static struct gn_box stroke_tail_box(struct gn_stroke *stroke, size_t st) {
+    struct gn_box box = {0};
+    float pad = stroke_damage_pad(stroke);
+    struct gn_stroke_pos pos = stroke_seek(stroke, st);
+    for (size_t i = st; i < stroke->n_pts; i++) {
+        struct gn_vec2 pt = *stroke_pos_pt(pos);
+        box = gn_box_union(box, gn_box_from_segment(pt, pt, pad));
+        stroke_pos_next(&pos);
+    }
+    return box;
+}
 
-    if (stroke->pts == NULL) {
-        fprintf(stderr, "Failed to allocate memory for stroke points\n");
+// the equivalent of angle closest to the middle of the wedge, lines through
+// the origin repeat every pi radians
+static double wedge_unwrap(struct gn_stroke_wedge *wedge, double angle) {
+    double mid = (wedge->lo + wedge->hi) * 0.5;
+    return angle - STROKE_PI * round((angle - mid) / STROKE_PI);
+}
+
+// narrows the wedge to the lines passing within the threshold of pt. a line
+// at angle theta is sin(theta - phi) * r away from pt at angle phi and
+// distance r from the origin.
+static void wedge_add(struct gn_stroke_wedge *wedge, struct gn_vec2 pt) {
+    double dx = (double)pt.x - wedge->origin.x;
+    double dy = (double)pt.y - wedge->origin.y;
+    double r = sqrt(dx * dx + dy * dy);
+    // no line through the origin is farther from pt than r
+    if (r < STROKE_SIMPLIFICATION_THRESHOLD * (1. - STROKE_WEDGE_MARGIN)) {
+        return;
+    }
+
+    double phi = atan2(dy, dx);
+    double alpha = asin(fmin(STROKE_SIMPLIFICATION_THRESHOLD / r, 1.));
+    if (!wedge->bounded) {
+        wedge->bounded = true;
+        wedge->lo = phi - alpha;
+        wedge->hi = phi + alpha;
+        return;
+    }
+    // if the other half turn of pt's range also overlaps, it is dropped
+    phi = wedge_unwrap(wedge, phi);
+    wedge->lo = fmax(wedge->lo, phi - alpha);
+    wedge->hi = fmin(wedge->hi, phi + alpha);
+}
+
+// whether the line from the origin to pt surely passes within the threshold
+// of every point in the wedge
+static bool wedge_contains(struct gn_stroke_wedge *wedge, struct gn_vec2 pt) {
+    double dx = (double)pt.x - wedge->origin.x;
+    double dy = (double)pt.y - wedge->origin.y;
+    if (!wedge->bounded || (dx == 0. && dy == 0.)) {
+        return true;
+    }
+    double theta = wedge_unwrap(wedge, atan2(dy, dx));
+    return theta > wedge->lo + STROKE_WEDGE_MARGIN &&
+           theta < wedge->hi - STROKE_WEDGE_MARGIN;
+}
+
+struct gn_stroke *create_stroke(struct gn_state *state, double width,
+                                int32_t color) {
+    struct gn_stroke *stroke = stroke_table_add(&state->strokes);
+    if (stroke == NULL) {
         return NULL;
     }
+    // chunks are taken from the pool as points come in
+    stroke->pool = &state->pool;
+    stroke->width = width;
+    stroke->color = color;
     return stroke;
 }
 
-void extend_stroke(struct gn_stroke *stroke, double x, double y) {
+static void stroke_keep_input(struct gn_stroke *stroke, struct gn_vec2 pt) {
+    if (stroke->n_input == stroke->c_input) {
+        size_t c_input =
+            stroke->c_input == 0 ? STROKE_INIT_INPUT : stroke->c_input * 2;
+        struct gn_vec2 *input =
+            realloc(stroke->input, c_input * sizeof(struct gn_vec2));
+        if (input == NULL) {
+            // the stroke is left as a polyline
+            fprintf(stderr, "Failed to allocate memory for stroke input\n");
+            free(stroke->input);
+            stroke->input = NULL;
+            stroke->n_input = stroke->c_input = 0;
+            stroke->keep_input = false;
+            return;
+        }
+        stroke->input = input;
+        stroke->c_input = c_input;
+    }
+    stroke->input[stroke->n_input++] = pt;
+}
+
+void extend_stroke(struct gn_stroke *stroke, double x, double y,
+                   struct gn_box *damage) {
     stroke->pts_reported++;
+    if (stroke->keep_input) {
+        stroke_keep_input(stroke, (struct gn_vec2){x, y});
+    }
 
-    if (stroke->seg_st + 1 < stroke->n_pts) {
-        struct gn_vec2 n_pt = {x, y};
-        float max_dist = 0.0;
+    struct gn_vec2 n_pt = {x, y};
+    struct gn_box changed = {0};
+    // the open segment is only scanned when it may have to be closed, which
+    // is once per segment unless n_pt lands right on the edge of the wedge
+    if (stroke->seg_st + 1 < stroke->n_pts &&
+        !wedge_contains(&stroke->wedge, n_pt)) {
+        float max_cross_sq = 0.f;
         size_t index = -1;
 
-        for (size_t i = stroke->seg_st + 1; i < stroke->n_pts; i++) {
-            float dist = gn_vec2_perp_dist(stroke->pts[i],
-                                           stroke->pts[stroke->seg_st], n_pt);
-            if (dist > max_dist) {
-                max_dist = dist;
-                index = i;
+        struct gn_stroke_pos pos = stroke_seek(stroke, stroke->seg_st);
+        struct gn_vec2 st_pt = *stroke_pos_pt(pos);
+        stroke_pos_next(&pos);
+        // the points of each chunk are scanned in one run
+        for (size_t i = stroke->seg_st + 1; i < stroke->n_pts;) {
+            size_t n = STROKE_CHUNK_PTS - pos.off;
+            if (n > stroke->n_pts - i) {
+                n = stroke->n_pts - i;
+            }
+            struct gn_scan_max max =
+                scan_line(stroke_pos_pt(pos), n, st_pt, n_pt);
+            if (max.cross_sq > max_cross_sq) {
+                max_cross_sq = max.cross_sq;
+                index = i + max.index;
             }
+            i += n;
+            pos = (struct gn_stroke_pos){pos.chunk->next, 0};
         }
 
-        if (max_dist < STROKE_SIMPLIFICATION_THRESHOLD) {
+        float len_sq = gn_vec2_norm_sq(gn_vec2_minus(n_pt, st_pt));
+        if (max_cross_sq == 0.f ||
+            max_cross_sq < STROKE_SIMPLIFICATION_THRESHOLD *
+                               STROKE_SIMPLIFICATION_THRESHOLD * len_sq) {
             goto add_point;
         }
 
+        // the whole open segment is rewritten
+        changed = stroke_tail_box(stroke, stroke->seg_st);
         stroke->seg_st++;
+        struct gn_stroke_pos dst = stroke_seek(stroke, stroke->seg_st);
+        struct gn_stroke_pos src = stroke_seek(stroke, index);
+        stroke->wedge = (struct gn_stroke_wedge){.origin = *stroke_pos_pt(src)};
         for (size_t i = index; i < stroke->n_pts; i++) {
-            stroke->pts[i - index + stroke->seg_st] = stroke->pts[i];
+            *stroke_pos_pt(dst) = *stroke_pos_pt(src);
+            if (i > index) {
+                wedge_add(&stroke->wedge, *stroke_pos_pt(src));
+            }
+            stroke_pos_next(&dst);
+            stroke_pos_next(&src);
         }
-        stroke->n_pts = stroke->n_pts - index + stroke->seg_st;
+        stroke_truncate(stroke, stroke->n_pts - index + stroke->seg_st);
         // continue to add the point
     }
 
-add_point:
-    if (stroke->n_pts == stroke->capacity) {
-        if (stroke->capacity >= STROKE_MAX_PTS) {
-            fprintf(stderr, "Stroke has too many points\n");
-            return;
+add_point:;
+    float pad = stroke_damage_pad(stroke);
+    struct gn_vec2 prev =
+        stroke->n_pts > 0 ? *stroke_pt(stroke, stroke->n_pts - 1) : n_pt;
+    if (!stroke_push(stroke, n_pt)) {
+        return;
+    }
+    if (stroke->n_pts == 1) {
+        stroke->wedge = (struct gn_stroke_wedge){.origin = n_pt};
+    } else {
+        wedge_add(&stroke->wedge, n_pt);
+    }
+
+    changed = gn_box_union(changed, gn_box_from_segment(prev, n_pt, pad));
+    stroke->bbox =
+        gn_box_union(stroke->bbox, gn_box_from_segment(n_pt, n_pt, pad));
+    if (damage != NULL) {
+        *damage = gn_box_union(*damage, changed);
+    }
+}
+
+void finish_stroke(struct gn_stroke *stroke, struct gn_box *damage) {
+    stroke->finished = true;
+    if (stroke->seg_st + 1 < stroke->n_pts) {
+        if (damage != NULL) {
+            *damage =
+                gn_box_union(*damage, stroke_tail_box(stroke, stroke->seg_st));
+        }
+        stroke->seg_st++;
+        *stroke_pt(stroke, stroke->seg_st) =
+            *stroke_pt(stroke, stroke->n_pts - 1);
+        stroke_truncate(stroke, stroke->seg_st + 1);
+    }
+}
+
+void destroy_stroke(struct gn_stroke *stroke) {
+    if (stroke == NULL) {
+        return;
+    }
+    stroke_truncate(stroke, 0);
+    free(stroke->input);
+    stroke->input = NULL;
+}
+
+void canvas_damage(struct gn_state *state, struct gn_box box) {
+    if (state->canvas_listener != NULL) {
+        state->canvas_listener->damage(state, box);
+    }
+}
+
+void canvas_upload(struct gn_state *state, struct gn_stroke *stroke) {
+    if (state->canvas_listener != NULL) {
+        state->canvas_listener->upload(state, stroke);
+    }
+}
+
+void canvas_discard(struct gn_state *state, struct gn_stroke *stroke) {
+    if (state->canvas_listener != NULL) {
+        state->canvas_listener->discard(state, stroke);
+    }
+}
+
+void remove_stroke(struct gn_state *state, struct gn_stroke *stroke) {
+    canvas_damage(state, stroke->bbox);
+    unindex_stroke(state, stroke);
+    canvas_discard(state, stroke);
+    destroy_stroke(stroke);
+    stroke_table_remove(&state->strokes, stroke);
+}
+
+// narrows [*t0, *t1] to where x0 + t * dx lies in [lo, hi]
+static bool clip_range(float x0, float dx, float lo, float hi, float *t0,
+                       float *t1) {
+    if (dx == 0.f) {
+        return x0 >= lo && x0 <= hi;
+    }
+    float ta = (lo - x0) / dx;
+    float tb = (hi - x0) / dx;
+    *t0 = fmaxf(*t0, fminf(ta, tb));
+    *t1 = fminf(*t1, fmaxf(ta, tb));
+    return *t0 <= *t1;
+}
+
+// range of t where p + t * d lies in the circle
+static bool circle_range(struct gn_vec2 p, struct gn_vec2 d, struct gn_vec2 c,
+                         float r, float *t0, float *t1) {
+    struct gn_vec2 pc = gn_vec2_minus(p, c);
+    float A = gn_vec2_dot(d, d);
+    float B = gn_vec2_dot(d, pc);
+    float C = gn_vec2_dot(pc, pc) - r * r;
+    if (A == 0.f) {
+        *t0 = -INFINITY;
+        *t1 = INFINITY;
+        return C <= 0.f;
+    }
+    float disc = B * B - A * C;
+    if (disc < 0.f) {
+        return false;
+    }
+    float s = sqrtf(disc);
+    *t0 = (-B - s) / A;
+    *t1 = (-B + s) / A;
+    return true;
+}
+
+// part [*t0, *t1] of segment p-q inside the capsule of radius r around a-b.
+// the capsule is convex, so the part inside its two circles and its rectangle
+// is a single range.
+static bool capsule_clip(struct gn_vec2 p, struct gn_vec2 q, struct gn_vec2 a,
+                         struct gn_vec2 b, float r, float *t0, float *t1) {
+    struct gn_vec2 d = gn_vec2_minus(q, p);
+    float lo = INFINITY, hi = -INFINITY;
+    float s0, s1;
+    if (circle_range(p, d, a, r, &s0, &s1)) {
+        lo = fminf(lo, s0);
+        hi = fmaxf(hi, s1);
+    }
+    if (circle_range(p, d, b, r, &s0, &s1)) {
+        lo = fminf(lo, s0);
+        hi = fmaxf(hi, s1);
+    }
+
+    struct gn_vec2 ab = gn_vec2_minus(b, a);
+    float len = gn_vec2_norm(ab);
+    if (len > 0.f) {
+        struct gn_vec2 e = {ab.x / len, ab.y / len};
+        struct gn_vec2 n = {-e.y, e.x};
+        struct gn_vec2 pa = gn_vec2_minus(p, a);
+        s0 = -INFINITY;
+        s1 = INFINITY;
+        if (clip_range(gn_vec2_dot(pa, e), gn_vec2_dot(d, e), 0.f, len, &s0,
+                       &s1) &&
+            clip_range(gn_vec2_dot(pa, n), gn_vec2_dot(d, n), -r, r, &s0,
+                       &s1)) {
+            lo = fminf(lo, s0);
+            hi = fmaxf(hi, s1);
+        }
+    }
+
+    *t0 = fmaxf(lo, 0.f);
+    *t1 = fminf(hi, 1.f);
+    return *t0 < *t1;
+}
+
+static float polyline_length(const struct gn_vec2 *pts, size_t n) {
+    float len = 0.f;
+    for (size_t i = 1; i < n; i++) {
+        len += gn_vec2_norm(gn_vec2_minus(pts[i], pts[i - 1]));
+    }
+    return len;
+}
+
+bool set_stroke_points(struct gn_stroke *stroke, const struct gn_vec2 *pts,
+                       size_t n) {
+    // the points go into chunks of their own first, so that the stroke keeps
+    // the ones it had if memory runs out
+    struct gn_stroke tmp = {.pool = stroke->pool};
+    for (size_t i = 0; i < n; i++) {
+        if (!stroke_push(&tmp, pts[i])) {
+            stroke_truncate(&tmp, 0);
+            return false;
+        }
+    }
+    stroke_truncate(stroke, 0);
+    stroke->head = tmp.head;
+    stroke->tail = tmp.tail;
+    stroke->n_pts = n;
+    stroke->seg_st = n - 1;
+    stroke->finished = true;
+    stroke->curved = false;
+
+    float pad = stroke_damage_pad(stroke);
+    stroke->bbox = (struct gn_box){0};
+    for (size_t i = 0; i < n; i++) {
+        struct gn_box box = gn_box_from_segment(pts[i], pts[i], pad);
+        stroke->bbox = gn_box_union(stroke->bbox, box);
+    }
+    return true;
+}
+
+bool unpack_stroke(struct gn_stroke *stroke) {
+    if (!stroke_is_packed(stroke)) {
+        return true;
+    }
+    size_t n = stroke->n_pts;
+    stroke->n_pts = 0;
+    const uint8_t *p = stroke->packed, *end = p + stroke->n_packed;
+    int32_t x = 0, y = 0;
+    float pad = stroke_damage_pad(stroke);
+    struct gn_box bbox = stroke->bbox;
+    for (size_t i = 0; i < n; i++) {
+        int32_t dx, dy;
+        if (!get_varint(&p, end, &dx) || !get_varint(&p, end, &dy)) {
+            fprintf(stderr, "Failed to unpack stroke, it is corrupt\n");
+            break;
+        }
+        x = (int32_t)((uint32_t)x + (uint32_t)dx);
+        y = (int32_t)((uint32_t)y + (uint32_t)dy);
+        struct gn_vec2 pt = {(float)x / GN_SESSION_QUANT,
+                             (float)y / GN_SESSION_QUANT};
+        if (!stroke_push(stroke, pt)) {
+            fprintf(stderr, "Failed to allocate memory to unpack stroke\n");
+            break;
         }
+        // the stored extent is trusted until the points say otherwise
+        bbox = gn_box_union(bbox, gn_box_from_segment(pt, pt, pad));
+    }
+    if (stroke->n_pts < n) {
+        stroke_truncate(stroke, 0);
+        stroke->n_pts = n;
+        return false;
+    }
+    stroke->bbox = bbox;
+    return true;
+}
+
+void repack_stroke(struct gn_stroke *stroke) {
+    if (stroke->packed == NULL) {
+        return;
+    }
+    size_t n = stroke->n_pts;
+    stroke_truncate(stroke, 0);
+    stroke->n_pts = n;
+}
+
+// fills flat, which is not in the stroke table, with the polyline a curved
+// stroke is drawn with
+static bool flatten_stroke(struct gn_stroke *stroke, struct gn_stroke *flat) {
+    size_t n_cubics = stroke_n_cubics(stroke);
+    struct gn_vec2 *pts =
+        malloc((n_cubics * GN_CUBIC_MAX_LINES + 1) * sizeof(*pts));
+    if (pts == NULL) {
+        fprintf(stderr, "Failed to allocate memory to cut stroke\n");
+        return false;
+    }
+
+    size_t n = 0;
+    struct gn_stroke_pos pos = {stroke->head, 0};
+    pts[n++] = *stroke_pos_pt(pos);
+    for (size_t i = 0; i < n_cubics; i++) {
+        struct gn_vec2 c[4];
+        stroke_pos_cubic(pos, c);
+        n += gn_cubic_flatten(c, STROKE_FLATTEN_TOLERANCE, &pts[n]);
+        for (size_t j = 0; j < 3; j++) {
+            stroke_pos_next(&pos);
+        }
+    }
+
+    *flat = (struct gn_stroke){
+        .pool = stroke->pool,
+        .width = stroke->width,
+        .color = stroke->color,
+    };
+    bool ok = set_stroke_points(flat, pts, n);
+    free(pts);
+    return ok;
+}
 
-        stroke->capacity *= 2;
-        stroke->pts =
-            realloc(stroke->pts, stroke->capacity * sizeof(struct gn_vec2));
+void cut_stroke(struct gn_state *state, size_t ind,
+                const struct gn_grid_entry *hits, size_t n_hits,
+                struct gn_vec2 a, struct gn_vec2 b, float radius) {
+    struct gn_stroke *stroke = stroke_table_at(&state->strokes, ind);
+    float reach = radius + stroke->width * 0.5f;
+    struct gn_vec2 *out = NULL;
+    size_t *piece_ends = NULL;
+
+    // the hits name cubics, every line of the flattened curve is checked.
+    // points are read from src, the stroke itself is kept intact for undo.
+    struct gn_stroke *src = stroke;
+    struct gn_stroke flat = {0};
+    struct gn_grid_entry *lines = NULL;
+    if (stroke->curved) {
+        if (!flatten_stroke(stroke, &flat)) {
+            goto out;
+        }
+        src = &flat;
+        n_hits = src->n_pts - 1;
+        lines = malloc(n_hits * sizeof(*lines));
+        if (lines == NULL) {
+            fprintf(stderr, "Failed to allocate memory to cut stroke\n");
+            goto out;
+        }
+        struct gn_stroke_pos pos = {src->head, 0};
+        for (size_t i = 0; i < n_hits; i++, stroke_pos_next(&pos)) {
+            lines[i] = (struct gn_grid_entry){ind, i, pos.chunk};
+        }
+        hits = lines;
+    }
+
+    // every hit segment adds at most the two points where it is cut
+    out = malloc((src->n_pts + 2 * n_hits) * sizeof(*out));
+    piece_ends = malloc((n_hits + 1) * sizeof(*piece_ends));
+    if (out == NULL || piece_ends == NULL) {
+        fprintf(stderr, "Failed to allocate memory to cut stroke\n");
+        goto out;
+    }
+
+    // segments that were not hit are copied over untouched
+    size_t n_out = 0, n_pieces = 0, piece_st = 0, next = 0;
+    struct gn_stroke_pos pos = {src->head, 0};
+    bool cut = false;
+    for (size_t i = 0; i < n_hits; i++) {
+        size_t seg = hits[i].seg;
+        struct gn_vec2 p, q;
+        stroke_pos_seg(grid_entry_pos(src, hits[i]), &p, &q);
+        float t0, t1;
+        if (!capsule_clip(p, q, a, b, reach, &t0, &t1)) {
+            continue;
+        }
+        cut = true;
+
+        for (; next <= seg; next++) {
+            out[n_out++] = *stroke_pos_pt(pos);
+            stroke_pos_next(&pos);
+        }
+        if (t0 > 0.f) {
+            out[n_out++] = gn_vec2_lerp(p, q, t0);
+        }
+        if (n_out - piece_st >= 2 &&
+            polyline_length(&out[piece_st], n_out - piece_st) >=
+                STROKE_CUT_MIN_LENGTH) {
+            piece_ends[n_pieces++] = n_out;
+            piece_st = n_out;
+        }
+        n_out = piece_st;
 
-        if (stroke->pts == NULL) {
-            fprintf(stderr, "Failed to allocate memory for more strokes\n");
+        if (t1 < 1.f) {
+            out[n_out++] = gn_vec2_lerp(p, q, t1);
+        }
+    }
+    if (!cut) {
+        goto out;
+    }
+    for (; next < src->n_pts; next++) {
+        out[n_out++] = *stroke_pos_pt(pos);
+        stroke_pos_next(&pos);
+    }
+    if (n_out - piece_st >= 2 &&
+        polyline_length(&out[piece_st], n_out - piece_st) >=
+            STROKE_CUT_MIN_LENGTH) {
+        piece_ends[n_pieces++] = n_out;
+    }
+
+    // the stroke is kept for undo and replaced by a new stroke per piece,
+    // which go on top of the z order like every stroke added to the canvas
+    float width = stroke->width;
+    int32_t color = stroke->color;
+    history_erase(state, stroke);
+    piece_st = 0;
+    for (size_t i = 0; i < n_pieces; i++) {
+        struct gn_stroke *piece = create_stroke(state, width, color);
+        size_t n = piece_ends[i] - piece_st;
+        if (piece == NULL) {
+            break;
+        }
+        if (!set_stroke_points(piece, &out[piece_st], n)) {
+            remove_stroke(state, piece);
+            break;
+        }
+        index_stroke(state, piece);
+        canvas_upload(state, piece);
+        history_add(state, piece);
+        piece_st = piece_ends[i];
+    }
+
+out:
+    destroy_stroke(&flat);
+    free(lines);
+    free(out);
+    free(piece_ends);
+}
+
+struct fit_ctx {
+    // samples of the input and their parameters on the current curve
+    const struct gn_vec2 *d;
+    float *u;
+    // control points, each curve adding the three after its first point
+    struct gn_vec2 *out;
+    size_t n_out, c_out;
+    bool failed;
+};
+
+static void fit_push(struct fit_ctx *ctx, const struct gn_vec2 bez[4]) {
+    if (ctx->n_out + 3 > ctx->c_out) {
+        size_t c_out = ctx->c_out * 2 + 3;
+        struct gn_vec2 *out = realloc(ctx->out, c_out * sizeof(*out));
+        if (out == NULL) {
+            ctx->failed = true;
             return;
         }
+        ctx->out = out;
+        ctx->c_out = c_out;
     }
+    for (size_t i = 1; i < 4; i++) {
+        ctx->out[ctx->n_out++] = bez[i];
+    }
+}
 
-    stroke->pts[stroke->n_pts].x = x;
-    stroke->pts[stroke->n_pts].y = y;
-    stroke->n_pts++;
+static void chord_params(struct fit_ctx *ctx, size_t first, size_t last) {
+    ctx->u[first] = 0.f;
+    for (size_t i = first + 1; i <= last; i++) {
+        ctx->u[i] = ctx->u[i - 1] +
+                    gn_vec2_norm(gn_vec2_minus(ctx->d[i], ctx->d[i - 1]));
+    }
+    for (size_t i = first + 1; i <= last; i++) {
+        ctx->u[i] /= ctx->u[last];
+    }
 }
 
-void finish_stroke(struct gn_stroke *stroke) {
-    if (stroke->seg_st + 1 < stroke->n_pts) {
-        stroke->seg_st++;
-        stroke->pts[stroke->seg_st] = stroke->pts[stroke->n_pts - 1];
-        stroke->n_pts = stroke->seg_st + 1;
+// least squares fit of the inner control points along the end tangents,
+// falling back to a third of the chord when that fails
+static void fit_bezier(struct fit_ctx *ctx, size_t first, size_t last,
+                       struct gn_vec2 t1, struct gn_vec2 t2,
+                       struct gn_vec2 bez[4]) {
+    struct gn_vec2 p0 = ctx->d[first], p3 = ctx->d[last];
+    float c00 = 0.f, c01 = 0.f, c11 = 0.f, x0 = 0.f, x1 = 0.f;
+    for (size_t i = first; i <= last; i++) {
+        float t = ctx->u[i], s = 1.f - t;
+        float b0 = s * s * s, b1 = 3.f * s * s * t, b2 = 3.f * s * t * t,
+              b3 = t * t * t;
+        struct gn_vec2 a1 = gn_vec2_scale(t1, b1);
+        struct gn_vec2 a2 = gn_vec2_scale(t2, b2);
+        struct gn_vec2 rest =
+            gn_vec2_minus(ctx->d[i], gn_vec2_add(gn_vec2_scale(p0, b0 + b1),
+                                                 gn_vec2_scale(p3, b2 + b3)));
+        c00 += gn_vec2_dot(a1, a1);
+        c01 += gn_vec2_dot(a1, a2);
+        c11 += gn_vec2_dot(a2, a2);
+        x0 += gn_vec2_dot(a1, rest);
+        x1 += gn_vec2_dot(a2, rest);
     }
+
+    float len = gn_vec2_norm(gn_vec2_minus(p3, p0));
+    float det = c00 * c11 - c01 * c01;
+    float al = 0.f, ar = 0.f;
+    if (det != 0.f) {
+        al = (x0 * c11 - x1 * c01) / det;
+        ar = (c00 * x1 - c01 * x0) / det;
+    }
+    if (!(al > len * 1e-6f) || !(ar > len * 1e-6f)) {
+        al = ar = len / 3.f;
+    }
+    bez[0] = p0;
+    bez[1] = gn_vec2_add(p0, gn_vec2_scale(t1, al));
+    bez[2] = gn_vec2_add(p3, gn_vec2_scale(t2, ar));
+    bez[3] = p3;
 }
 
-void destroy_stroke(struct gn_stroke *stroke) {
-    if (stroke == NULL) {
+// largest squared distance of the samples, and of the curve halfway between
+// them, from the input. the curve loops between samples whose parameters are
+// out of order.
+static float fit_error(struct fit_ctx *ctx, size_t first, size_t last,
+                       const struct gn_vec2 bez[4], size_t *split) {
+    float max_err = 0.f;
+    *split = (first + last) / 2;
+    for (size_t i = first + 1; i <= last; i++) {
+        if (ctx->u[i] < ctx->u[i - 1]) {
+            return INFINITY;
+        }
+        struct gn_vec2 mid =
+            gn_cubic_eval(bez, (ctx->u[i - 1] + ctx->u[i]) * 0.5f);
+        float err = gn_vec2_seg_dist_sq(mid, ctx->d[i - 1], ctx->d[i]);
+        if (i < last) {
+            err = fmaxf(err, gn_vec2_norm_sq(gn_vec2_minus(
+                                 gn_cubic_eval(bez, ctx->u[i]), ctx->d[i])));
+        }
+        if (err > max_err) {
+            max_err = err;
+            *split = i < last ? i : i - 1;
+        }
+    }
+    return max_err;
+}
+
+// moves every parameter a newton step closer to the nearest point of the curve
+static void fit_reparameterize(struct fit_ctx *ctx, size_t first, size_t last,
+                               const struct gn_vec2 bez[4]) {
+    struct gn_vec2 d1[3], d2[2];
+    for (size_t i = 0; i < 3; i++) {
+        d1[i] = gn_vec2_scale(gn_vec2_minus(bez[i + 1], bez[i]), 3.f);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        d2[i] = gn_vec2_scale(gn_vec2_minus(d1[i + 1], d1[i]), 2.f);
+    }
+    for (size_t i = first + 1; i < last; i++) {
+        float t = ctx->u[i], s = 1.f - t;
+        struct gn_vec2 diff = gn_vec2_minus(gn_cubic_eval(bez, t), ctx->d[i]);
+        struct gn_vec2 q1 = gn_vec2_add(
+            gn_vec2_add(gn_vec2_scale(d1[0], s * s),
+                        gn_vec2_scale(d1[1], 2.f * s * t)),
+            gn_vec2_scale(d1[2], t * t));
+        struct gn_vec2 q2 =
+            gn_vec2_add(gn_vec2_scale(d2[0], s), gn_vec2_scale(d2[1], t));
+        float den = gn_vec2_dot(q1, q1) + gn_vec2_dot(diff, q2);
+        if (den != 0.f) {
+            t -= gn_vec2_dot(diff, q1) / den;
+            ctx->u[i] = fminf(fmaxf(t, 0.f), 1.f);
+        }
+    }
+}
+
+// direction from sample i towards sample end, taken over the corner span so
+// the staircase of integer positions does not throw it off
+static struct gn_vec2 fit_tangent(const struct gn_vec2 *d, size_t i,
+                                  size_t end) {
+    size_t j = i;
+    float len = 0.f;
+    while (j != end && len < STROKE_FIT_CORNER_SPAN) {
+        size_t next = j < end ? j + 1 : j - 1;
+        len += gn_vec2_norm(gn_vec2_minus(d[next], d[j]));
+        j = next;
+    }
+    return gn_vec2_normalize(gn_vec2_minus(d[j], d[i]));
+}
+
+// fits samples first to last, leaving the ends along unit tangents t1 and t2
+static void fit_cubic(struct fit_ctx *ctx, size_t first, size_t last,
+                      struct gn_vec2 t1, struct gn_vec2 t2) {
+    const float max_err = STROKE_FIT_ERROR * STROKE_FIT_ERROR;
+    struct gn_vec2 bez[4];
+    if (ctx->failed) {
+        return;
+    }
+    if (last - first == 1) {
+        float third =
+            gn_vec2_norm(gn_vec2_minus(ctx->d[last], ctx->d[first])) / 3.f;
+        bez[0] = ctx->d[first];
+        bez[1] = gn_vec2_add(bez[0], gn_vec2_scale(t1, third));
+        bez[3] = ctx->d[last];
+        bez[2] = gn_vec2_add(bez[3], gn_vec2_scale(t2, third));
+        fit_push(ctx, bez);
+        return;
+    }
+
+    chord_params(ctx, first, last);
+    fit_bezier(ctx, first, last, t1, t2, bez);
+    size_t split;
+    float err = fit_error(ctx, first, last, bez, &split);
+    // close fits are often only badly parameterized
+    for (size_t i = 0; i < STROKE_FIT_ITERATIONS && err >= max_err &&
+                       err < max_err * 4.f;
+         i++) {
+        fit_reparameterize(ctx, first, last, bez);
+        fit_bezier(ctx, first, last, t1, t2, bez);
+        err = fit_error(ctx, first, last, bez, &split);
+    }
+    if (err < max_err) {
+        fit_push(ctx, bez);
         return;
     }
-    if (stroke->pts != NULL) {
-        free(stroke->pts);
+
+    struct gn_vec2 center =
+        gn_vec2_normalize(gn_vec2_minus(fit_tangent(ctx->d, split, first),
+                                        fit_tangent(ctx->d, split, last)));
+    if (center.x == 0.f && center.y == 0.f) {
+        center = fit_tangent(ctx->d, split, first);
+    }
+    fit_cubic(ctx, first, split, t1, center);
+    fit_cubic(ctx, split, last, gn_vec2_scale(center, -1.f), t2);
+}
+
+// fits the samples between two corners
+static void fit_run(struct fit_ctx *ctx, size_t first, size_t last) {
+    fit_cubic(ctx, first, last, fit_tangent(ctx->d, first, last),
+              fit_tangent(ctx->d, last, first));
+}
+
+// picks the sharpest sample of every stretch turning more than the corner
+// threshold. u holds the arc length of every sample.
+static size_t find_corners(const struct gn_vec2 *d, const float *u, size_t n,
+                           size_t *corners) {
+    size_t n_corners = 0, j = 0, k = 0, best = 0;
+    float best_cos = INFINITY;
+    for (size_t i = 1; i + 1 < n; i++) {
+        while (u[i] - u[j + 1] >= STROKE_FIT_CORNER_SPAN) {
+            j++;
+        }
+        while (k + 1 < n && (k <= i || u[k] - u[i] < STROKE_FIT_CORNER_SPAN)) {
+            k++;
+        }
+        float cos = gn_vec2_dot(gn_vec2_normalize(gn_vec2_minus(d[i], d[j])),
+                                gn_vec2_normalize(gn_vec2_minus(d[k], d[i])));
+        if (cos < STROKE_FIT_CORNER_COS) {
+            if (cos < best_cos) {
+                best_cos = cos;
+                best = i;
+            }
+        } else if (best_cos != INFINITY) {
+            corners[n_corners++] = best;
+            best_cos = INFINITY;
+        }
+    }
+    if (best_cos != INFINITY) {
+        corners[n_corners++] = best;
+    }
+    return n_corners;
+}
+
+void fit_stroke(struct gn_stroke *stroke, struct gn_box *damage) {
+    struct gn_vec2 *input = stroke->input;
+    size_t n_input = stroke->n_input;
+    stroke->input = NULL;
+    stroke->n_input = stroke->c_input = 0;
+    stroke->keep_input = false;
+
+    struct gn_vec2 *d = NULL;
+    float *u = NULL;
+    size_t *corners = NULL;
+    struct fit_ctx ctx = {0};
+    if (!stroke->finished || stroke->curved || stroke->n_pts < 3 ||
+        n_input < 2) {
+        goto out;
+    }
+
+    // consecutive samples are distinct and at most the spacing apart, so
+    // chord lengths stay close to arc lengths
+    size_t c_samples = 1;
+    for (size_t i = 1; i < n_input; i++) {
+        float len = gn_vec2_norm(gn_vec2_minus(input[i], input[i - 1]));
+        c_samples += (size_t)ceilf(len / STROKE_FIT_SPACING);
+    }
+    d = malloc(c_samples * sizeof(*d));
+    u = malloc(c_samples * sizeof(*u));
+    corners = malloc(c_samples * sizeof(*corners));
+    if (d == NULL || u == NULL || corners == NULL) {
+        fprintf(stderr, "Failed to allocate memory to fit stroke\n");
+        goto out;
+    }
+
+    size_t n = 0;
+    d[n] = input[0];
+    u[n++] = 0.f;
+    for (size_t i = 1; i < n_input; i++) {
+        struct gn_vec2 st = input[i - 1];
+        float len = gn_vec2_norm(gn_vec2_minus(input[i], st));
+        if (len == 0.f) {
+            continue;
+        }
+        size_t k = (size_t)ceilf(len / STROKE_FIT_SPACING);
+        float arc = u[n - 1];
+        for (size_t j = 1; j <= k; j++) {
+            d[n] = j < k ? gn_vec2_lerp(st, input[i], (float)j / k) : input[i];
+            u[n++] = arc + len * j / k;
+        }
+    }
+    if (n < 2) {
+        goto out;
+    }
+    size_t n_corners = find_corners(d, u, n, corners);
+
+    ctx = (struct fit_ctx){
+        .d = d,
+        .u = u,
+        .out = malloc(stroke->n_pts * sizeof(struct gn_vec2)),
+        .c_out = stroke->n_pts,
+    };
+    if (ctx.out == NULL) {
+        fprintf(stderr, "Failed to allocate memory to fit stroke\n");
+        goto out;
+    }
+    ctx.out[ctx.n_out++] = d[0];
+    size_t first = 0;
+    for (size_t i = 0; i < n_corners; i++) {
+        fit_run(&ctx, first, corners[i]);
+        first = corners[i];
     }
+    fit_run(&ctx, first, n - 1);
+    if (ctx.failed) {
+        fprintf(stderr, "Failed to allocate memory to fit stroke\n");
+        goto out;
+    }
+    // scribbles full of corners may not get any smaller
+    if (ctx.n_out >= stroke->n_pts) {
+        goto out;
+    }
+
+    struct gn_box old = stroke->bbox;
+    if (set_stroke_points(stroke, ctx.out, ctx.n_out)) {
+        stroke->curved = true;
+    }
+    if (damage != NULL) {
+        *damage = gn_box_union(*damage, gn_box_union(old, stroke->bbox));
+    }
+
+out:
+    free(input);
+    free(d);
+    free(u);
+    free(corners);
+    free(ctx.out);
 }
@@ -0,0 +1,133 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stroke.h"
+#include "table.h"
+
+#define GN_TABLE_NO_SLOT UINT32_MAX
+
+void init_stroke_table(struct gn_stroke_table *table) {
+    *table = (struct gn_stroke_table){.free = GN_TABLE_NO_SLOT};
+    wl_list_init(&table->order);
+    wl_list_init(&table->hidden);
+}
+
+static bool stroke_table_grow(struct gn_stroke_table *table) {
+    if (table->n_slots >= GN_TABLE_NO_SLOT - GN_TABLE_BLOCK_STROKES) {
+        return false;
+    }
+    if (table->n_blocks == table->c_blocks) {
+        size_t c_blocks =
+            table->c_blocks == 0 ? GN_TABLE_INIT_BLOCKS : table->c_blocks * 2;
+        struct gn_stroke **blocks =
+            realloc(table->blocks, c_blocks * sizeof(struct gn_stroke *));
+        if (blocks == NULL) {
+            return false;
+        }
+        table->blocks = blocks;
+        table->c_blocks = c_blocks;
+    }
+    struct gn_stroke *block =
+        malloc(GN_TABLE_BLOCK_STROKES * sizeof(struct gn_stroke));
+    if (block == NULL) {
+        return false;
+    }
+    table->blocks[table->n_blocks++] = block;
+    return true;
+}
+
+struct gn_stroke *stroke_table_add(struct gn_stroke_table *table) {
+    struct gn_stroke_handle handle;
+    if (table->free != GN_TABLE_NO_SLOT) {
+        struct gn_stroke *slot = stroke_table_at(table, table->free);
+        table->free = slot->next_free;
+        handle = slot->handle;
+    } else {
+        if (table->n_slots == table->n_blocks * GN_TABLE_BLOCK_STROKES &&
+            !stroke_table_grow(table)) {
+            fprintf(stderr, "Failed to allocate memory for more strokes\n");
+            return NULL;
+        }
+        handle = (struct gn_stroke_handle){table->n_slots++, 1};
+    }
+
+    struct gn_stroke *stroke = stroke_table_at(table, handle.ind);
+    *stroke = (struct gn_stroke){.handle = handle};
+    wl_list_insert(table->order.prev, &stroke->link);
+    table->n_live++;
+    return stroke;
+}
+
+void stroke_table_remove(struct gn_stroke_table *table,
+                         struct gn_stroke *stroke) {
+    struct gn_stroke_handle handle = stroke->handle;
+    if (!stroke->hidden) {
+        table->n_live--;
+    }
+    wl_list_remove(&stroke->link);
+    // handles to the stroke go stale
+    handle.gen = handle.gen == UINT32_MAX ? 1 : handle.gen + 1;
+    *stroke = (struct gn_stroke){
+        .handle = handle,
+        .removed = true,
+        .next_free = table->free,
+    };
+    table->free = handle.ind;
+}
+
+void stroke_table_hide(struct gn_stroke_table *table,
+                       struct gn_stroke *stroke) {
+    wl_list_remove(&stroke->link);
+    wl_list_insert(&table->hidden, &stroke->link);
+    stroke->hidden = true;
+    table->n_live--;
+}
+
+void stroke_table_show(struct gn_stroke_table *table,
+                       struct gn_stroke *stroke) {
+    wl_list_remove(&stroke->link);
+    wl_list_insert(table->order.prev, &stroke->link);
+    stroke->hidden = false;
+    table->n_live++;
+}
+
+void stroke_table_raise(struct gn_stroke_table *table,
+                        struct gn_stroke *stroke) {
+    wl_list_remove(&stroke->link);
+    wl_list_insert(table->order.prev, &stroke->link);
+}
+
+struct gn_stroke *stroke_table_at(struct gn_stroke_table *table,
+                                  uint32_t ind) {
+    return &table->blocks[ind / GN_TABLE_BLOCK_STROKES]
+                         [ind % GN_TABLE_BLOCK_STROKES];
+}
+
+struct gn_stroke *stroke_table_get(struct gn_stroke_table *table,
+                                   struct gn_stroke_handle handle) {
+    if (handle.ind >= table->n_slots) {
+        return NULL;
+    }
+    struct gn_stroke *stroke = stroke_table_at(table, handle.ind);
+    if (stroke->removed || stroke->handle.gen != handle.gen) {
+        return NULL;
+    }
+    return stroke;
+}
+
+struct gn_stroke *stroke_table_last(struct gn_stroke_table *table) {
+    if (wl_list_empty(&table->order)) {
+        return NULL;
+    }
+    struct gn_stroke *stroke = wl_container_of(table->order.prev, stroke, link);
+    return stroke;
+}
+
+void cleanup_stroke_table(struct gn_stroke_table *table) {
+    for (size_t i = 0; i < table->n_blocks; i++) {
+        free(table->blocks[i]);
+    }
+    free(table->blocks);
+    init_stroke_table(table);
+}
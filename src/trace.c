@@ -0,0 +1,474 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client-protocol.h>
+
+#include "glassnote.h"
+#include "seat.h"
+#include "session.h"
+#include "stroke.h"
+#include "trace.h"
+
+// u8 type, then at most five 64 bit uvarints
+#define GN_TRACE_MAX_EVENT_SZ 51
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// uvarint fields of the events of the seats, by type
+static const size_t n_seat_fields[] = {
+    [GN_TRACE_MOTION] = 3,
+    [GN_TRACE_BUTTON] = 3,
+    [GN_TRACE_KEY] = 3,
+    [GN_TRACE_TOUCH_DOWN] = 4,
+    [GN_TRACE_TOUCH_MOTION] = 4,
+    [GN_TRACE_TOUCH_UP] = 2,
+    [GN_TRACE_TOUCH_FRAME] = 1,
+    [GN_TRACE_TOUCH_CANCEL] = 1,
+};
+
+static uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint64_t z) {
+    return (int32_t)((uint32_t)z >> 1) ^ -(int32_t)(z & 1);
+}
+
+// starts an event of type at the current time, returning where its fields go
+static size_t begin_event(struct gn_trace *trace, uint8_t *p,
+                          enum gn_trace_type type) {
+    uint64_t t = now_us();
+    p[0] = type;
+    size_t n = 1 + put_uvarint(&p[1], t - trace->last_us);
+    trace->last_us = t;
+    return n;
+}
+
+static void write_event(struct gn_trace *trace, const uint8_t *p, size_t n) {
+    // a failed write shows in ferror once the trace is stopped
+    fwrite(p, 1, n, trace->file);
+}
+
+bool start_trace(struct gn_state *state, const char *path) {
+    struct gn_trace *trace = &state->trace;
+    size_t session_sz;
+    uint8_t *session = encode_session(state, &session_sz);
+    if (session == NULL) {
+        return false;
+    }
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        free(session);
+        return false;
+    }
+
+    uint8_t header[GN_TRACE_HEADER_SZ];
+    memcpy(header, GN_TRACE_MAGIC, 4);
+    put_u32(&header[4], GN_TRACE_VERSION);
+    put_f32(&header[8], state->cur_stroke_width);
+    put_u32(&header[12], state->color_ind);
+    for (size_t i = 0; i < GN_TRACE_N_COLORS; i++) {
+        put_u32(&header[16 + i * 4], (uint32_t)state->colors[i]);
+    }
+    put_u32(&header[36], state->tool);
+    put_f32(&header[40], state->eraser_radius);
+    put_u32(&header[44], state->fit_curves ? GN_TRACE_FLAG_FIT_CURVES : 0);
+    put_u64(&header[48], state->history.budget);
+    put_u64(&header[56], session_sz);
+    bool ok = fwrite(header, 1, sizeof(header), trace->file) ==
+                  sizeof(header) &&
+              fwrite(session, 1, session_sz, trace->file) == session_sz;
+    free(session);
+    if (!ok) {
+        fprintf(stderr, "Failed to write trace %s\n", path);
+        fclose(trace->file);
+        trace->file = NULL;
+        return false;
+    }
+    trace->last_us = now_us();
+    return true;
+}
+
+void trace_configure(struct gn_state *state, uint32_t width, uint32_t height) {
+    struct gn_trace *trace = &state->trace;
+    if (trace->file == NULL) {
+        return;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, GN_TRACE_CONFIGURE);
+    n += put_uvarint(&p[n], width);
+    n += put_uvarint(&p[n], height);
+    write_event(trace, p, n);
+}
+
+// the position relative to the one put before
+static size_t put_position(struct gn_trace *trace, uint8_t *p, int32_t x,
+                           int32_t y) {
+    size_t n = put_uvarint(
+        p, zigzag((int32_t)((uint32_t)x - (uint32_t)trace->last_x)));
+    n += put_uvarint(
+        &p[n], zigzag((int32_t)((uint32_t)y - (uint32_t)trace->last_y)));
+    trace->last_x = x;
+    trace->last_y = y;
+    return n;
+}
+
+void trace_motion(struct gn_seat *seat, int32_t x, int32_t y) {
+    struct gn_trace *trace = &seat->state->trace;
+    if (trace->file == NULL) {
+        return;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, GN_TRACE_MOTION);
+    n += put_uvarint(&p[n], seat->id);
+    n += put_position(trace, &p[n], x, y);
+    write_event(trace, p, n);
+}
+
+void trace_button(struct gn_seat *seat, uint32_t button, uint32_t state) {
+    struct gn_trace *trace = &seat->state->trace;
+    if (trace->file == NULL) {
+        return;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, GN_TRACE_BUTTON);
+    n += put_uvarint(&p[n], seat->id);
+    n += put_uvarint(&p[n], button);
+    n += put_uvarint(&p[n], state);
+    write_event(trace, p, n);
+}
+
+void trace_key(struct gn_seat *seat, uint32_t keysym, uint32_t state) {
+    struct gn_trace *trace = &seat->state->trace;
+    if (trace->file == NULL) {
+        return;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, GN_TRACE_KEY);
+    n += put_uvarint(&p[n], seat->id);
+    n += put_uvarint(&p[n], keysym);
+    n += put_uvarint(&p[n], state);
+    write_event(trace, p, n);
+}
+
+void trace_touch(struct gn_seat *seat, enum gn_trace_type type, int32_t id,
+                 int32_t x, int32_t y) {
+    struct gn_trace *trace = &seat->state->trace;
+    if (trace->file == NULL) {
+        return;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, type);
+    n += put_uvarint(&p[n], seat->id);
+    n += put_uvarint(&p[n], zigzag(id));
+    n += put_position(trace, &p[n], x, y);
+    write_event(trace, p, n);
+}
+
+void trace_touch_up(struct gn_seat *seat, int32_t id) {
+    struct gn_trace *trace = &seat->state->trace;
+    if (trace->file == NULL) {
+        return;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, GN_TRACE_TOUCH_UP);
+    n += put_uvarint(&p[n], seat->id);
+    n += put_uvarint(&p[n], zigzag(id));
+    write_event(trace, p, n);
+}
+
+void trace_touch_frame(struct gn_seat *seat, enum gn_trace_type type) {
+    struct gn_trace *trace = &seat->state->trace;
+    if (trace->file == NULL) {
+        return;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, type);
+    n += put_uvarint(&p[n], seat->id);
+    write_event(trace, p, n);
+}
+
+bool stop_trace(struct gn_state *state) {
+    struct gn_trace *trace = &state->trace;
+    if (trace->file == NULL) {
+        return false;
+    }
+    uint8_t p[GN_TRACE_MAX_EVENT_SZ];
+    size_t n = begin_event(trace, p, GN_TRACE_END);
+    put_u32(&p[n], hash_strokes(state));
+    write_event(trace, p, n + 4);
+
+    bool ok = !ferror(trace->file);
+    ok = fclose(trace->file) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Failed to write trace\n");
+    }
+    *trace = (struct gn_trace){0};
+    return ok;
+}
+
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t n) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t hash_strokes(struct gn_state *state) {
+    uint32_t hash = 2166136261u;
+    struct gn_stroke *stroke;
+    wl_list_for_each(stroke, &state->strokes.order, link) {
+        uint8_t fields[13];
+        put_u32(&fields[0], stroke->n_pts);
+        put_f32(&fields[4], stroke->width);
+        put_u32(&fields[8], (uint32_t)stroke->color);
+        fields[12] = stroke->curved;
+        hash = hash_bytes(hash, fields, sizeof(fields));
+
+        bool packed = stroke_is_packed(stroke);
+        if (packed && !unpack_stroke(stroke)) {
+            continue;
+        }
+        struct gn_stroke_pos pos = {stroke->head, 0};
+        for (size_t i = 0; i < stroke->n_pts; i++, stroke_pos_next(&pos)) {
+            struct gn_vec2 pt = *stroke_pos_pt(pos);
+            uint8_t bits[8];
+            put_f32(&bits[0], pt.x);
+            put_f32(&bits[4], pt.y);
+            hash = hash_bytes(hash, bits, sizeof(bits));
+        }
+        if (packed) {
+            repack_stroke(stroke);
+        }
+    }
+    return hash;
+}
+
+bool open_trace(struct gn_trace_reader *reader, struct gn_state *state,
+                const char *path) {
+    *reader = (struct gn_trace_reader){0};
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < GN_TRACE_HEADER_SZ) {
+        fprintf(stderr, "Failed to load trace %s\n", path);
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    const uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    uint64_t session_sz = get_u64(&file[56]);
+    uint32_t version = get_u32(&file[4]);
+    if (memcmp(file, GN_TRACE_MAGIC, 4) != 0 || version == 0 ||
+        version > GN_TRACE_VERSION ||
+        session_sz > size - GN_TRACE_HEADER_SZ) {
+        fprintf(stderr, "Failed to load trace %s, unknown format\n", path);
+        munmap((void *)file, size);
+        return false;
+    }
+    state->cur_stroke_width = get_f32(&file[8]);
+    state->color_ind = get_u32(&file[12]) % GN_TRACE_N_COLORS;
+    for (size_t i = 0; i < GN_TRACE_N_COLORS; i++) {
+        state->colors[i] = (int32_t)get_u32(&file[16 + i * 4]);
+    }
+    uint32_t tool = get_u32(&file[36]);
+    state->tool = tool <= GN_TOOL_PIXEL_ERASER ? tool : GN_TOOL_PEN;
+    state->eraser_radius = get_f32(&file[40]);
+    state->fit_curves = get_u32(&file[44]) & GN_TRACE_FLAG_FIT_CURVES;
+    state->history.budget = get_u64(&file[48]);
+    if (session_sz > 0 &&
+        load_session_data(state, &file[GN_TRACE_HEADER_SZ], session_sz, path,
+                          NULL) != GN_SESSION_LOADED) {
+        munmap((void *)file, size);
+        return false;
+    }
+
+    reader->data = file;
+    reader->size = size;
+    reader->p = &file[GN_TRACE_HEADER_SZ + session_sz];
+    return true;
+}
+
+int next_trace_event(struct gn_trace_reader *reader,
+                     struct gn_trace_event *event) {
+    const uint8_t *end = reader->data + reader->size;
+    if (reader->p == end) {
+        return 0;
+    }
+    const uint8_t *p = reader->p;
+    uint64_t type = *p++, dt, v[4];
+    if (!get_uvarint(&p, end, &dt)) {
+        goto bad;
+    }
+    *event = (struct gn_trace_event){
+        .type = type,
+        .time_us = reader->time_us + dt,
+    };
+
+    switch (type) {
+    case GN_TRACE_CONFIGURE:
+        if (!get_uvarint(&p, end, &v[0]) || !get_uvarint(&p, end, &v[1]) ||
+            v[0] > INT32_MAX || v[1] > INT32_MAX) {
+            goto bad;
+        }
+        event->x = v[0];
+        event->y = v[1];
+        break;
+    case GN_TRACE_MOTION:
+    case GN_TRACE_BUTTON:
+    case GN_TRACE_KEY:
+    case GN_TRACE_TOUCH_DOWN:
+    case GN_TRACE_TOUCH_MOTION:
+    case GN_TRACE_TOUCH_UP:
+    case GN_TRACE_TOUCH_FRAME:
+    case GN_TRACE_TOUCH_CANCEL:
+        for (size_t i = 0; i < n_seat_fields[type]; i++) {
+            if (!get_uvarint(&p, end, &v[i]) || v[i] > UINT32_MAX) {
+                goto bad;
+            }
+        }
+        if (v[0] >= GN_TRACE_MAX_SEATS) {
+            goto bad;
+        }
+        event->seat = v[0];
+        if (type == GN_TRACE_MOTION) {
+            reader->x = (int32_t)((uint32_t)reader->x + unzigzag(v[1]));
+            reader->y = (int32_t)((uint32_t)reader->y + unzigzag(v[2]));
+            event->x = reader->x;
+            event->y = reader->y;
+        } else if (type == GN_TRACE_TOUCH_DOWN ||
+                   type == GN_TRACE_TOUCH_MOTION) {
+            event->code = unzigzag(v[1]);
+            reader->x = (int32_t)((uint32_t)reader->x + unzigzag(v[2]));
+            reader->y = (int32_t)((uint32_t)reader->y + unzigzag(v[3]));
+            event->x = reader->x;
+            event->y = reader->y;
+        } else if (type == GN_TRACE_TOUCH_UP) {
+            event->code = unzigzag(v[1]);
+        } else if (type == GN_TRACE_BUTTON || type == GN_TRACE_KEY) {
+            event->code = v[1];
+            event->state = v[2];
+        }
+        break;
+    case GN_TRACE_END:
+        if (end - p < 4) {
+            return 0;
+        }
+        event->code = get_u32(p);
+        p += 4;
+        break;
+    default:
+        goto bad;
+    }
+    reader->p = p;
+    reader->time_us = event->time_us;
+    return 1;
+
+bad:
+    // an event cut short is where the recording stopped
+    return p == end ? 0 : -1;
+}
+
+static struct gn_seat *replay_seat(struct gn_state *state, uint32_t id) {
+    struct gn_seat *seat;
+    wl_list_for_each(seat, &state->seats, link) {
+        if (seat->id == id) {
+            return seat;
+        }
+    }
+    seat = calloc(1, sizeof(struct gn_seat));
+    if (seat == NULL) {
+        fprintf(stderr, "Failed to allocate memory for seat\n");
+        return NULL;
+    }
+    seat->state = state;
+    seat->id = id;
+    wl_list_insert(&state->seats, &seat->link);
+    return seat;
+}
+
+void replay_trace_event(struct gn_state *state,
+                        const struct gn_trace_event *event) {
+    if (event->type == GN_TRACE_CONFIGURE || event->type == GN_TRACE_END) {
+        return;
+    }
+    struct gn_seat *seat = replay_seat(state, event->seat);
+    if (seat == NULL) {
+        return;
+    }
+
+    // as the wl_pointer, wl_keyboard and wl_touch listeners do
+    struct gn_vec2 pt = {wl_fixed_to_double(event->x),
+                         wl_fixed_to_double(event->y)};
+    switch (event->type) {
+    case GN_TRACE_MOTION:;
+        struct gn_vec2 prev_loc = seat->pointer_loc;
+        seat->pointer_loc = pt;
+        seat_handle_moved(seat, prev_loc);
+        if (state->predict_ms > 0.f) {
+            // replays run on the trace's clock
+            seat_sample_motion(seat, event->time_us, event->time_us * 1000,
+                               seat->pointer_loc);
+        }
+        break;
+    case GN_TRACE_BUTTON:
+        if (event->state == WL_POINTER_BUTTON_STATE_PRESSED) {
+            seat_handle_pressed(seat);
+        } else if (event->state == WL_POINTER_BUTTON_STATE_RELEASED) {
+            seat_handle_released(seat);
+        }
+        break;
+    case GN_TRACE_KEY:
+        if (event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+            seat_handle_key(seat, event->code);
+        }
+        break;
+    case GN_TRACE_TOUCH_DOWN:
+        seat_handle_touch_down(seat, (int32_t)event->code, pt);
+        break;
+    case GN_TRACE_TOUCH_MOTION:
+        seat_handle_touch_motion(seat, (int32_t)event->code, pt);
+        break;
+    case GN_TRACE_TOUCH_UP:
+        seat_handle_touch_up(seat, (int32_t)event->code);
+        break;
+    case GN_TRACE_TOUCH_FRAME:
+        seat_handle_touch_frame(seat);
+        break;
+    case GN_TRACE_TOUCH_CANCEL:
+        seat_handle_touch_cancel(seat);
+        break;
+    default:
+        break;
+    }
+}
+
+void close_trace(struct gn_trace_reader *reader) {
+    if (reader->data != NULL) {
+        munmap((void *)reader->data, reader->size);
+    }
+    *reader = (struct gn_trace_reader){0};
+}